@@ -1,72 +1,245 @@
-use mochi::{div, text, Canvas, Color, Element, TextRenderer, Window, WindowConfig};
-use std::sync::{Arc, Mutex};
+use mochi::calloop::generic::Generic;
+use mochi::calloop::timer::{TimeoutAction, Timer};
+use mochi::calloop::{Interest, LoopHandle, Mode, PostAction};
+use mochi::{
+    div, text, AppState, Canvas, Color, Div, ElementExt, ResizeMode, RetainedTree, Text,
+    TextRenderer, Window, WindowConfig,
+};
+use chrono::{Datelike, Month, Timelike};
+use std::cell::{Cell, Ref, RefCell};
+use std::fmt::Write as _;
+use std::fs::File;
+use std::io::Read;
+use std::os::fd::OwnedFd;
+use std::process::{Command, Stdio};
+use std::rc::Rc;
 use std::time::Duration;
 
-// Global state for active window tracking
+// Active window tracking. Event sources and the draw callback all run on
+// the window's thread, so the state is shared without locks.
 #[derive(Clone)]
 struct ActiveWindowState {
-    app_name: Arc<Mutex<String>>,
-    window_title: Arc<Mutex<String>>,
+    app_name: Rc<RefCell<String>>,
+    window_title: Rc<RefCell<String>>,
+    // Bumped by every lookup; a lookup that finishes after a newer one
+    // started is dropped
+    generation: Rc<Cell<u64>>,
 }
 
 impl ActiveWindowState {
     fn new() -> Self {
         Self {
-            app_name: Arc::new(Mutex::new("Shell Explorer".to_string())),
-            window_title: Arc::new(Mutex::new(String::new())),
+            app_name: Rc::new(RefCell::new(DEFAULT_APP_NAME.to_string())),
+            window_title: Rc::new(RefCell::new(String::new())),
+            generation: Rc::new(Cell::new(0)),
         }
     }
 
-    fn get_app_name(&self) -> String {
-        self.app_name.lock().unwrap().clone()
+    fn app_name(&self) -> Ref<'_, String> {
+        self.app_name.borrow()
     }
 
-    fn set_active_window(&self, app_name: String, title: String) {
-        *self.app_name.lock().unwrap() = app_name;
-        *self.window_title.lock().unwrap() = title;
+    // True if anything changed
+    fn set_active_window(&self, app_name: String, title: String) -> bool {
+        let changed = *self.app_name.borrow() != app_name || *self.window_title.borrow() != title;
+        *self.app_name.borrow_mut() = app_name;
+        *self.window_title.borrow_mut() = title;
+        changed
+    }
+
+    // Look up the class and title of window `id` in the background, then
+    // redraw if they changed
+    fn look_up(&self, handle: &LoopHandle<'static, AppState>, id: &str, window: &mut AppState) {
+        let generation = self.generation.get() + 1;
+        self.generation.set(generation);
+        // 0x0 while nothing has focus
+        if u32::from_str_radix(id.trim_start_matches("0x"), 16).map_or(true, |id| id == 0) {
+            if self.set_active_window(DEFAULT_APP_NAME.to_string(), String::new()) {
+                window.request_redraw();
+            }
+            return;
+        }
+
+        let state = self.clone();
+        let mut xprop = Command::new("xprop");
+        xprop.args(["-id", id, "WM_CLASS", "_NET_WM_NAME", "WM_NAME"]);
+        let _ = run_in_background(handle, &mut xprop, move |output, window| {
+            let Some(output) = output else {
+                return;
+            };
+            if state.generation.get() != generation {
+                return;
+            }
+            let (app_name, title) = parse_window_info(output);
+            if state.set_active_window(app_name, title) {
+                window.request_redraw();
+            }
+        });
     }
 }
 
-// Get active window info from various sources
-fn get_active_window_info() -> Result<(String, String), Box<dyn std::error::Error>> {
-    // Try xdotool + xprop (works with XWayland and most apps on GNOME Wayland)
-    let window_id_output = std::process::Command::new("xdotool")
-        .args(["getactivewindow"])
-        .output();
-    
-    if let Ok(window_id_output) = window_id_output {
-        if window_id_output.status.success() {
-            let window_id = String::from_utf8_lossy(&window_id_output.stdout).trim().to_string();
-            
-            if !window_id.is_empty() {
-                // Get WM_CLASS using xprop
-                let class_output = std::process::Command::new("xprop")
-                    .args(["-id", &window_id, "WM_CLASS"])
-                    .output();
-                
-                if let Ok(class_output) = class_output {
-                    if class_output.status.success() {
-                        let class_str = String::from_utf8_lossy(&class_output.stdout);
-                        if let Some(app_name) = extract_wm_class(&class_str) {
-                            let title_output = std::process::Command::new("xdotool")
-                                .args(["getactivewindow", "getwindowname"])
-                                .output();
-                            
-                            let title = if let Ok(title_output) = title_output {
-                                String::from_utf8_lossy(&title_output.stdout).trim().to_string()
-                            } else {
-                                String::new()
-                            };
-                            
-                            return Ok((app_name, title));
-                        }
+// Follow focus changes. `xprop -spy` prints the root window's
+// _NET_ACTIVE_WINDOW once and then on every change, so its stdout only
+// becomes readable when there is something to look up. Without it, poll.
+fn watch_active_window(
+    handle: &LoopHandle<'static, AppState>,
+    state: ActiveWindowState,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let spy = Command::new("xprop")
+        .args(["-spy", "-root", "_NET_ACTIVE_WINDOW"])
+        .stdout(Stdio::piped())
+        .stderr(Stdio::null())
+        .spawn();
+    let (mut child, stdout) = match spy {
+        Ok(mut child) => match child.stdout.take() {
+            Some(stdout) => (child, File::from(OwnedFd::from(stdout))),
+            None => return poll_active_window(handle, state),
+        },
+        Err(_) => return poll_active_window(handle, state),
+    };
+
+    let loop_handle = handle.clone();
+    let mut line = String::new();
+    let source = Generic::new(stdout, Interest::READ, Mode::Level);
+    handle
+        .insert_source(source, move |_, stdout, window| {
+            let mut buf = [0u8; 4096];
+            let mut reader: &File = stdout.as_ref();
+            let read = match reader.read(&mut buf) {
+                Ok(read) => read,
+                Err(e) if e.kind() == std::io::ErrorKind::Interrupted => return Ok(PostAction::Continue),
+                Err(e) => return Err(e),
+            };
+            if read == 0 {
+                // xprop exited, e.g. without an X display
+                let _ = child.kill();
+                let _ = child.wait();
+                if let Err(e) = poll_active_window(&loop_handle, state.clone()) {
+                    eprintln!("Active window tracking stopped: {}", e);
+                }
+                return Ok(PostAction::Remove);
+            }
+
+            // Only the newest complete line matters
+            line.push_str(&String::from_utf8_lossy(&buf[..read]));
+            let Some(end) = line.rfind('\n') else {
+                return Ok(PostAction::Continue);
+            };
+            let latest = line[..end].lines().last().and_then(parse_window_id);
+            line.drain(..=end);
+            if let Some(id) = latest {
+                state.look_up(&loop_handle, &id, window);
+            }
+            Ok(PostAction::Continue)
+        })
+        .map_err(|e| e.error)?;
+    Ok(())
+}
+
+// Ask for the active window every 500 ms, without blocking the loop. A
+// poll is skipped while the previous one's xprop is still running.
+fn poll_active_window(
+    handle: &LoopHandle<'static, AppState>,
+    state: ActiveWindowState,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let loop_handle = handle.clone();
+    let in_flight = Rc::new(Cell::new(false));
+    handle
+        .insert_source(Timer::immediate(), move |_, _, _| {
+            let interval = TimeoutAction::ToDuration(Duration::from_millis(500));
+            if in_flight.get() {
+                return interval;
+            }
+            let state = state.clone();
+            let lookup_handle = loop_handle.clone();
+            let finished = in_flight.clone();
+            let mut xprop = Command::new("xprop");
+            xprop.args(["-root", "_NET_ACTIVE_WINDOW"]);
+            let started = run_in_background(&loop_handle, &mut xprop, move |output, window| {
+                finished.set(false);
+                if let Some(id) = output.and_then(parse_window_id) {
+                    state.look_up(&lookup_handle, &id, window);
+                }
+            });
+            in_flight.set(started.is_ok());
+            interval
+        })
+        .map_err(|e| e.error)?;
+    Ok(())
+}
+
+// Start `command` and hand its whole stdout to `done` once it exits, or
+// None if reading it failed. The loop keeps running meanwhile.
+fn run_in_background(
+    handle: &LoopHandle<'static, AppState>,
+    command: &mut Command,
+    done: impl FnOnce(Option<&str>, &mut AppState) + 'static,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let mut child = command.stdout(Stdio::piped()).stderr(Stdio::null()).spawn()?;
+    let command_name = command.get_program().to_owned();
+    let stdout = File::from(OwnedFd::from(child.stdout.take().ok_or("No stdout")?));
+    let mut output = Vec::new();
+    let mut done = Some(done);
+    handle
+        .insert_source(Generic::new(stdout, Interest::READ, Mode::Level), move |_, stdout, window| {
+            let mut buf = [0u8; 4096];
+            let mut reader: &File = stdout.as_ref();
+            match reader.read(&mut buf) {
+                Ok(0) => {
+                    let _ = child.wait();
+                    if let Some(done) = done.take() {
+                        done(Some(&String::from_utf8_lossy(&output)), window);
+                    }
+                    Ok(PostAction::Remove)
+                }
+                Ok(read) => {
+                    output.extend_from_slice(&buf[..read]);
+                    Ok(PostAction::Continue)
+                }
+                Err(e) if e.kind() == std::io::ErrorKind::Interrupted => Ok(PostAction::Continue),
+                Err(e) => {
+                    eprintln!("Reading {:?} failed: {}", command_name, e);
+                    let _ = child.kill();
+                    let _ = child.wait();
+                    if let Some(done) = done.take() {
+                        done(None, window);
                     }
+                    Ok(PostAction::Remove)
                 }
             }
-        }
-    }
-    
-    Ok(("Shell Explorer".to_string(), String::new()))
+        })
+        .map_err(|e| e.error)?;
+    Ok(())
+}
+
+const DEFAULT_APP_NAME: &str = "Shell Explorer";
+
+// The id in "_NET_ACTIVE_WINDOW(WINDOW): window id # 0x3c00007"
+fn parse_window_id(line: &str) -> Option<String> {
+    let id = line.rsplit("# ").next()?.split(',').next()?.trim();
+    id.starts_with("0x").then(|| id.to_string())
+}
+
+// App name and title from `xprop -id <id> WM_CLASS _NET_WM_NAME WM_NAME`
+fn parse_window_info(output: &str) -> (String, String) {
+    let property = |name: &str| {
+        output
+            .lines()
+            .find(|line| line.split('(').next() == Some(name) && line.contains(" = "))
+    };
+    let Some(app_name) = property("WM_CLASS").and_then(extract_wm_class) else {
+        return (DEFAULT_APP_NAME.to_string(), String::new());
+    };
+    let title = property("_NET_WM_NAME")
+        .or_else(|| property("WM_NAME"))
+        .and_then(|line| {
+            let value = line.split_once(" = ")?.1;
+            // xprop escapes quotes and backslashes in the value
+            let value = value.trim().strip_prefix('"')?.strip_suffix('"')?;
+            Some(value.replace("\\\"", "\"").replace("\\\\", "\\"))
+        })
+        .unwrap_or_default();
+    (app_name, title)
 }
 
 fn extract_wm_class(output: &str) -> Option<String> {
@@ -79,6 +252,59 @@ fn extract_wm_class(output: &str) -> Option<String> {
     }
 }
 
+// Write the clock as "Fri 16 October 14:05" into `out`, reusing its
+// buffer. chrono's format() allocates on every call.
+fn format_clock(out: &mut String, now: &chrono::DateTime<chrono::Local>) {
+    out.clear();
+    let month = Month::try_from(now.month() as u8).map_or("", |month| month.name());
+    let _ = write!(out, "{} {} {} {:02}:{:02}", now.weekday(), now.day(), month, now.hour(), now.minute());
+}
+
+// Labels are set in Inter at this size
+const LABEL_SIZE: f32 = 13.0;
+
+// Menu labels, laid out after the app name with MENU_GAP around each
+const MENU_ITEMS: [&str; 4] = ["File", "Edit", "View", "Options"];
+const MENU_GAP: i32 = 20;
+
+fn label(content: &str, x: i32, font: &str, color: Color, shadow_alpha: u8) -> Text {
+    text(content, 0, 0)
+        .at(x, 8)
+        .size(LABEL_SIZE)
+        .color(color)
+        .font(font)
+        .shadow(true)
+        .shadow_offset(1, 1)
+        .shadow_blur(2)
+        .shadow_color(Color::rgba(0, 0, 0, shadow_alpha))
+}
+
+fn build_bar(width: i32, height: i32) -> Div {
+    let menu_color = Color::rgba(40, 40, 40, 255);
+    let mut bar = div(0, 0, width, height)
+        .background(Color::rgba(255, 255, 255, 255))
+        .child(
+            text("◆", 0, 0)
+                .at(8, 8)
+                .size(14.0)
+                .color(Color::rgba(0, 0, 0, 255))
+                .font("bold")
+                .shadow(true)
+                .shadow_offset(1, 1)
+                .shadow_blur(2)
+                .shadow_color(Color::rgba(0, 0, 0, 80)),
+        )
+        .child(label("Workspace 1", 32, "semibold", Color::rgba(0, 0, 0, 255), 80))
+        .child(label("", 140, "bold", Color::rgba(0, 0, 0, 255), 80).keyed("app"));
+
+    // Menu items are positioned after the app name on the first frame
+    for item in MENU_ITEMS {
+        bar = bar.child(label(item, 140, "regular", menu_color, 70).keyed(item));
+    }
+
+    bar.child(label("", width - 120, "medium", Color::rgba(0, 0, 0, 255), 80).keyed("clock"))
+}
+
 fn main() -> Result<(), Box<dyn std::error::Error>> {
     // Load fonts
     let mut text_renderer = TextRenderer::new();
@@ -101,132 +327,59 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         decorations: false,
         transparent: false, // Test with non-transparent first
         draggable: false,
+        resize_mode: ResizeMode::Fill,
     };
 
     let mut window = Window::new(config)?;
     
-    // Active window state
+    // Active window state, updated from the window's own event loop
     let active_window_state = ActiveWindowState::new();
-    let state_clone = active_window_state.clone();
-    
-    // Spawn background thread to update active window info
-    std::thread::spawn(move || {
-        loop {
-            if let Ok(info) = get_active_window_info() {
-                state_clone.set_active_window(info.0, info.1);
-            }
-            std::thread::sleep(Duration::from_millis(500));
-        }
-    });
+    watch_active_window(&window.loop_handle(), active_window_state.clone())?;
+
+    // The bar is built once and updated in place; only labels whose text
+    // changed are repainted
+    let mut tree = RetainedTree::new();
+    let mut tree_width = 0;
+    let mut time_str = String::new();
 
     // Set up draw callback
     window.on_draw(move |canvas: &mut Canvas| {
         let width = canvas.width() as i32;
         let height = canvas.height() as i32;
-        
+
+        if tree.is_empty() || width != tree_width {
+            tree.set_root(build_bar(width, height));
+            tree_width = width;
+        }
+
         // Get current time
-        let now = chrono::Local::now();
-        let time_str = now.format("%a %-d %B %H:%M").to_string();
-        
-        // Get active app name
-        let active_app = active_window_state.get_app_name();
-
-        // Build UI tree - test with background first to see shadows
-        let ui = div(0, 0, width, height)
-            .background(Color::rgba(255,255,255, 255))
-            .child(
-                text("◆", 0, 0)
-                    .at(8, 8)
-                    .size(14.0)
-                    .color(Color::rgba(0, 0, 0, 255))
-                    .font("bold")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 80)),
-            )
-            .child(
-                text("Workspace 1", 0, 0)
-                    .at(32, 8)
-                    .size(13.0)
-                    .color(Color::rgba(0, 0, 0, 255))
-                    .font("semibold")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 80)),
-            )
-            .child(
-                text(&active_app, 0, 0)
-                    .at(140, 8)
-                    .size(13.0)
-                    .color(Color::rgba(0, 0, 0, 255))
-                    .font("bold")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 80)),
-            )
-            .child(
-                text("File", 0, 0)
-                    .at(140 + (active_app.len() as i32 * 8) + 20, 8)
-                    .size(13.0)
-                    .color(Color::rgba(40, 40, 40, 255))
-                    .font("regular")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 70)),
-            )
-            .child(
-                text("Edit", 0, 0)
-                    .at(140 + (active_app.len() as i32 * 8) + 60, 8)
-                    .size(13.0)
-                    .color(Color::rgba(40, 40, 40, 255))
-                    .font("regular")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 70)),
-            )
-            .child(
-                text("View", 0, 0)
-                    .at(140 + (active_app.len() as i32 * 8) + 100, 8)
-                    .size(13.0)
-                    .color(Color::rgba(40, 40, 40, 255))
-                    .font("regular")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 70)),
-            )
-            .child(
-                text("Options", 0, 0)
-                    .at(140 + (active_app.len() as i32 * 8) + 150, 8)
-                    .size(13.0)
-                    .color(Color::rgba(40, 40, 40, 255))
-                    .font("regular")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 70)),
-            )
-            .child(
-                text(&time_str, 0, 0)
-                    .at(width - 120, 8)
-                    .size(13.0)
-                    .color(Color::rgba(0, 0, 0, 255))
-                    .font("medium")
-                    .shadow(true)
-                    .shadow_offset(1, 1)
-                    .shadow_blur(2)
-                    .shadow_color(Color::rgba(0, 0, 0, 80)),
-            );
+        format_clock(&mut time_str, &chrono::Local::now());
+
+        // The menu follows the app name. Labels are measured in the fonts
+        // they are drawn in; runs are cached, so each string is laid out once.
+        let active_app = active_window_state.app_name();
+        let mut menu_x = 140 + text_renderer.measure(&active_app, LABEL_SIZE, "bold").0 + MENU_GAP;
+
+        if let Some(clock) = tree.find_mut::<Text>("clock") {
+            clock.set_text(&time_str);
+        }
+        if let Some(app) = tree.find_mut::<Text>("app") {
+            app.set_text(&active_app);
+        }
+        for key in MENU_ITEMS {
+            if let Some(item) = tree.find_mut::<Text>(key) {
+                item.x = menu_x;
+            }
+            menu_x += text_renderer.measure(key, LABEL_SIZE, "regular").0 + MENU_GAP;
+        }
 
         // Render the UI tree
-        ui.render(canvas, &text_renderer);
+        tree.render(canvas, &text_renderer);
     });
 
+    // The clock changes on the minute; nothing else redraws an idle bar
+    window.redraw_every(Duration::from_secs(60))?;
+
     // Run the window event loop
     window.run()
 }
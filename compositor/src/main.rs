@@ -1,19 +1,35 @@
 use std::sync::Arc;
+use std::time::Duration;
 use slog::{Drain, Logger, o};
 
+use calloop::{
+    generic::Generic,
+    timer::{TimeoutAction, Timer},
+    EventLoop, Interest, LoopHandle, Mode as TriggerMode, PostAction,
+};
 use smithay::{
     reexports::wayland_server::Display,
     backend::{
-        winit::{self, WinitEvent},
-        renderer::gles::GlesRenderer,
+        winit::{self, WinitEvent, WinitGraphicsBackend},
+        renderer::{damage::OutputDamageTracker, gles::GlesRenderer},
     },
+    desktop::space::space_render_elements,
+    output::{Mode, Output, PhysicalProperties, Subpixel},
+    utils::Transform,
+    wayland::socket::ListeningSocketSource,
 };
 
-use wayland_server::ListeningSocket;
-
 mod state;
+mod udev;
 use state::{HanamiState, ClientState};
 
+// The nested backend gets no vblank events, so frames are paced to 60Hz
+const FRAME_INTERVAL: Duration = Duration::from_micros(16_667);
+const REFRESH_MHZ: i32 = 60_000;
+
+// Behind all windows
+const CLEAR_COLOR: [f32; 4] = [0.1, 0.1, 0.1, 1.0];
+
 fn main() -> Result<(), Box<dyn std::error::Error>> {
     // Initialize logging
     let decorator = slog_term::TermDecorator::new().build();
@@ -31,9 +47,8 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
                   std::env::var("XDG_SESSION_TYPE").map(|s| s == "tty").unwrap_or(false);
 
     if use_drm {
-        slog::info!(log, "DRM/KMS backend not yet implemented");
-        slog::info!(log, "Please run in a Wayland or X11 session for now");
-        return Ok(());
+        slog::info!(log, "Starting with DRM/KMS backend");
+        return udev::run_udev(log);
     }
 
     // Use Winit backend (nested compositor)
@@ -41,59 +56,18 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     run_winit(log)
 }
 
-fn run_winit(log: Logger) -> Result<(), Box<dyn std::error::Error>> {
+// Create the display and compositor state, bind the socket, and register
+// the socket and display fd with `handle`
+fn init_wayland(
+    log: &Logger,
+    handle: &LoopHandle<'static, HanamiState>,
+) -> Result<HanamiState, Box<dyn std::error::Error>> {
     // Create Wayland display
-    let mut display: Display<HanamiState> = Display::new()?;
-    let dh = display.handle();
-
-    // Initialize compositor state
-    let compositor_state = smithay::wayland::compositor::CompositorState::new::<HanamiState>(&dh);
-    let xdg_shell_state = smithay::wayland::shell::xdg::XdgShellState::new::<HanamiState>(&dh);
-    let shm_state = smithay::wayland::shm::ShmState::new::<HanamiState>(&dh, vec![]);
-    let seat_state = smithay::input::SeatState::new();
-
-    let mut state = HanamiState {
-        log: log.clone(),
-        compositor_state,
-        xdg_shell_state,
-        shm_state,
-        seat_state,
-        windows: Vec::new(),
-    };
+    let display: Display<HanamiState> = Display::new()?;
+    let state = HanamiState::new(log.clone(), display.handle());
 
-    // Create Wayland socket - try wayland-0 first, then increment
-    let socket_name = std::env::var("WAYLAND_DISPLAY").ok();
-    
-    let listener = if let Some(name) = socket_name {
-        slog::info!(log, "Using WAYLAND_DISPLAY from environment: {}", name);
-        ListeningSocket::bind(&name)?
-    } else {
-        // Try wayland-0, wayland-1, wayland-2, etc. until we find an available socket
-        let mut display_num = 0;
-        loop {
-            let socket_name = format!("wayland-{}", display_num);
-            match ListeningSocket::bind(&socket_name) {
-                Ok(listener) => {
-                    slog::info!(log, "Bound to {} (display #{})", socket_name, display_num);
-                    break listener;
-                }
-                Err(_) if display_num < 32 => {
-                    slog::debug!(log, "{} already in use, trying next...", socket_name);
-                    display_num += 1;
-                }
-                Err(e) => {
-                    slog::error!(log, "Failed to bind to any wayland socket: {}", e);
-                    return Err(e.into());
-                }
-            }
-        }
-    };
-    
-    let socket_name = listener
-        .socket_name()
-        .and_then(|s| s.to_str())
-        .unwrap_or("wayland-0")
-        .to_string();
+    let listener = bind_socket(&log)?;
+    let socket_name = listener.socket_name().to_string_lossy().into_owned();
     
     // Print to stdout for scripts to capture (like cage does)
     println!("{}", socket_name);
@@ -106,62 +80,181 @@ fn run_winit(log: Logger) -> Result<(), Box<dyn std::error::Error>> {
     // Set WAYLAND_DISPLAY for child processes
     std::env::set_var("WAYLAND_DISPLAY", &socket_name);
 
+    // Accept new clients
+    handle
+        .insert_source(listener, |stream, _, state| {
+            match state
+                .display_handle
+                .insert_client(stream, Arc::new(ClientState::default()))
+            {
+                Ok(_) => slog::info!(state.log, "New client connected"),
+                Err(e) => slog::warn!(state.log, "Failed to add client: {}", e),
+            }
+        })
+        .map_err(|e| e.error)?;
+
+    // Dispatch client requests whenever the display fd is readable
+    handle
+        .insert_source(
+            Generic::new(display, Interest::READ, TriggerMode::Level),
+            |_, display, state| {
+                // Safety: the display is never dropped while the source lives
+                unsafe {
+                    display.get_mut().dispatch_clients(state)?;
+                }
+                Ok(PostAction::Continue)
+            },
+        )
+        .map_err(|e| e.error)?;
+
+    Ok(state)
+}
+
+fn run_winit(log: Logger) -> Result<(), Box<dyn std::error::Error>> {
+    // Everything below is an event source: the loop sleeps until a client
+    // connects or sends requests, the window gets input, or a frame is due
+    let mut event_loop: EventLoop<'static, HanamiState> = EventLoop::try_new()?;
+    let handle = event_loop.handle();
+    let mut state = init_wayland(&log, &handle)?;
+
     // Initialize Winit backend
-    let (mut backend, mut winit_evt_loop) = winit::init::<GlesRenderer>()?;
+    let (mut backend, winit_evt_loop) = winit::init::<GlesRenderer>()?;
+
+    // The nested window is the one output
+    let output = Output::new(
+        "winit".to_string(),
+        PhysicalProperties {
+            size: (0, 0).into(),
+            subpixel: Subpixel::Unknown,
+            make: "Hanami".into(),
+            model: "Winit".into(),
+        },
+    );
+    let _global = output.create_global::<HanamiState>(&state.display_handle);
+    let mode = Mode {
+        size: backend.window_size(),
+        refresh: REFRESH_MHZ,
+    };
+    output.change_current_state(Some(mode), Some(Transform::Flipped180), None, Some((0, 0).into()));
+    output.set_preferred(mode);
+    state.space.map_output(&output, (0, 0));
+
+    // Works out which parts of the output changed since the buffer being
+    // drawn was last on screen, from the surfaces' tracked damage
+    let mut damage_tracker = OutputDamageTracker::from_output(&output);
+
+    let resized_output = output.clone();
+    handle
+        .insert_source(winit_evt_loop, move |event, _, state| match event {
+            WinitEvent::CloseRequested => {
+                slog::info!(state.log, "Close requested, shutting down");
+                state.running = false;
+            }
+            WinitEvent::Resized { size, .. } => {
+                slog::debug!(state.log, "Window resized"; "width" => size.w, "height" => size.h);
+                let mode = Mode {
+                    size,
+                    refresh: REFRESH_MHZ,
+                };
+                resized_output.change_current_state(Some(mode), None, None, None);
+                resized_output.set_preferred(mode);
+                state.needs_redraw = true;
+            }
+            WinitEvent::Redraw => state.needs_redraw = true,
+            WinitEvent::Input(input_event) => {
+                slog::trace!(state.log, "Input event"; "event" => ?input_event);
+            }
+            _ => {}
+        })
+        .map_err(|e| e.error)?;
     
     slog::info!(log, "✓ Display window created");
     slog::info!(log, "✓ Compositor ready - waiting for clients...");
 
-    let mut clients = Vec::new();
-
     // Main event loop
-    loop {
-        // Accept new clients
-        if let Some(stream) = listener.accept()? {
-            slog::info!(log, "New client connected");
-            let client = display
-                .handle()
-                .insert_client(stream, Arc::new(ClientState::default()))?;
-            clients.push(client);
-        }
+    while state.running {
+        // Sleeps until some source is ready; an idle desktop doesn't wake
+        event_loop.dispatch(None, &mut state)?;
 
-        // Dispatch Winit events
-        let mut should_exit = false;
-        winit_evt_loop.dispatch_new_events(|event| {
-            match event {
-                WinitEvent::CloseRequested => {
-                    slog::info!(log, "Close requested, shutting down");
-                    should_exit = true;
-                }
-                WinitEvent::Resized { size, .. } => {
-                    slog::debug!(log, "Window resized"; "width" => size.w, "height" => size.h);
-                }
-                WinitEvent::Input(input_event) => {
-                    slog::trace!(log, "Input event"; "event" => ?input_event);
-                }
-                _ => {}
-            }
-        });
-        
-        if should_exit {
-            break;
+        // Whatever this batch of events damaged goes out in one frame, as
+        // soon as the previous one has had its interval
+        if state.needs_redraw && !state.frame_pending {
+            render_winit(&mut backend, &mut damage_tracker, &output, &mut state)?;
+            schedule_next_frame(&handle, &mut state);
         }
 
-        // Dispatch client requests
-        display.dispatch_clients(&mut state)?;
-        display.flush_clients()?;
+        state.space.refresh();
+        state.display_handle.flush_clients()?;
+    }
+    
+    Ok(())
+}
+
+// Bind WAYLAND_DISPLAY if set, otherwise the first free wayland-N
+fn bind_socket(log: &Logger) -> Result<ListeningSocketSource, Box<dyn std::error::Error>> {
+    if let Ok(name) = std::env::var("WAYLAND_DISPLAY") {
+        slog::info!(log, "Using WAYLAND_DISPLAY from environment: {}", name);
+        return Ok(ListeningSocketSource::with_name(&name)?);
+    }
 
-        // Render
-        {
-            let (_renderer, _framebuffer) = backend.bind()?;
-            // TODO: Render windows here
-            // For now, just clear to a dark background (done automatically)
+    // Try wayland-0, wayland-1, wayland-2, etc. until we find an available socket
+    let mut display_num = 0;
+    loop {
+        let socket_name = format!("wayland-{}", display_num);
+        match ListeningSocketSource::with_name(&socket_name) {
+            Ok(listener) => {
+                slog::info!(log, "Bound to {} (display #{})", socket_name, display_num);
+                return Ok(listener);
+            }
+            Err(_) if display_num < 32 => {
+                slog::debug!(log, "{} already in use, trying next...", socket_name);
+                display_num += 1;
+            }
+            Err(e) => {
+                slog::error!(log, "Failed to bind to any wayland socket: {}", e);
+                return Err(e.into());
+            }
         }
-        backend.submit(None)?;
+    }
+}
 
-        // Small sleep to avoid busy-waiting
-        std::thread::sleep(std::time::Duration::from_millis(16)); // ~60 FPS
+// Redraw only what changed. When nothing did, nothing is drawn or
+// swapped, so a static desktop costs no GPU (or llvmpipe) time.
+fn render_winit(
+    backend: &mut WinitGraphicsBackend<GlesRenderer>,
+    damage_tracker: &mut OutputDamageTracker,
+    output: &Output,
+    state: &mut HanamiState,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let age = backend.buffer_age().unwrap_or(0);
+    let damage = {
+        let (renderer, mut framebuffer) = backend.bind()?;
+        let elements = space_render_elements(renderer, [&state.space], output, 1.0)?;
+        let result = damage_tracker.render_output(renderer, &mut framebuffer, age, &elements, CLEAR_COLOR)?;
+        result.damage.cloned()
+    };
+    if let Some(damage) = damage {
+        slog::trace!(state.log, "Submitting frame"; "rects" => damage.len());
+        backend.submit(Some(damage.as_slice()))?;
     }
-    
+    state.needs_redraw = false;
+
+    // Clients draw their next frame now, to be ready for the next interval
+    state.send_frame_callbacks(output);
     Ok(())
 }
+
+// Hold further frames back for one frame interval. Nothing is scheduled
+// while idle.
+fn schedule_next_frame(handle: &LoopHandle<'static, HanamiState>, state: &mut HanamiState) {
+    state.frame_pending = true;
+    let timer = Timer::from_duration(FRAME_INTERVAL);
+    let inserted = handle.insert_source(timer, |_, _, state| {
+        state.frame_pending = false;
+        TimeoutAction::Drop
+    });
+    if let Err(e) = inserted {
+        slog::warn!(state.log, "Failed to start frame timer: {}", e.error);
+        state.frame_pending = false;
+    }
+}
@@ -1,12 +1,28 @@
+use std::time::{Duration, Instant};
+
 use slog::Logger;
 use smithay::{
-    delegate_compositor, delegate_shm, delegate_xdg_shell, delegate_seat,
+    backend::{
+        allocator::dmabuf::Dmabuf,
+        renderer::{gles::GlesRenderer, utils::on_commit_buffer_handler, ImportDma},
+    },
+    delegate_compositor, delegate_dmabuf, delegate_output, delegate_shm, delegate_xdg_shell,
+    delegate_seat,
+    desktop::{Space, Window},
     input::{Seat, SeatHandler, SeatState},
+    output::Output,
+    reexports::wayland_protocols::xdg::shell::server::xdg_toplevel,
+    utils::{Logical, Point, Rectangle},
     wayland::{
-        compositor::{CompositorClientState, CompositorHandler, CompositorState},
+        compositor::{
+            get_parent, is_sync_subsurface, with_states, CompositorClientState, CompositorHandler,
+            CompositorState,
+        },
+        dmabuf::{DmabufGlobal, DmabufHandler, DmabufState, ImportNotifier},
+        output::OutputHandler,
         shell::xdg::{
             XdgShellHandler, XdgShellState, ToplevelSurface, PopupSurface, 
-            PositionerState,
+            PositionerState, XdgToplevelSurfaceData,
         },
         shm::{ShmHandler, ShmState},
         buffer::BufferHandler,
@@ -14,17 +30,91 @@ use smithay::{
 };
 use wayland_server::{
     backend::{ClientData, ClientId, DisconnectReason},
-    protocol::{wl_surface::WlSurface, wl_seat::WlSeat},
-    Client,
+    protocol::{wl_output::WlOutput, wl_surface::WlSurface, wl_seat::WlSeat},
+    Client, DisplayHandle,
 };
 
 pub struct HanamiState {
     pub log: Logger,
+    pub display_handle: DisplayHandle,
     pub compositor_state: CompositorState,
     pub xdg_shell_state: XdgShellState,
     pub shm_state: ShmState,
     pub seat_state: SeatState<Self>,
-    pub windows: Vec<ToplevelSurface>,
+    pub dmabuf_state: DmabufState,
+    // The DRM backend's renderer, for importing client dmabufs; the winit
+    // backend keeps its own
+    pub renderer: Option<GlesRenderer>,
+    // Mapped windows, rendered back to front
+    pub space: Space<Window>,
+    // Where the DRM backend draws its cursor, in global coordinates
+    pub pointer_location: Point<f64, Logical>,
+    // Cleared to leave the event loop
+    pub running: bool,
+    // Something changed on screen since the last frame
+    pub needs_redraw: bool,
+    // A frame went out less than a frame interval ago
+    pub frame_pending: bool,
+    // Frame callback timestamps count from here
+    pub start_time: Instant,
+}
+
+impl HanamiState {
+    pub fn new(log: Logger, display_handle: DisplayHandle) -> Self {
+        let dh = &display_handle;
+        Self {
+            log,
+            compositor_state: CompositorState::new::<Self>(dh),
+            xdg_shell_state: XdgShellState::new::<Self>(dh),
+            shm_state: ShmState::new::<Self>(dh, vec![]),
+            seat_state: SeatState::new(),
+            // Its global is created by backends that can import dmabufs
+            dmabuf_state: DmabufState::new(),
+            renderer: None,
+            space: Space::default(),
+            pointer_location: (0.0, 0.0).into(),
+            running: true,
+            needs_redraw: true,
+            frame_pending: false,
+            start_time: Instant::now(),
+            display_handle,
+        }
+    }
+
+    /// Let every window on `output` know its last commit made it into a
+    /// frame
+    pub fn send_frame_callbacks(&self, output: &Output) {
+        let time = self.start_time.elapsed();
+        for window in self.space.elements() {
+            window.send_frame(output, time, Some(Duration::ZERO), |_, _| Some(output.clone()));
+        }
+    }
+
+    /// The area covered by all outputs
+    pub fn output_bounds(&self) -> Option<Rectangle<i32, Logical>> {
+        self.space
+            .outputs()
+            .filter_map(|output| self.space.output_geometry(output))
+            .reduce(|a, b| a.merge(b))
+    }
+
+    /// Move the pointer to `location`, kept within the outputs
+    pub fn move_pointer(&mut self, location: Point<f64, Logical>) {
+        let Some(bounds) = self.output_bounds() else {
+            return;
+        };
+        let (left, top) = (bounds.loc.x as f64, bounds.loc.y as f64);
+        let right = left + (bounds.size.w - 1).max(0) as f64;
+        let bottom = top + (bounds.size.h - 1).max(0) as f64;
+        self.pointer_location = (location.x.clamp(left, right), location.y.clamp(top, bottom)).into();
+        self.needs_redraw = true;
+    }
+
+    fn window_for_surface(&self, surface: &WlSurface) -> Option<&Window> {
+        self.space
+            .elements()
+            .find(|window| window.toplevel().map_or(false, |t| t.wl_surface() == surface))
+    }
 }
 
 #[derive(Default)]
@@ -54,6 +144,35 @@ impl CompositorHandler for HanamiState {
 
     fn commit(&mut self, surface: &WlSurface) {
         slog::debug!(self.log, "Surface committed"; "surface" => ?surface);
+
+        // Imports the buffer and adds the surface's damage to what the
+        // renderer tracks for it; the damage tracker picks it up from there
+        on_commit_buffer_handler::<Self>(surface);
+        if !is_sync_subsurface(surface) {
+            let mut root = surface.clone();
+            while let Some(parent) = get_parent(&root) {
+                root = parent;
+            }
+            if let Some(window) = self.window_for_surface(&root) {
+                window.on_commit();
+            }
+        }
+
+        // A new toplevel is sized by its first configure
+        if let Some(window) = self.window_for_surface(surface) {
+            let initial_configure_sent = with_states(surface, |states| {
+                states
+                    .data_map
+                    .get::<XdgToplevelSurfaceData>()
+                    .map_or(true, |data| data.lock().unwrap().initial_configure_sent)
+            });
+            if !initial_configure_sent {
+                if let Some(toplevel) = window.toplevel() {
+                    toplevel.send_configure();
+                }
+            }
+        }
+        self.needs_redraw = true;
     }
 }
 
@@ -65,7 +184,10 @@ impl XdgShellHandler for HanamiState {
 
     fn new_toplevel(&mut self, surface: ToplevelSurface) {
         slog::info!(self.log, "New toplevel window created");
-        self.windows.push(surface);
+        // Cascade new windows so they don't stack exactly
+        let offset = 32 * (self.space.elements().count() as i32 % 10);
+        self.space.map_element(Window::new_wayland_window(surface), (offset, offset), true);
+        self.needs_redraw = true;
     }
 
     fn new_popup(&mut self, _surface: PopupSurface, _positioner: PositionerState) {
@@ -80,9 +202,48 @@ impl XdgShellHandler for HanamiState {
         // Handle reposition request
     }
 
+    // A fullscreen window covers its output exactly, which is what lets the
+    // DRM backend scan its buffer out directly instead of compositing
+    fn fullscreen_request(&mut self, surface: ToplevelSurface, _output: Option<WlOutput>) {
+        let Some(geometry) = self
+            .space
+            .outputs()
+            .next()
+            .and_then(|output| self.space.output_geometry(output))
+        else {
+            return;
+        };
+        slog::info!(self.log, "Window going fullscreen"; "width" => geometry.size.w, "height" => geometry.size.h);
+        surface.with_pending_state(|state| {
+            state.states.set(xdg_toplevel::State::Fullscreen);
+            state.size = Some(geometry.size);
+        });
+        if let Some(window) = self.window_for_surface(surface.wl_surface()).cloned() {
+            self.space.map_element(window, geometry.loc, true);
+        }
+        if surface.is_initial_configure_sent() {
+            surface.send_configure();
+        }
+        self.needs_redraw = true;
+    }
+
+    fn unfullscreen_request(&mut self, surface: ToplevelSurface) {
+        surface.with_pending_state(|state| {
+            state.states.unset(xdg_toplevel::State::Fullscreen);
+            state.size = None;
+        });
+        if surface.is_initial_configure_sent() {
+            surface.send_configure();
+        }
+        self.needs_redraw = true;
+    }
+
     fn toplevel_destroyed(&mut self, surface: ToplevelSurface) {
         slog::info!(self.log, "Toplevel window destroyed");
-        self.windows.retain(|w| w != &surface);
+        if let Some(window) = self.window_for_surface(surface.wl_surface()).cloned() {
+            self.space.unmap_elem(&window);
+        }
+        self.needs_redraw = true;
     }
 
     fn popup_destroyed(&mut self, _surface: PopupSurface) {
@@ -116,6 +277,31 @@ impl ShmHandler for HanamiState {
     }
 }
 
+// Output handler implementation
+impl OutputHandler for HanamiState {}
+
+// Dmabuf handler implementation. A buffer is accepted only if the renderer
+// can import it, so it can always be composited when it can't be scanned
+// out directly.
+impl DmabufHandler for HanamiState {
+    fn dmabuf_state(&mut self) -> &mut DmabufState {
+        &mut self.dmabuf_state
+    }
+
+    fn dmabuf_imported(&mut self, _global: &DmabufGlobal, dmabuf: Dmabuf, notifier: ImportNotifier) {
+        let imported = self
+            .renderer
+            .as_mut()
+            .map_or(false, |renderer| renderer.import_dmabuf(&dmabuf, None).is_ok());
+        if imported {
+            let _ = notifier.successful::<HanamiState>();
+        } else {
+            slog::debug!(self.log, "Rejected client dmabuf");
+            notifier.failed();
+        }
+    }
+}
+
 // Buffer handler implementation
 impl BufferHandler for HanamiState {
     fn buffer_destroyed(&mut self, _buffer: &wayland_server::protocol::wl_buffer::WlBuffer) {
@@ -147,3 +333,5 @@ delegate_compositor!(HanamiState);
 delegate_xdg_shell!(HanamiState);
 delegate_shm!(HanamiState);
 delegate_seat!(HanamiState);
+delegate_output!(HanamiState);
+delegate_dmabuf!(HanamiState);
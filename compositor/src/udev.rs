@@ -0,0 +1,440 @@
+// DRM/KMS backend
+//
+// Drives the primary GPU directly: every connected connector gets a CRTC,
+// its preferred mode and a DrmCompositor, which renders into GBM buffers
+// and presents them with atomic commits (legacy modesetting is only used
+// where the driver has no atomic support). A new frame is rendered when
+// something changed and the output's last page flip has completed, so
+// clients are paced by vblank and an idle desktop doesn't wake up.
+//
+// DrmCompositor also assigns elements to planes. A fullscreen window whose
+// dmabuf covers the output is put on the primary plane as is: nothing is
+// composited or copied for it. The cursor goes on the cursor plane, and
+// opaque, unscaled client buffers (video, the bar) on overlay planes. Each
+// candidate configuration is checked with a TEST_ONLY atomic commit first,
+// and whatever the driver rejects is composited with GL as before. With
+// the cursor on its plane, moving it is a plane update and the other
+// planes aren't redrawn.
+//
+// There is no seat manager integration, so the device and input nodes are
+// opened directly. Run as root (or with DRM master) on a free VT; vkms
+// works for headless testing.
+
+use std::cell::{Cell, RefCell};
+use std::collections::HashMap;
+use std::fs::File;
+use std::os::fd::OwnedFd;
+use std::os::unix::fs::OpenOptionsExt;
+use std::path::Path;
+use std::rc::Rc;
+use std::sync::OnceLock;
+use std::time::Duration;
+
+use slog::Logger;
+use calloop::{
+    timer::{TimeoutAction, Timer},
+    EventLoop, LoopHandle,
+};
+use smithay::{
+    backend::{
+        allocator::{
+            gbm::{GbmAllocator, GbmBufferFlags, GbmDevice},
+            Fourcc,
+        },
+        drm::{
+            compositor::{DrmCompositor, FrameFlags, PrimaryPlaneElement},
+            exporter::gbm::GbmFramebufferExporter,
+            DrmDevice, DrmDeviceFd, DrmEvent, DrmNode,
+        },
+        egl::{EGLContext, EGLDisplay},
+        input::{AbsolutePositionEvent, InputEvent, PointerMotionEvent},
+        libinput::LibinputInputBackend,
+        renderer::{
+            element::{
+                memory::{MemoryRenderBuffer, MemoryRenderBufferRenderElement},
+                surface::WaylandSurfaceRenderElement,
+                Kind,
+            },
+            gles::GlesRenderer,
+            ImportDma,
+        },
+        udev::{all_gpus, primary_gpu},
+    },
+    desktop::space::{space_render_elements, SpaceRenderElements},
+    output::{Mode, Output, PhysicalProperties, Subpixel},
+    reexports::{
+        drm::control::{connector, Device as ControlDevice, ModeTypeFlags},
+        input::{Libinput, LibinputInterface},
+        wayland_server::backend::GlobalId,
+    },
+    utils::{DeviceFd, Point, Transform},
+};
+
+use crate::state::HanamiState;
+
+// Framebuffer formats tried for composited frames, in order
+const COLOR_FORMATS: [Fourcc; 2] = [Fourcc::Argb8888, Fourcc::Xrgb8888];
+
+// The default cursor, an arrow with its hotspot at the top left
+const CURSOR_SIZE: i32 = 24;
+
+smithay::render_elements! {
+    OutputElements<=GlesRenderer>;
+    Cursor=MemoryRenderBufferRenderElement<GlesRenderer>,
+    Space=SpaceRenderElements<GlesRenderer, WaylandSurfaceRenderElement<GlesRenderer>>,
+}
+
+type GbmDrmCompositor = DrmCompositor<
+    GbmAllocator<DrmDeviceFd>,
+    GbmFramebufferExporter<DrmDeviceFd>,
+    (),
+    DrmDeviceFd,
+>;
+
+struct OutputSurface {
+    output: Output,
+    compositor: GbmDrmCompositor,
+    // Keeps the wl_output global alive
+    _global: GlobalId,
+    // A frame was queued and its page flip hasn't completed yet
+    flip_pending: bool,
+    // Frame callbacks for an empty frame are waiting on a timer
+    callbacks_scheduled: Rc<Cell<bool>>,
+}
+
+pub fn run_udev(log: Logger) -> Result<(), Box<dyn std::error::Error>> {
+    let mut event_loop: EventLoop<'static, HanamiState> = EventLoop::try_new()?;
+    let handle = event_loop.handle();
+    let mut state = crate::init_wayland(&log, &handle)?;
+
+    // Open the GPU
+    let path = match primary_gpu("seat0")? {
+        Some(path) => path,
+        None => all_gpus("seat0")?.into_iter().next().ok_or("No GPU found")?,
+    };
+    slog::info!(log, "Using GPU {}", path.display());
+    let file = File::options().read(true).write(true).open(&path)?;
+    let fd = DrmDeviceFd::new(DeviceFd::from(OwnedFd::from(file)));
+    let node = DrmNode::from_file(&fd)?;
+
+    let (drm, notifier) = DrmDevice::new(fd.clone(), true)?;
+    let gbm = GbmDevice::new(fd.clone())?;
+    let egl_display = unsafe { EGLDisplay::new(gbm.clone())? };
+    let context = EGLContext::new(&egl_display)?;
+    let mut renderer = unsafe { GlesRenderer::new(context)? };
+
+    // Clients may hand over dmabufs the renderer can import; those are also
+    // what can be scanned out directly
+    let render_formats = renderer.dmabuf_formats();
+    let _dmabuf_global = state
+        .dmabuf_state
+        .create_global::<HanamiState>(&state.display_handle, render_formats.clone());
+
+    let mut outputs = HashMap::new();
+    let mut x = 0;
+    let resources = drm.resource_handles()?;
+    for &conn in resources.connectors() {
+        let info = drm.get_connector(conn, false)?;
+        if info.state() != connector::State::Connected {
+            continue;
+        }
+        let Some(&mode) = info
+            .modes()
+            .iter()
+            .find(|mode| mode.mode_type().contains(ModeTypeFlags::PREFERRED))
+            .or_else(|| info.modes().first())
+        else {
+            continue;
+        };
+
+        // The first CRTC that can drive this connector and isn't taken
+        let crtc = info
+            .encoders()
+            .iter()
+            .filter_map(|&encoder| drm.get_encoder(encoder).ok())
+            .flat_map(|encoder| resources.filter_crtcs(encoder.possible_crtcs()))
+            .find(|crtc| !outputs.contains_key(crtc));
+        let Some(crtc) = crtc else {
+            slog::warn!(log, "No free CRTC for connector {:?}", conn);
+            continue;
+        };
+
+        let name = format!("{}-{}", info.interface().as_str(), info.interface_id());
+        let (width, height) = info.size().unwrap_or((0, 0));
+        let output = Output::new(
+            name.clone(),
+            PhysicalProperties {
+                size: (width as i32, height as i32).into(),
+                subpixel: Subpixel::Unknown,
+                make: "Unknown".into(),
+                model: "Unknown".into(),
+            },
+        );
+        let global = output.create_global::<HanamiState>(&state.display_handle);
+        let output_mode = Mode::from(mode);
+        output.change_current_state(Some(output_mode), None, None, Some((x, 0).into()));
+        output.set_preferred(output_mode);
+        state.space.map_output(&output, (x, 0));
+        x += output_mode.size.w;
+
+        let surface = drm.create_surface(crtc, mode, &[conn])?;
+        slog::info!(log, "{} has {} overlay planes", name, surface.planes().overlay.len());
+        let compositor = DrmCompositor::new(
+            &output,
+            surface,
+            None,
+            GbmAllocator::new(gbm.clone(), GbmBufferFlags::RENDERING | GbmBufferFlags::SCANOUT),
+            GbmFramebufferExporter::new(gbm.clone(), node.into()),
+            COLOR_FORMATS,
+            render_formats.clone(),
+            drm.cursor_size(),
+            Some(gbm.clone()),
+        )?;
+        slog::info!(log, "Output {} on {:?}", name, crtc; "mode" => ?mode);
+
+        outputs.insert(
+            crtc,
+            OutputSurface {
+                output,
+                compositor,
+                _global: global,
+                flip_pending: false,
+                callbacks_scheduled: Rc::new(Cell::new(false)),
+            },
+        );
+    }
+    if outputs.is_empty() {
+        return Err("No connected outputs".into());
+    }
+
+    // Page flips complete on vblank; the main loop picks them up
+    let vblanks = Rc::new(RefCell::new(Vec::new()));
+    let completed = vblanks.clone();
+    handle
+        .insert_source(notifier, move |event, _, state| match event {
+            DrmEvent::VBlank(crtc) => completed.borrow_mut().push(crtc),
+            DrmEvent::Error(e) => slog::warn!(state.log, "DRM error: {}", e),
+        })
+        .map_err(|e| e.error)?;
+
+    // Input
+    let mut libinput = Libinput::new_with_udev(DirectInterface);
+    libinput
+        .udev_assign_seat("seat0")
+        .map_err(|()| "Failed to assign libinput seat")?;
+    handle
+        .insert_source(LibinputInputBackend::new(libinput), |event, _, state| match event {
+            InputEvent::PointerMotion { event } => {
+                state.move_pointer(state.pointer_location + event.delta());
+            }
+            InputEvent::PointerMotionAbsolute { event } => {
+                if let Some(bounds) = state.output_bounds() {
+                    state.move_pointer(bounds.loc.to_f64() + event.position_transformed(bounds.size));
+                }
+            }
+            event => slog::trace!(state.log, "Input event"; "event" => ?event),
+        })
+        .map_err(|e| e.error)?;
+
+    let cursor = MemoryRenderBuffer::from_slice(
+        &cursor_pixels(),
+        Fourcc::Argb8888,
+        (CURSOR_SIZE, CURSOR_SIZE),
+        1,
+        Transform::Normal,
+        None,
+    );
+    // Start in the middle of the outputs
+    if let Some(bounds) = state.output_bounds() {
+        let center = bounds.loc + Point::from((bounds.size.w / 2, bounds.size.h / 2));
+        state.move_pointer(center.to_f64());
+    }
+
+    state.renderer = Some(renderer);
+    slog::info!(log, "✓ Compositor ready - waiting for clients...");
+
+    while state.running {
+        event_loop.dispatch(None, &mut state)?;
+
+        for crtc in vblanks.borrow_mut().drain(..) {
+            let Some(surface) = outputs.get_mut(&crtc) else {
+                continue;
+            };
+            if let Err(e) = surface.compositor.frame_submitted() {
+                slog::warn!(state.log, "Failed to complete frame: {}", e);
+            }
+            surface.flip_pending = false;
+            state.send_frame_callbacks(&surface.output);
+        }
+
+        // Outputs still waiting for a flip are drawn after it
+        if state.needs_redraw {
+            let mut deferred = false;
+            for surface in outputs.values_mut() {
+                if surface.flip_pending {
+                    deferred = true;
+                } else if let Err(e) = render_output(surface, &cursor, &handle, &mut state) {
+                    // A transient DRM error or a rejected commit costs this
+                    // frame only. It is drawn again on the next redraw, and
+                    // clients are kept going in the meantime, which also
+                    // wakes the loop to retry.
+                    slog::warn!(state.log, "Dropped frame on {}: {}", surface.output.name(), e);
+                    schedule_frame_callbacks(surface, &handle, &state);
+                    deferred = true;
+                }
+            }
+            state.needs_redraw = deferred;
+        }
+
+        state.space.refresh();
+        state.display_handle.flush_clients()?;
+    }
+
+    Ok(())
+}
+
+// Render and queue a frame if anything on `surface` changed
+fn render_output(
+    surface: &mut OutputSurface,
+    cursor: &MemoryRenderBuffer,
+    handle: &LoopHandle<'static, HanamiState>,
+    state: &mut HanamiState,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let Some(renderer) = state.renderer.as_mut() else {
+        return Ok(());
+    };
+
+    // Front to back: the cursor, then the windows
+    let mut elements = Vec::new();
+    if let Some(geometry) = state.space.output_geometry(&surface.output) {
+        if geometry.to_f64().contains(state.pointer_location) {
+            let location = (state.pointer_location - geometry.loc.to_f64()).to_physical(1.0);
+            elements.push(OutputElements::Cursor(MemoryRenderBufferRenderElement::from_buffer(
+                renderer,
+                location,
+                cursor,
+                None,
+                None,
+                None,
+                Kind::Cursor,
+            )?));
+        }
+    }
+    elements.extend(
+        space_render_elements(renderer, [&state.space], &surface.output, 1.0)?
+            .into_iter()
+            .map(OutputElements::Space),
+    );
+
+    let frame = surface
+        .compositor
+        .render_frame(renderer, &elements, crate::CLEAR_COLOR, frame_flags())?;
+    let is_empty = frame.is_empty;
+    if !is_empty {
+        slog::trace!(state.log, "Frame on {}", surface.output.name();
+            "direct scanout" => matches!(frame.primary_element, PrimaryPlaneElement::Element(_)),
+            "overlays" => frame.overlay_elements.len(),
+            "cursor plane" => frame.cursor_element.is_some());
+    }
+    drop(frame);
+
+    if is_empty {
+        // Nothing changed on this output, so there is no flip to wait for.
+        // Clients still get their callbacks, one refresh interval later
+        // rather than straight away, or one that commits without damage
+        // would spin.
+        schedule_frame_callbacks(surface, handle, state);
+        return Ok(());
+    }
+    surface.compositor.queue_frame(())?;
+    surface.flip_pending = true;
+    Ok(())
+}
+
+// Send `surface`'s frame callbacks after one refresh interval, as if a
+// vblank had come. Only one such timer is pending per output.
+fn schedule_frame_callbacks(
+    surface: &OutputSurface,
+    handle: &LoopHandle<'static, HanamiState>,
+    state: &HanamiState,
+) {
+    if surface.callbacks_scheduled.replace(true) {
+        return;
+    }
+    let output = surface.output.clone();
+    let scheduled = surface.callbacks_scheduled.clone();
+    let timer = Timer::from_duration(refresh_interval(&output));
+    let inserted = handle.insert_source(timer, move |_, _, state| {
+        scheduled.set(false);
+        state.send_frame_callbacks(&output);
+        TimeoutAction::Drop
+    });
+    if let Err(e) = inserted {
+        slog::warn!(state.log, "Failed to start frame callback timer: {}", e.error);
+        surface.callbacks_scheduled.set(false);
+    }
+}
+
+// One frame at the output's current refresh rate (given in mHz)
+fn refresh_interval(output: &Output) -> Duration {
+    match output.current_mode() {
+        Some(mode) if mode.refresh > 0 => Duration::from_micros(1_000_000_000 / mode.refresh as u64),
+        _ => crate::FRAME_INTERVAL,
+    }
+}
+
+// Planes DrmCompositor may put elements on instead of compositing them.
+// HANAMI_NO_PLANES composites everything, to compare against or to rule
+// out a driver that misreports what it can scan out.
+fn frame_flags() -> FrameFlags {
+    static FLAGS: OnceLock<FrameFlags> = OnceLock::new();
+    *FLAGS.get_or_init(|| {
+        if std::env::var("HANAMI_NO_PLANES").is_ok() {
+            FrameFlags::empty()
+        } else {
+            FrameFlags::DEFAULT
+                | FrameFlags::ALLOW_PRIMARY_PLANE_SCANOUT
+                | FrameFlags::ALLOW_OVERLAY_PLANE_SCANOUT
+                | FrameFlags::ALLOW_CURSOR_PLANE_SCANOUT
+        }
+    })
+}
+
+// A white arrow with a black outline, premultiplied ARGB8888 (BGRA in
+// memory)
+fn cursor_pixels() -> Vec<u8> {
+    let size = CURSOR_SIZE;
+    // Rows 0..17 widen by two pixels every three rows
+    let inside = |x: i32, y: i32| (0..17).contains(&y) && x >= 0 && x <= y * 2 / 3;
+    let mut pixels = vec![0u8; (size * size * 4) as usize];
+    for y in 0..size {
+        for x in (0..size).filter(|&x| inside(x, y)) {
+            let edge = !(inside(x - 1, y) && inside(x + 1, y) && inside(x, y - 1) && inside(x, y + 1));
+            let color = if edge { [0, 0, 0, 255] } else { [255; 4] };
+            let at = ((y * size + x) * 4) as usize;
+            pixels[at..at + 4].copy_from_slice(&color);
+        }
+    }
+    pixels
+}
+
+// Opens input devices directly, since there's no seat manager to ask
+struct DirectInterface;
+
+impl LibinputInterface for DirectInterface {
+    fn open_restricted(&mut self, path: &Path, flags: i32) -> Result<OwnedFd, i32> {
+        // The low two bits are the access mode: read, write or both
+        let access = flags & 0b11;
+        File::options()
+            .read(access != 1)
+            .write(access != 0)
+            .custom_flags(flags & !0b11)
+            .open(path)
+            .map(OwnedFd::from)
+            .map_err(|e| e.raw_os_error().unwrap_or(1))
+    }
+
+    fn close_restricted(&mut self, fd: OwnedFd) {
+        drop(fd);
+    }
+}
@@ -0,0 +1,15 @@
+// Timing shared by the *_bench examples, each of which pulls it in with
+// `mod bench;`
+
+use std::time::Instant;
+
+/// Average milliseconds per call of `f` over `iterations` calls, after one
+/// untimed warm-up call
+pub fn time_ms<F: FnMut()>(iterations: u32, mut f: F) -> f64 {
+    f();
+    let start = Instant::now();
+    for _ in 0..iterations {
+        f();
+    }
+    start.elapsed().as_secs_f64() * 1000.0 / iterations as f64
+}
@@ -0,0 +1,72 @@
+// Compares the integer blend kernels against the old float blend_pixel path.
+//
+// Run with: cargo run --release --example blend_bench
+
+mod bench;
+
+use bench::time_ms;
+use mochi::{Canvas, Color};
+
+const ITERATIONS: u32 = 50;
+
+// The pre-kernel implementation of blend_pixel: float math per channel
+fn legacy_blend_pixel(buffer: &mut [u8], width: u32, height: u32, x: i32, y: i32, color: Color) {
+    if x < 0 || y < 0 || x >= width as i32 || y >= height as i32 {
+        return;
+    }
+
+    let offset = (y as u32 * width + x as u32) as usize * 4;
+    let alpha = color.a as f32 / 255.0;
+    let inv_alpha = 1.0 - alpha;
+
+    buffer[offset] = ((buffer[offset] as f32 * inv_alpha) + (color.b as f32 * alpha)) as u8;
+    buffer[offset + 1] = ((buffer[offset + 1] as f32 * inv_alpha) + (color.g as f32 * alpha)) as u8;
+    buffer[offset + 2] = ((buffer[offset + 2] as f32 * inv_alpha) + (color.r as f32 * alpha)) as u8;
+}
+
+fn main() {
+    // A glyph-like mask: solid interior, soft edges, empty gaps
+    let (mask_w, mask_h) = (512i32, 256i32);
+    let mask: Vec<u8> = (0..mask_w * mask_h)
+        .map(|i| match (i % mask_w) % 24 {
+            0..=3 => 0,
+            4 | 23 => 96,
+            _ => 255,
+        })
+        .collect();
+
+    for &(name, width, height) in &[("1080p", 1920u32, 1080u32), ("4K", 3840, 2160)] {
+        let mut buffer = vec![40u8; (width * height * 4) as usize];
+        let color = Color::rgba(20, 20, 20, 220);
+
+        let legacy_ms = time_ms(ITERATIONS, || {
+            for tile_y in (0..height as i32).step_by(mask_h as usize) {
+                for tile_x in (0..width as i32).step_by(mask_w as usize) {
+                    for my in 0..mask_h {
+                        for mx in 0..mask_w {
+                            let coverage = mask[(my * mask_w + mx) as usize];
+                            if coverage > 0 {
+                                let c = Color::rgba(color.r, color.g, color.b, coverage);
+                                legacy_blend_pixel(&mut buffer, width, height, tile_x + mx, tile_y + my, c);
+                            }
+                        }
+                    }
+                }
+            }
+        });
+
+        let mask_ms = time_ms(ITERATIONS, || {
+            let mut canvas = Canvas::new(&mut buffer, width, height);
+            for tile_y in (0..height as i32).step_by(mask_h as usize) {
+                for tile_x in (0..width as i32).step_by(mask_w as usize) {
+                    canvas.blend_mask(tile_x, tile_y, mask_w, mask_h, &mask, color);
+                }
+            }
+        });
+
+        println!(
+            "{:>5} blend: {:>7.3}ms -> {:>7.3}ms ({:.1}x)",
+            name, legacy_ms, mask_ms, legacy_ms / mask_ms
+        );
+    }
+}
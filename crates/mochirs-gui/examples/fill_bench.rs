@@ -0,0 +1,67 @@
+// Compares the span fill engine against the old per-pixel path.
+//
+// Run with: cargo run --release --example fill_bench
+
+mod bench;
+
+use bench::time_ms;
+use mochi::{Canvas, Color};
+
+const ITERATIONS: u32 = 50;
+
+// The pre-span implementation of clear: four byte stores per pixel
+fn legacy_clear(buffer: &mut [u8], color: Color) {
+    for chunk in buffer.chunks_exact_mut(4) {
+        chunk[0] = color.b;
+        chunk[1] = color.g;
+        chunk[2] = color.r;
+        chunk[3] = color.a;
+    }
+}
+
+// The pre-span implementation of fill_rect: bounds check per pixel
+fn legacy_fill_rect(canvas: &mut Canvas, x: i32, y: i32, width: i32, height: i32, color: Color) {
+    for py in y..(y + height) {
+        for px in x..(x + width) {
+            canvas.set_pixel(px, py, color);
+        }
+    }
+}
+
+fn draw_cards(canvas: &mut Canvas, fill: fn(&mut Canvas, i32, i32, i32, i32, Color)) {
+    let width = canvas.width() as i32;
+    let height = canvas.height() as i32;
+    let card_width = (width - 40 * 4) / 3;
+    for i in 0..3 {
+        fill(canvas, 40 + i * (card_width + 40), 60, card_width, height - 120, Color::BG_SECONDARY);
+    }
+}
+
+fn main() {
+    println!("span fill kernel: {}", mochi::core::raster::fill_backend());
+
+    for &(name, width, height) in &[("1080p", 1920u32, 1080u32), ("4K", 3840, 2160)] {
+        let mut buffer = vec![0u8; (width * height * 4) as usize];
+
+        let legacy_clear_ms = time_ms(ITERATIONS, || legacy_clear(&mut buffer, Color::BG_PRIMARY));
+        let span_clear_ms = time_ms(ITERATIONS, || Canvas::new(&mut buffer, width, height).clear(Color::BG_PRIMARY));
+
+        let legacy_fill_ms = time_ms(ITERATIONS, || {
+            let mut canvas = Canvas::new(&mut buffer, width, height);
+            draw_cards(&mut canvas, legacy_fill_rect);
+        });
+        let span_fill_ms = time_ms(ITERATIONS, || {
+            let mut canvas = Canvas::new(&mut buffer, width, height);
+            draw_cards(&mut canvas, |c, x, y, w, h, color| c.fill_rect(x, y, w, h, color));
+        });
+
+        println!(
+            "{:>5} clear: {:>7.3}ms -> {:>7.3}ms ({:.1}x)",
+            name, legacy_clear_ms, span_clear_ms, legacy_clear_ms / span_clear_ms
+        );
+        println!(
+            "{:>5} cards: {:>7.3}ms -> {:>7.3}ms ({:.1}x)",
+            name, legacy_fill_ms, span_fill_ms, legacy_fill_ms / span_fill_ms
+        );
+    }
+}
@@ -0,0 +1,64 @@
+// Compares the lookup-table gradient engine against the old per-pixel path.
+//
+// Run with: cargo run --release --example gradient_bench
+
+mod bench;
+
+use bench::time_ms;
+use mochi::{Canvas, Color, CornerRadii, Gradient, Rect};
+use std::sync::Arc;
+
+const ITERATIONS: u32 = 20;
+
+// The pre-table implementation: four float lerps and a set_pixel per pixel
+fn legacy_gradient(canvas: &mut Canvas, width: i32, height: i32, start: Color, end: Color, angle: f32) {
+    let (sin_a, cos_a) = angle.to_radians().sin_cos();
+    for py in 0..height {
+        for px in 0..width {
+            let fx = px as f32 / width as f32;
+            let fy = py as f32 / height as f32;
+            let t = (fx * cos_a + fy * sin_a).clamp(0.0, 1.0);
+
+            let r = (start.r as f32 * (1.0 - t) + end.r as f32 * t) as u8;
+            let g = (start.g as f32 * (1.0 - t) + end.g as f32 * t) as u8;
+            let b = (start.b as f32 * (1.0 - t) + end.b as f32 * t) as u8;
+            let a = (start.a as f32 * (1.0 - t) + end.a as f32 * t) as u8;
+            canvas.set_pixel(px, py, Color::rgba(r, g, b, a));
+        }
+    }
+}
+
+fn main() {
+    let (width, height) = (3840u32, 2160u32);
+    let mut buffer = vec![0u8; (width * height * 4) as usize];
+    let (start, end) = (Color::rgb(30, 30, 60), Color::rgb(80, 40, 120));
+
+    for &angle in &[0.0f32, 90.0, 45.0] {
+        let legacy_ms = time_ms(ITERATIONS, || {
+            let mut canvas = Canvas::new(&mut buffer, width, height);
+            legacy_gradient(&mut canvas, width as i32, height as i32, start, end, angle);
+        });
+        let lut_ms = time_ms(ITERATIONS, || {
+            let mut canvas = Canvas::new(&mut buffer, width, height);
+            canvas.fill_gradient_rect(0, 0, width as i32, height as i32, start, end, angle);
+        });
+        println!(
+            "4K linear {:>3}deg: {:>7.3}ms -> {:>7.3}ms ({:.1}x)",
+            angle, legacy_ms, lut_ms, legacy_ms / lut_ms
+        );
+    }
+
+    let rect = Rect::new(0, 0, width as i32, height as i32);
+    let stops = |g: Gradient| g.stop(0.0, start).stop(0.6, Color::ACCENT).stop(1.0, end);
+    for (name, gradient) in [
+        ("three-stop", stops(Gradient::linear(30.0))),
+        ("dithered", stops(Gradient::linear(30.0)).dithered()),
+        ("radial", stops(Gradient::radial((0.5, 0.5), 1.0))),
+    ] {
+        let gradient = Arc::new(gradient);
+        let ms = time_ms(ITERATIONS, || {
+            Canvas::new(&mut buffer, width, height).fill_gradient(rect, CornerRadii::default(), &gradient);
+        });
+        println!("4K {:>10}: {:>7.3}ms", name, ms);
+    }
+}
@@ -0,0 +1,65 @@
+// Measures how replaying a recorded frame scales with the tiled renderer's
+// thread count.
+//
+// Run with: cargo run --release --example tile_bench
+
+mod bench;
+
+use bench::time_ms;
+use mochi::core::damage::DamageRegion;
+use mochi::core::display_list::DisplayList;
+use mochi::core::tiles::TiledRenderer;
+use mochi::{card, container, div, Canvas, Color, Element, TextRenderer};
+
+const ITERATIONS: u32 = 20;
+
+// A shell-like frame: full-screen background, shadowed rounded cards and
+// gradients spread over the whole surface
+fn record_frame(width: u32, height: u32, text_renderer: &TextRenderer) -> DisplayList {
+    let (w, h) = (width as i32, height as i32);
+    let mut ui = container(0, 0, w, h).background(Color::BG_PRIMARY);
+    for row in 0..4 {
+        for col in 0..4 {
+            let x = 40 + col * (w - 80) / 4;
+            let y = 40 + row * (h - 80) / 4;
+            let (cw, ch) = ((w - 80) / 4 - 30, (h - 80) / 4 - 30);
+            ui = ui.child(
+                card(x, y, cw, ch)
+                    .background(Color::rgb(60 + col as u8 * 40, 90, 160 - row as u8 * 30))
+                    .gradient(Color::rgb(30, 30, 40), 60.0)
+                    .rounded(16.0)
+                    .shadow(true)
+                    .shadow_blur(6)
+                    .child(div(x + 20, y + 20, cw - 40, 40).background(Color::WHITE).rounded(8.0)),
+            );
+        }
+    }
+
+    let damage = DamageRegion::full(width, height);
+    let mut canvas = Canvas::recording(width, height, damage, DisplayList::new());
+    ui.render(&mut canvas, text_renderer);
+    canvas.finish_recording().unwrap().0
+}
+
+fn main() {
+    let text_renderer = TextRenderer::new();
+
+    for &(name, width, height) in &[("1080p", 1920u32, 1080u32), ("4K", 3840, 2160)] {
+        let list = record_frame(width, height, &text_renderer);
+        let damage = DamageRegion::full(width, height);
+        let mut buffer = vec![0u8; (width * height * 4) as usize];
+
+        let mut single_ms = 0.0;
+        for threads in [1, 2, 4, 8] {
+            let mut tiles = TiledRenderer::with_threads(threads);
+            let ms = time_ms(ITERATIONS, || tiles.render(&mut buffer, width, height, &damage, &list));
+            if threads == 1 {
+                single_ms = ms;
+            }
+            println!(
+                "{:>5} {} threads: {:>7.3}ms ({:.1}x)",
+                name, threads, ms, single_ms / ms
+            );
+        }
+    }
+}
@@ -1,31 +1,204 @@
 use crate::core::color::Color;
-
-// Debug logging macro
-macro_rules! debug_log {
-    ($($arg:tt)*) => {
-        if std::env::var("MOCHI_DEBUG").is_ok() {
-            eprintln!("[CANVAS] {}", format!($($arg)*));
-        }
-    };
-}
+use crate::core::damage::{DamageRegion, MAX_RECTS};
+use crate::core::display_list::{DisplayList, DrawCommand};
+use crate::core::glyph_cache::GlyphBitmap;
+use crate::core::gradient::Gradient;
+use crate::core::raster;
+use crate::core::rounded::{mix, Border, CornerRadii, RoundedShape};
+use crate::core::shadow::{self, ShadowMask};
+use crate::core::ui::Rect;
+use std::cell::RefCell;
+use std::sync::Arc;
 
 use glam::Vec2;
 
+// Two-color gradients kept by fill_gradient_rect
+const RECENT_GRADIENTS: usize = 8;
+
 pub struct Canvas<'a> {
     buffer: &'a mut [u8],
     width: u32,
     height: u32,
     renderer_name: String,
+    // Pixels that may change this frame; every primitive is clipped to it
+    damage: DamageRegion,
+    // Newly damaged areas are cleared to this before anything paints there
+    background: Option<Color>,
+    // Position of the buffer's top-left pixel in drawing coordinates
+    origin: (i32, i32),
+    // Set when recording: draw calls are captured here instead of drawn
+    list: Option<DisplayList>,
+    // Parts of the surface known to end up fully opaque
+    opaque: [Rect; MAX_RECTS],
+    opaque_count: usize,
+}
+
+// Clipped (x0, y0, x1, y1) boxes with exclusive ends, one per damage rect
+#[derive(Clone, Copy)]
+struct ClipBoxes {
+    boxes: [(usize, usize, usize, usize); MAX_RECTS],
+    len: usize,
+}
+
+impl ClipBoxes {
+    fn iter(&self) -> impl Iterator<Item = (usize, usize, usize, usize)> + '_ {
+        self.boxes[..self.len].iter().copied()
+    }
 }
 
 impl<'a> Canvas<'a> {
     pub fn new(buffer: &'a mut [u8], width: u32, height: u32) -> Self {
+        Self::with_damage(buffer, width, height, DamageRegion::full(width, height))
+    }
+
+    /// A canvas over a buffer that already holds the previous frame; only
+    /// pixels inside `damage` will be painted.
+    pub fn with_damage(buffer: &'a mut [u8], width: u32, height: u32, mut damage: DamageRegion) -> Self {
+        damage.clip(width, height);
         Self {
             buffer,
             width,
             height,
             renderer_name: "LLVMpipe (Mesa Software Renderer)".to_string(),
+            damage,
+            background: None,
+            origin: (0, 0),
+            list: None,
+            opaque: [Rect::new(0, 0, 0, 0); MAX_RECTS],
+            opaque_count: 0,
+        }
+    }
+
+    /// A canvas that records draw calls into `list` (which is cleared)
+    /// instead of drawing them. Commands entirely outside `damage` are
+    /// dropped. Get the list back with `finish_recording`.
+    pub fn recording(width: u32, height: u32, damage: DamageRegion, mut list: DisplayList) -> Canvas<'static> {
+        list.clear();
+        let mut canvas = Canvas::with_damage(&mut [], width, height, damage);
+        canvas.list = Some(list);
+        canvas
+    }
+
+    pub fn is_recording(&self) -> bool {
+        self.list.is_some()
+    }
+
+    /// The recorded commands and the damage they were recorded against
+    pub fn finish_recording(&mut self) -> Option<(DisplayList, DamageRegion)> {
+        let list = self.list.take()?;
+        Some((list, self.damage.take()))
+    }
+
+    // In recording mode, capture the call instead of drawing it. Returns
+    // true when the caller should not draw.
+    fn record(&mut self, command: impl FnOnce(&mut DisplayList) -> DrawCommand) -> bool {
+        let list = match self.list.as_mut() {
+            Some(list) => list,
+            None => return false,
+        };
+        let mark = list.data_len();
+        let command = command(list);
+        let bounds = command.bounds();
+        let (x, y) = (bounds.x - self.origin.0, bounds.y - self.origin.1);
+        if self.damage.intersects(&Rect::new(x, y, bounds.width, bounds.height)) {
+            list.push(command);
+        } else {
+            list.truncate_data(mark);
         }
+        true
+    }
+
+    /// An offscreen canvas covering `bounds`. Elements draw into it with
+    /// their usual coordinates, and the result can be blitted back with
+    /// `composite`. The buffer should start out transparent.
+    pub fn layer(buffer: &'a mut [u8], bounds: Rect) -> Self {
+        let mut damage = DamageRegion::new();
+        damage.add(bounds);
+        Self::region(buffer, bounds, &damage)
+    }
+
+    /// A canvas over the part of a larger surface covered by `bounds`, such
+    /// as one tile of a frame. `damage` is in surface coordinates.
+    pub fn region(buffer: &'a mut [u8], bounds: Rect, damage: &DamageRegion) -> Self {
+        let (width, height) = (bounds.width.max(0) as u32, bounds.height.max(0) as u32);
+        let mut local = DamageRegion::new();
+        for rect in damage.rects() {
+            if let Some(r) = rect.intersect(&bounds) {
+                local.add(Rect::new(r.x - bounds.x, r.y - bounds.y, r.width, r.height));
+            }
+        }
+        let mut canvas = Self::with_damage(buffer, width, height, local);
+        canvas.origin = (bounds.x, bounds.y);
+        canvas
+    }
+
+    // Drawing coordinates to buffer coordinates
+    #[inline]
+    fn to_buffer(&self, x: i32, y: i32) -> (i32, i32) {
+        (x - self.origin.0, y - self.origin.1)
+    }
+
+    /// Clear the current damage to `color`, and clear any damage reported
+    /// later in the frame the same way
+    pub fn set_background(&mut self, color: Color) {
+        self.background = Some(color);
+        self.clear(color);
+    }
+
+    /// Report a changed area. Painting is clipped to the accumulated damage,
+    /// and the window hands the same rects to the compositor. Report damage
+    /// before painting over it; areas are not repainted retroactively.
+    pub fn add_damage(&mut self, rect: Rect) {
+        let (x, y) = self.to_buffer(rect.x, rect.y);
+        let rect = Rect::new(x, y, rect.width, rect.height);
+        let mut before = [Rect::new(0, 0, 0, 0); MAX_RECTS];
+        let count = self.damage.rects().len();
+        before[..count].copy_from_slice(self.damage.rects());
+
+        self.damage.add(rect);
+        self.damage.clip(self.width, self.height);
+
+        // Merging may grow the region past `rect`, so clear every rect that
+        // wasn't already damaged
+        if let Some(color) = self.background {
+            let mut fresh = [Rect::new(0, 0, 0, 0); MAX_RECTS];
+            let mut fresh_count = 0;
+            for r in self.damage.rects() {
+                if !before[..count].iter().any(|old| old.contains(r)) {
+                    fresh[fresh_count] = *r;
+                    fresh_count += 1;
+                }
+            }
+            for r in &fresh[..fresh_count] {
+                self.fill_rect(r.x + self.origin.0, r.y + self.origin.1, r.width, r.height, color);
+            }
+        }
+    }
+
+    pub fn damage(&self) -> &DamageRegion {
+        &self.damage
+    }
+
+    pub fn take_damage(&mut self) -> DamageRegion {
+        self.damage.take()
+    }
+
+    /// Whether anything inside `rect` will be painted this frame
+    pub fn is_damaged(&self, rect: &Rect) -> bool {
+        let (x, y) = self.to_buffer(rect.x, rect.y);
+        self.damage.intersects(&Rect::new(x, y, rect.width, rect.height))
+    }
+
+    /// Report the parts of the surface that are fully opaque after this
+    /// frame. The window passes them on to the compositor, which can then
+    /// skip drawing what is beneath. At most MAX_RECTS rects are kept.
+    pub fn set_opaque_region(&mut self, rects: &[Rect]) {
+        self.opaque_count = rects.len().min(MAX_RECTS);
+        self.opaque[..self.opaque_count].copy_from_slice(&rects[..self.opaque_count]);
+    }
+
+    pub fn opaque_region(&self) -> &[Rect] {
+        &self.opaque[..self.opaque_count]
     }
 
     pub fn width(&self) -> u32 {
@@ -49,30 +222,76 @@ impl<'a> Canvas<'a> {
     }
 
     pub fn clear(&mut self, color: Color) {
-        for chunk in self.buffer.chunks_exact_mut(4) {
-            chunk[0] = color.b;
-            chunk[1] = color.g;
-            chunk[2] = color.r;
-            chunk[3] = color.a;
+        let (x, y) = self.origin;
+        self.fill_rect(x, y, self.width as i32, self.height as i32, color);
+    }
+
+    // Clip a rect in buffer coordinates against the damage region (which is
+    // already clipped to the canvas)
+    fn clip_rect(&self, x: i32, y: i32, width: i32, height: i32) -> ClipBoxes {
+        let mut clips = ClipBoxes {
+            boxes: [(0, 0, 0, 0); MAX_RECTS],
+            len: 0,
+        };
+        let rect = Rect::new(x, y, width, height);
+        for damaged in self.damage.rects() {
+            if let Some(r) = rect.intersect(damaged) {
+                clips.boxes[clips.len] = (
+                    r.x as usize,
+                    r.y as usize,
+                    r.right() as usize,
+                    r.bottom() as usize,
+                );
+                clips.len += 1;
+            }
         }
+        clips
+    }
+
+    // Bounding box of the damage in drawing coordinates. Primitives that
+    // loop per pixel or per row restrict their loops to it, so painting a
+    // small tile of a large shape only costs the tile.
+    fn clip_bounds(&self) -> Rect {
+        let b = self.damage.bounds();
+        Rect::new(b.x + self.origin.0, b.y + self.origin.1, b.width, b.height)
+    }
+
+    fn in_clip(&self, x: i32, y: i32) -> bool {
+        self.damage.contains_point(x, y)
     }
 
     pub fn set_pixel(&mut self, x: i32, y: i32, color: Color) {
-        if x < 0 || y < 0 || x >= self.width as i32 || y >= self.height as i32 {
+        if self.record(|_| DrawCommand::SetPixel { x, y, color }) {
+            return;
+        }
+        let (x, y) = self.to_buffer(x, y);
+        if !self.in_clip(x, y) {
             return;
         }
 
         let offset = (y as u32 * self.width + x as u32) as usize * 4;
-        self.buffer[offset] = color.b;
-        self.buffer[offset + 1] = color.g;
-        self.buffer[offset + 2] = color.r;
-        self.buffer[offset + 3] = color.a;
+        self.buffer[offset..offset + 4].copy_from_slice(&premultiplied_pixel(color).to_le_bytes());
     }
 
     pub fn fill_rect(&mut self, x: i32, y: i32, width: i32, height: i32, color: Color) {
-        for py in y..(y + height) {
-            for px in x..(x + width) {
-                self.set_pixel(px, py, color);
+        let rect = Rect::new(x, y, width, height);
+        if self.record(|_| DrawCommand::FillRect { rect, color }) {
+            return;
+        }
+        let pixel = premultiplied_pixel(color);
+        let stride = self.width as usize * 4;
+
+        let (x, y) = self.to_buffer(x, y);
+        let clips = self.clip_rect(x, y, width, height);
+        for (x0, y0, x1, y1) in clips.iter() {
+            // Full-width rects are one contiguous span
+            if x0 == 0 && x1 == self.width as usize {
+                raster::fill_span(&mut self.buffer[y0 * stride..y1 * stride], pixel);
+                continue;
+            }
+
+            for row in self.buffer[y0 * stride..y1 * stride].chunks_exact_mut(stride) {
+                raster::fill_span(&mut row[x0 * 4..x1 * 4], pixel);
             }
         }
     }
@@ -86,42 +305,106 @@ impl<'a> Canvas<'a> {
         radius: f32,
         color: Color,
     ) {
-        let radius = radius as i32;
-
-        // Fill main body
-        self.fill_rect(x + radius, y, width - radius * 2, height, color);
-        self.fill_rect(x, y + radius, width, height - radius * 2, color);
-
-        // Draw corners with anti-aliasing
-        for corner_x in [x, x + width - radius] {
-            for corner_y in [y, y + height - radius] {
-                for dy in 0..radius {
-                    for dx in 0..radius {
-                        let center_x = if corner_x == x { radius } else { 0 };
-                        let center_y = if corner_y == y { radius } else { 0 };
-
-                        let dist = (((dx - center_x) * (dx - center_x)
-                            + (dy - center_y) * (dy - center_y))
-                            as f32)
-                            .sqrt();
-
-                        if dist <= radius as f32 {
-                            let alpha = if dist >= radius as f32 - 1.0 {
-                                ((radius as f32 - dist) * 255.0) as u8
-                            } else {
-                                255
-                            };
-
-                            let aa_color = Color::rgba(color.r, color.g, color.b, 
-                                ((alpha as f32 / 255.0) * (color.a as f32 / 255.0) * 255.0) as u8);
-                            self.blend_pixel(corner_x + dx, corner_y + dy, aa_color);
+        let rect = Rect::new(x, y, width, height);
+        self.draw_rounded_rect(rect, CornerRadii::all(radius), Some(color), None);
+    }
+
+    /// Fill and stroke a rounded rect in one pass. Fully covered pixels are
+    /// stored like `fill_rect`; only edge pixels are blended by coverage.
+    /// Without a fill the inside is left untouched.
+    pub fn draw_rounded_rect(
+        &mut self,
+        rect: Rect,
+        radii: CornerRadii,
+        fill: Option<Color>,
+        border: Option<Border>,
+    ) {
+        if self.record(|_| DrawCommand::RoundedRect { rect, radii, fill, border }) {
+            return;
+        }
+        if fill.is_none() && border.map_or(true, |b| b.width <= 0.0) {
+            return;
+        }
+
+        let (x, y) = self.to_buffer(rect.x, rect.y);
+        let outer = RoundedShape::new(Rect::new(x, y, rect.width, rect.height), radii);
+        // Everything inside the border; the whole shape when there is none
+        let (inner, border_color) = match border {
+            Some(border) if border.width > 0.0 => (outer.inset(border.width), border.color),
+            _ => (Some(outer), fill.unwrap_or(Color::TRANSPARENT)),
+        };
+        let has_border = inner != Some(outer);
+        let fill_color = fill.unwrap_or(border_color);
+        let (fill_pixel, border_pixel) = (premultiplied_pixel(fill_color), premultiplied_pixel(border_color));
+        let stride = self.width as usize * 4;
+
+        let clips = self.clip_rect(x, y, rect.width, rect.height);
+        for (x0, y0, x1, y1) in clips.iter() {
+            let clip = (x0 as i32, x1 as i32);
+            for row in y0..y1 {
+                let y = row as i32;
+                let o = match outer.row(y) {
+                    Some(o) => o,
+                    None => continue,
+                };
+                let i = match inner {
+                    Some(shape) if has_border => shape.row(y),
+                    Some(_) => Some(o),
+                    None => None,
+                };
+                let line = &mut self.buffer[row * stride..(row + 1) * stride];
+
+                // Fully covered spans; the border shows wherever the inside
+                // doesn't cover
+                match i {
+                    Some(i) if fill != Some(border_color) => {
+                        fill_clipped(line, clip, o.full_start, i.start.min(o.full_end), border_pixel);
+                        fill_clipped(line, clip, i.end.max(o.full_start), o.full_end, border_pixel);
+                        if fill.is_some() {
+                            let (from, to) = (i.full_start.max(o.full_start), i.full_end.min(o.full_end));
+                            fill_clipped(line, clip, from, to, fill_pixel);
                         }
                     }
+                    _ => fill_clipped(line, clip, o.full_start, o.full_end, border_pixel),
+                }
+
+                // Edge pixels of the outer shape, then those of the inner
+                // shape that fall in the outer shape's full span
+                let inner_edges = i.map_or([(0, 0); 2], |i| {
+                    [
+                        (i.start.max(o.full_start), i.full_start.min(o.full_end)),
+                        (i.full_end.max(o.full_start), i.end.min(o.full_end)),
+                    ]
+                });
+                let edges = [(o.start, o.full_start), (o.full_end, o.end), inner_edges[0], inner_edges[1]];
+                for (from, to) in edges {
+                    for x in from.max(clip.0)..to.min(clip.1) {
+                        let covered = outer.coverage(x, y);
+                        let inside = match inner {
+                            Some(shape) if has_border => shape.coverage(x, y).min(covered),
+                            Some(_) => covered,
+                            None => 0.0,
+                        };
+                        let (color, coverage) = match fill {
+                            Some(_) if !has_border => (fill_color, covered),
+                            Some(_) if covered > 0.0 => {
+                                (mix(border_color, fill_color, inside / covered), covered)
+                            }
+                            Some(_) => (fill_color, 0.0),
+                            // Stroke only: just the ring
+                            None => (border_color, covered - inside),
+                        };
+                        let offset = x as usize * 4;
+                        store_coverage(&mut line[offset..offset + 4], color, coverage);
+                    }
                 }
             }
         }
     }
 
+    /// Fill a rect with a two-color linear gradient. The last few of these
+    /// are kept, so one painted every frame doesn't rebuild its lookup
+    /// table; elements build theirs once with `.gradient()`.
     pub fn fill_gradient_rect(
         &mut self,
         x: i32,
@@ -132,23 +415,71 @@ impl<'a> Canvas<'a> {
         end_color: Color,
         angle: f32,
     ) {
-        let angle_rad = angle.to_radians();
-        let cos_a = angle_rad.cos();
-        let sin_a = angle_rad.sin();
+        let gradient = recent_gradient(start_color, end_color, angle);
+        self.fill_gradient(Rect::new(x, y, width, height), CornerRadii::default(), &gradient);
+    }
 
-        for py in 0..height {
-            for px in 0..width {
-                let fx = px as f32 / width as f32;
-                let fy = py as f32 / height as f32;
+    /// Fill `rect`, with its corners rounded by `radii`, with a gradient.
+    /// Covered pixels are stored like any other fill; the anti-aliased
+    /// corner edges are composited over what is there.
+    pub fn fill_gradient(&mut self, rect: Rect, radii: CornerRadii, gradient: &Arc<Gradient>) {
+        if self.record(|_| DrawCommand::Gradient { rect, radii, gradient: gradient.clone() }) {
+            return;
+        }
+        if rect.is_empty() {
+            return;
+        }
 
-                let t = (fx * cos_a + fy * sin_a).clamp(0.0, 1.0);
+        let shader = gradient.shader(rect.width, rect.height);
+        let (x, y) = self.to_buffer(rect.x, rect.y);
+        let stride = self.width as usize * 4;
+        let clips = self.clip_rect(x, y, rect.width, rect.height);
+
+        if radii.max() <= 0.0 {
+            for (x0, y0, x1, y1) in clips.iter() {
+                let (from, to) = (x0 * 4, x1 * 4);
+                for row in y0..y1 {
+                    let offset = row * stride;
+                    // Shade the first row of a repeating gradient, copy the rest
+                    if row > y0 && shader.rows_repeat() {
+                        self.buffer.copy_within(y0 * stride + from..y0 * stride + to, offset + from);
+                    } else {
+                        shader.row(&mut self.buffer[offset + from..offset + to], x0 as i32 - x, row as i32 - y);
+                    }
+                }
+            }
+            return;
+        }
+
+        let shape = RoundedShape::new(Rect::new(x, y, rect.width, rect.height), radii);
+        for (x0, y0, x1, y1) in clips.iter() {
+            let clip = (x0 as i32, x1 as i32);
+            for row in y0..y1 {
+                let py = row as i32;
+                let spans = match shape.row(py) {
+                    Some(spans) => spans,
+                    None => continue,
+                };
+                let line = &mut self.buffer[row * stride..(row + 1) * stride];
 
-                let r = (start_color.r as f32 * (1.0 - t) + end_color.r as f32 * t) as u8;
-                let g = (start_color.g as f32 * (1.0 - t) + end_color.g as f32 * t) as u8;
-                let b = (start_color.b as f32 * (1.0 - t) + end_color.b as f32 * t) as u8;
-                let a = (start_color.a as f32 * (1.0 - t) + end_color.a as f32 * t) as u8;
+                let (from, to) = (spans.full_start.max(clip.0), spans.full_end.min(clip.1));
+                if from < to {
+                    shader.row(&mut line[from as usize * 4..to as usize * 4], from - x, py - y);
+                }
 
-                self.set_pixel(x + px, y + py, Color::rgba(r, g, b, a));
+                let edges = (spans.start..spans.full_start).chain(spans.full_end..spans.end);
+                for px in edges.filter(|px| (clip.0..clip.1).contains(px)) {
+                    let coverage = (shape.coverage(px, py) * 255.0).round() as u32;
+                    let dst = &mut line[px as usize * 4..px as usize * 4 + 4];
+                    let mut src = [0u8; 4];
+                    shader.row(&mut src, px - x, py - y);
+                    if coverage == 255 {
+                        dst.copy_from_slice(&src);
+                    } else if coverage > 0 {
+                        let src = src.map(|c| raster::div255(c as u32 * coverage) as u8);
+                        raster::composite_span_scalar(dst, &src);
+                    }
+                }
             }
         }
     }
@@ -209,61 +540,7 @@ impl<'a> Canvas<'a> {
         blur: i32,
         color: Color,
     ) {
-        // Limit blur radius for performance on software renderer
-        let blur = blur.min(6).max(0);
-        
-        if blur < 1 {
-            return;
-        }
-        
-        // Small offset for shadow
-        let shadow_offset = (blur / 2).max(1);
-        let blur_f = blur as f32;
-        
-        // Render shadow with simple linear falloff - only outside the shape
-        for py in -blur..=(height + blur) {
-            for px in -blur..=(width + blur) {
-                // Calculate distance to nearest edge
-                let dx = if px < 0 {
-                    -px as f32
-                } else if px >= width {
-                    (px - width + 1) as f32
-                } else {
-                    0.0
-                };
-                
-                let dy = if py < 0 {
-                    -py as f32
-                } else if py >= height {
-                    (py - height + 1) as f32
-                } else {
-                    0.0
-                };
-                
-                let dist = (dx * dx + dy * dy).sqrt();
-                
-                // Only render shadow OUTSIDE the shape
-                if dist <= 0.0 || dist > blur_f {
-                    continue;
-                }
-                
-                // Simple linear falloff (no smoothstep, no pow)
-                let t = (dist / blur_f).min(1.0);
-                let falloff = 1.0 - t;
-                
-                // Clamp alpha to reasonable range
-                let shadow_alpha = (falloff * 0.4 * 255.0).min(100.0) as u8;
-                
-                if shadow_alpha > 1 {
-                    let shadow_color = Color::rgba(color.r, color.g, color.b, shadow_alpha);
-                    self.blend_pixel_premul(
-                        x + px + shadow_offset,
-                        y + py + shadow_offset,
-                        shadow_color,
-                    );
-                }
-            }
-        }
+        self.draw_box_shadow(Rect::new(x, y, width, height), CornerRadii::default(), blur, color);
     }
 
     pub fn draw_rounded_shadow(
@@ -276,151 +553,254 @@ impl<'a> Canvas<'a> {
         blur: i32,
         color: Color,
     ) {
-        // Limit blur radius for performance on software renderer
-        let blur = blur.min(6).max(0);
-        
-        if blur < 1 {
+        let rect = Rect::new(x, y, width, height);
+        self.draw_box_shadow(rect, CornerRadii::all(radius), blur, color);
+    }
+
+    /// Gaussian shadow of a rounded rect, offset slightly down and right.
+    /// The whole shape is shadowed, not just what lies outside it, and
+    /// `color`'s alpha is the opacity of its solid middle, so pass a
+    /// translucent color. The blurred mask is cached, so redrawing the same
+    /// shape only costs the blend.
+    pub fn draw_box_shadow(&mut self, rect: Rect, radii: CornerRadii, blur: i32, color: Color) {
+        let blur = blur.min(shadow::MAX_BLUR);
+        if blur < 1 || rect.is_empty() || !self.is_damaged(&shadow::bounds(rect, blur)) {
             return;
         }
-        
-        debug_log!("draw_rounded_shadow: {}x{} at ({},{}) blur={} radius={}", 
-                  width, height, x, y, blur, radius);
-        
-        let shadow_start = std::time::Instant::now();
-        
-        // Small offset and radius for better performance
-        let shadow_offset = (blur / 2).max(1);
-        let blur_f = blur as f32;
-        let radius_i = (radius.min(8.0)) as i32;
-        
-        // Render shadow with simple linear falloff - only outside the shape
-        for py in -blur..=(height + blur) {
-            for px in -blur..=(width + blur) {
-                // Calculate distance to nearest point on the rounded rectangle
-                let dist = self.distance_to_rounded_rect(px, py, width, height, radius_i);
-                
-                // Only render shadow OUTSIDE the shape (dist > 0)
-                if dist <= 0.0 || dist > blur_f {
-                    continue;
-                }
-                
-                // Simple linear falloff (no smoothstep, no pow)
-                let t = (dist / blur_f).min(1.0);
-                let falloff = 1.0 - t;
-                
-                // Clamp alpha to reasonable range
-                let shadow_alpha = (falloff * 0.4 * 255.0).min(100.0) as u8;
-                
-                if shadow_alpha > 1 {
-                    let shadow_color = Color::rgba(color.r, color.g, color.b, shadow_alpha);
-                    self.blend_pixel_premul(
-                        x + px + shadow_offset,
-                        y + py + shadow_offset,
-                        shadow_color,
-                    );
-                }
-            }
-        }
-        
-        let shadow_elapsed = shadow_start.elapsed();
-        debug_log!("Shadow rendering took: {:.2}ms", shadow_elapsed.as_secs_f64() * 1000.0);
-    }
-    
-    // Helper function to calculate signed distance from a point to a rounded rectangle
-    // Returns negative if inside, positive if outside
-    fn distance_to_rounded_rect(&self, px: i32, py: i32, width: i32, height: i32, radius: i32) -> f32 {
-        // Check if we're in a corner region
-        let in_top_left = px < radius && py < radius;
-        let in_top_right = px >= width - radius && py < radius;
-        let in_bottom_left = px < radius && py >= height - radius;
-        let in_bottom_right = px >= width - radius && py >= height - radius;
-        
-        if in_top_left {
-            let dx = px - radius;
-            let dy = py - radius;
-            let corner_dist = ((dx * dx + dy * dy) as f32).sqrt();
-            corner_dist - radius as f32
-        } else if in_top_right {
-            let dx = px - (width - radius - 1);
-            let dy = py - radius;
-            let corner_dist = ((dx * dx + dy * dy) as f32).sqrt();
-            corner_dist - radius as f32
-        } else if in_bottom_left {
-            let dx = px - radius;
-            let dy = py - (height - radius - 1);
-            let corner_dist = ((dx * dx + dy * dy) as f32).sqrt();
-            corner_dist - radius as f32
-        } else if in_bottom_right {
-            let dx = px - (width - radius - 1);
-            let dy = py - (height - radius - 1);
-            let corner_dist = ((dx * dx + dy * dy) as f32).sqrt();
-            corner_dist - radius as f32
-        } else {
-            // Not in a corner, calculate distance to nearest edge
-            let dx = if px < 0 {
-                -px as f32
-            } else if px >= width {
-                (px - width + 1) as f32
-            } else {
-                0.0
-            };
-            
-            let dy = if py < 0 {
-                -py as f32
-            } else if py >= height {
-                (py - height + 1) as f32
-            } else {
-                0.0
-            };
-            
-            // If inside the main body, return negative distance
-            if dx == 0.0 && dy == 0.0 {
-                -1.0
-            } else {
-                (dx * dx + dy * dy).sqrt()
-            }
+        debug_log!("draw_box_shadow: {}x{} at ({},{}) blur={}", rect.width, rect.height, rect.x, rect.y, blur);
+        let mask = shadow::mask(rect.width, rect.height, radii, blur);
+        self.draw_shadow_mask(rect, &mask, color);
+    }
+
+    /// Blend a shadow mask built for `rect`. Recording keeps a reference to
+    /// the mask instead of copying it.
+    pub fn draw_shadow_mask(&mut self, rect: Rect, mask: &Arc<ShadowMask>, color: Color) {
+        if self.record(|_| DrawCommand::Shadow { rect, mask: mask.clone(), color }) {
+            return;
         }
+        let bounds = shadow::bounds(rect, mask.key.blur);
+        self.blend_mask(bounds.x, bounds.y, mask.width as i32, mask.height as i32, &mask.alpha, color);
     }
 
     pub fn blend_pixel(&mut self, x: i32, y: i32, color: Color) {
-        if x < 0 || y < 0 || x >= self.width as i32 || y >= self.height as i32 {
+        if self.record(|_| DrawCommand::BlendPixel { x, y, color }) {
+            return;
+        }
+        let (x, y) = self.to_buffer(x, y);
+        if !self.in_clip(x, y) {
             return;
         }
 
         let offset = (y as u32 * self.width + x as u32) as usize * 4;
-        let alpha = color.a as f32 / 255.0;
-        let inv_alpha = 1.0 - alpha;
-
-        self.buffer[offset] =
-            ((self.buffer[offset] as f32 * inv_alpha) + (color.b as f32 * alpha)) as u8;
-        self.buffer[offset + 1] =
-            ((self.buffer[offset + 1] as f32 * inv_alpha) + (color.g as f32 * alpha)) as u8;
-        self.buffer[offset + 2] =
-            ((self.buffer[offset + 2] as f32 * inv_alpha) + (color.r as f32 * alpha)) as u8;
-    }
-    
-    // Premultiplied alpha blending - optimized for software rendering
+        raster::blend_span_scalar(&mut self.buffer[offset..offset + 4], &[255], color);
+    }
+
+    // Premultiplied alpha blending - kept for callers that blend single pixels
     pub fn blend_pixel_premul(&mut self, x: i32, y: i32, color: Color) {
-        if x < 0 || y < 0 || x >= self.width as i32 || y >= self.height as i32 {
+        self.blend_pixel(x, y, color);
+    }
+
+    /// Blend a horizontal run of coverage values starting at (x, y).
+    /// Each pixel gets `color` at `coverage[i] * color.a / 255`.
+    pub fn blend_span(&mut self, x: i32, y: i32, coverage: &[u8], color: Color) {
+        if self.record(|list| DrawCommand::BlendSpan { x, y, coverage: list.push_data(coverage), color }) {
             return;
         }
+        let (x, y) = self.to_buffer(x, y);
+        let clips = self.clip_rect(x, y, coverage.len() as i32, 1);
+        for (x0, y0, x1, _) in clips.iter() {
+            let skip = (x0 as i32 - x) as usize;
+            let offset = (y0 * self.width as usize + x0) * 4;
+            raster::blend_span(
+                &mut self.buffer[offset..offset + (x1 - x0) * 4],
+                &coverage[skip..skip + (x1 - x0)],
+                color,
+            );
+        }
+    }
 
-        let offset = (y as u32 * self.width + x as u32) as usize * 4;
-        
-        // Clamp alpha
-        let alpha = (color.a as u32).min(255);
-        let inv_alpha = 255 - alpha;
-        
-        // Premultiplied alpha blend using integer math (faster on software renderer)
-        self.buffer[offset] = 
-            (((self.buffer[offset] as u32 * inv_alpha) + (color.b as u32 * alpha)) / 255) as u8;
-        self.buffer[offset + 1] = 
-            (((self.buffer[offset + 1] as u32 * inv_alpha) + (color.g as u32 * alpha)) / 255) as u8;
-        self.buffer[offset + 2] = 
-            (((self.buffer[offset + 2] as u32 * inv_alpha) + (color.r as u32 * alpha)) / 255) as u8;
+    /// Blend a `width` x `height` coverage mask (row-major, stride = width)
+    /// with its top-left corner at (x, y).
+    pub fn blend_mask(&mut self, x: i32, y: i32, width: i32, height: i32, mask: &[u8], color: Color) {
+        debug_assert!(mask.len() >= (width.max(0) * height.max(0)) as usize);
+        let rect = Rect::new(x, y, width, height);
+        let len = rect.area() as usize;
+        if self.record(|list| DrawCommand::BlendMask { rect, mask: list.push_data(&mask[..len]), color }) {
+            return;
+        }
+        let stride = self.width as usize * 4;
+
+        let (x, y) = self.to_buffer(x, y);
+        let clips = self.clip_rect(x, y, width, height);
+        for (x0, y0, x1, y1) in clips.iter() {
+            let mask_x = (x0 as i32 - x) as usize;
+            let span = x1 - x0;
+            for row in y0..y1 {
+                let mask_offset = (row as i32 - y) as usize * width as usize + mask_x;
+                let offset = row * stride + x0 * 4;
+                raster::blend_span(
+                    &mut self.buffer[offset..offset + span * 4],
+                    &mask[mask_offset..mask_offset + span],
+                    color,
+                );
+            }
+        }
+    }
+
+    /// Blend a cached glyph's coverage with its top-left corner at (x, y).
+    /// Recording keeps a reference to the bitmap instead of copying it.
+    pub fn draw_glyph(&mut self, x: i32, y: i32, bitmap: &Arc<GlyphBitmap>, color: Color) {
+        if self.record(|_| DrawCommand::Glyph { x, y, bitmap: bitmap.clone(), color }) {
+            return;
+        }
+        self.blend_mask(x, y, bitmap.width as i32, bitmap.height as i32, &bitmap.coverage, color);
+    }
+
+    /// Composite `width` x `height` premultiplied BGRA pixels with their
+    /// top-left corner at (x, y). Recording copies only the part inside the
+    /// damage; layers use `composite_layer`, which copies nothing.
+    pub fn composite(&mut self, x: i32, y: i32, width: i32, height: i32, pixels: &[u8]) {
+        debug_assert!(pixels.len() >= (width.max(0) * height.max(0)) as usize * 4);
+        let layer = Rect::new(x, y, width, height);
+        if self.is_recording() {
+            let Some(rect) = layer.intersect(&self.clip_bounds()) else {
+                return;
+            };
+            let (src_stride, span) = (layer.width as usize * 4, rect.width as usize * 4);
+            let mut part = Vec::with_capacity(rect.area() as usize * 4);
+            for row in rect.y - layer.y..rect.bottom() - layer.y {
+                let from = row as usize * src_stride + (rect.x - layer.x) as usize * 4;
+                part.extend_from_slice(&pixels[from..from + span]);
+            }
+            self.composite_layer(rect, rect, &Arc::new(part));
+            return;
+        }
+        self.composite_part(layer, layer, pixels);
+    }
+
+    /// Composite the part `rect` of a layer's premultiplied pixels, which
+    /// cover `layer`. Recording keeps a reference to the pixels and only the
+    /// part inside the damage, so replaying a mostly clean layer is cheap.
+    pub fn composite_layer(&mut self, rect: Rect, layer: Rect, pixels: &Arc<Vec<u8>>) {
+        let visible = rect.intersect(&layer).and_then(|r| r.intersect(&self.clip_bounds()));
+        let Some(rect) = visible else {
+            return;
+        };
+        if self.record(|_| DrawCommand::Composite { rect, layer, pixels: pixels.clone() }) {
+            return;
+        }
+        self.composite_part(rect, layer, pixels);
+    }
+
+    // Composite `rect`, a part of `layer`, from pixels covering `layer`
+    fn composite_part(&mut self, rect: Rect, layer: Rect, pixels: &[u8]) {
+        debug_assert!(pixels.len() >= layer.area() as usize * 4);
+        let stride = self.width as usize * 4;
+        let src_stride = layer.width.max(0) as usize * 4;
+
+        let (x, y) = self.to_buffer(layer.x, layer.y);
+        let (rect_x, rect_y) = self.to_buffer(rect.x, rect.y);
+        let clips = self.clip_rect(rect_x, rect_y, rect.width, rect.height);
+        for (x0, y0, x1, y1) in clips.iter() {
+            let src_x = (x0 as i32 - x) as usize * 4;
+            let span = (x1 - x0) * 4;
+            for row in y0..y1 {
+                let src_offset = (row as i32 - y) as usize * src_stride + src_x;
+                let offset = row * stride + x0 * 4;
+                raster::composite_span(
+                    &mut self.buffer[offset..offset + span],
+                    &pixels[src_offset..src_offset + span],
+                );
+            }
+        }
     }
 
     pub fn as_slice_mut(&mut self) -> &mut [u8] {
         self.buffer
     }
 }
+
+// `color` as stored in a buffer. Buffers hold premultiplied pixels (layers
+// are composited as such, and so is the window), so fills that store a
+// translucent color rather than blending it must premultiply it first.
+fn premultiplied_pixel(color: Color) -> u32 {
+    let premultiply = |c: u8| raster::div255(c as u32 * color.a as u32) as u8;
+    u32::from_le_bytes([premultiply(color.b), premultiply(color.g), premultiply(color.r), color.a])
+}
+
+// Fill columns [from, to) of a row, clipped to the exclusive range `clip`
+fn fill_clipped(line: &mut [u8], clip: (i32, i32), from: i32, to: i32, pixel: u32) {
+    let (from, to) = (from.max(clip.0), to.min(clip.1));
+    if from < to {
+        raster::fill_span(&mut line[from as usize * 4..to as usize * 4], pixel);
+    }
+}
+
+// Store `color` where coverage is full, blend it by coverage elsewhere
+fn store_coverage(pixel: &mut [u8], color: Color, coverage: f32) {
+    let coverage = (coverage * 255.0).round() as u8;
+    if coverage == 255 {
+        pixel.copy_from_slice(&premultiplied_pixel(color).to_le_bytes());
+    } else if coverage > 0 {
+        raster::blend_span_scalar(pixel, &[coverage], color);
+    }
+}
+
+// Gradient::between(start, end, angle), reused if it was asked for recently
+fn recent_gradient(start: Color, end: Color, angle: f32) -> Arc<Gradient> {
+    thread_local! {
+        // Least recently used first
+        static RECENT: RefCell<Vec<Arc<Gradient>>> = RefCell::new(Vec::new());
+    }
+    RECENT.with(|recent| {
+        let mut recent = recent.borrow_mut();
+        let gradient = match recent.iter().position(|g| g.is_between(start, end, angle)) {
+            Some(index) => recent.remove(index),
+            None => {
+                if recent.len() == RECENT_GRADIENTS {
+                    recent.remove(0);
+                }
+                Arc::new(Gradient::between(start, end, angle))
+            }
+        };
+        recent.push(gradient.clone());
+        gradient
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn translucent_fill_in_a_layer_composites_like_a_blend() {
+        let color = Color::rgba(200, 120, 40, 128);
+        let bounds = Rect::new(10, 20, 6, 3);
+        let mut layer = vec![0u8; bounds.area() as usize * 4];
+        {
+            let mut canvas = Canvas::layer(&mut layer, bounds);
+            canvas.fill_rect(bounds.x, bounds.y, bounds.width, bounds.height, color);
+        }
+        for px in layer.chunks_exact(4) {
+            assert!(px[..3].iter().all(|&c| c <= px[3]), "not premultiplied: {:?}", px);
+        }
+
+        // The layer over a backdrop matches blending the color directly
+        let backdrop = [30u8, 60, 90, 255].repeat(bounds.area() as usize);
+        let mut composited = backdrop.clone();
+        let mut canvas = Canvas::region(&mut composited, bounds, &DamageRegion::full(100, 100));
+        canvas.composite(bounds.x, bounds.y, bounds.width, bounds.height, &layer);
+        let mut blended = backdrop;
+        raster::blend_span_scalar(&mut blended, &vec![255; bounds.area() as usize], color);
+        for (a, b) in composited.iter().zip(&blended) {
+            assert!(a.abs_diff(*b) <= 1, "{:?} vs {:?}", &composited[..4], &blended[..4]);
+        }
+
+        // Rounded fills store the same pixels in their interior
+        let mut rounded = vec![0u8; bounds.area() as usize * 4];
+        let mut canvas = Canvas::layer(&mut rounded, bounds);
+        canvas.draw_rounded_rect(bounds, CornerRadii::all(1.0), Some(color), None);
+        let middle = (bounds.width as usize + 2) * 4;
+        assert_eq!(rounded[middle..middle + 4], layer[middle..middle + 4]);
+    }
+}
@@ -1,4 +1,4 @@
-#[derive(Debug, Clone, Copy, PartialEq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub struct Color {
     pub r: u8,
     pub g: u8,
@@ -19,6 +19,11 @@ impl Color {
         (self.r, self.g, self.b)
     }
 
+    // Packed pixel in the canvas byte order (BGRA in memory)
+    pub const fn to_pixel(&self) -> u32 {
+        u32::from_le_bytes([self.b, self.g, self.r, self.a])
+    }
+
     // Basic colors
     pub const WHITE: Color = Color::rgb(255, 255, 255);
     pub const BLACK: Color = Color::rgb(0, 0, 0);
@@ -0,0 +1,202 @@
+// Damage regions for partial redraw
+//
+// A frame's damage is a short list of rects. Overlapping or touching rects
+// are merged as they are added, and once the list grows past MAX_RECTS it
+// collapses to its bounding box, so clipping against it stays cheap.
+
+use crate::core::ui::Rect;
+
+pub const MAX_RECTS: usize = 8;
+
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct DamageRegion {
+    rects: Vec<Rect>,
+}
+
+impl DamageRegion {
+    pub fn new() -> Self {
+        Self { rects: Vec::new() }
+    }
+
+    /// A region covering a whole `width` x `height` surface
+    pub fn full(width: u32, height: u32) -> Self {
+        let mut region = Self::new();
+        region.add(Rect::new(0, 0, width as i32, height as i32));
+        region
+    }
+
+    pub fn add(&mut self, rect: Rect) {
+        if rect.is_empty() {
+            return;
+        }
+
+        // Absorb every rect the new one touches; the union may in turn touch
+        // rects it did not before, so repeat until stable
+        let mut merged = rect;
+        loop {
+            let before = self.rects.len();
+            self.rects.retain(|r| {
+                if r.touches(&merged) {
+                    merged = merged.union(r);
+                    false
+                } else {
+                    true
+                }
+            });
+            if self.rects.len() == before {
+                break;
+            }
+        }
+        self.rects.push(merged);
+
+        if self.rects.len() > MAX_RECTS {
+            let bounds = self.bounds();
+            self.rects.clear();
+            self.rects.push(bounds);
+        }
+    }
+
+    pub fn union(&mut self, other: &DamageRegion) {
+        for rect in &other.rects {
+            self.add(*rect);
+        }
+    }
+
+    /// Restrict the region to a `width` x `height` surface
+    pub fn clip(&mut self, width: u32, height: u32) {
+        let surface = Rect::new(0, 0, width as i32, height as i32);
+        self.rects.retain_mut(|r| match r.intersect(&surface) {
+            Some(clipped) => {
+                *r = clipped;
+                true
+            }
+            None => false,
+        });
+    }
+
+    pub fn rects(&self) -> &[Rect] {
+        &self.rects
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.rects.is_empty()
+    }
+
+    pub fn clear(&mut self) {
+        self.rects.clear();
+    }
+
+    pub fn take(&mut self) -> DamageRegion {
+        std::mem::take(self)
+    }
+
+    pub fn bounds(&self) -> Rect {
+        self.rects
+            .iter()
+            .fold(Rect::new(0, 0, 0, 0), |acc, r| acc.union(r))
+    }
+
+    pub fn intersects(&self, rect: &Rect) -> bool {
+        self.rects.iter().any(|r| r.intersects(rect))
+    }
+
+    pub fn contains_point(&self, x: i32, y: i32) -> bool {
+        self.rects.iter().any(|r| r.contains_point(x, y))
+    }
+
+    /// Damaged pixel count (rects never overlap)
+    pub fn area(&self) -> i64 {
+        self.rects.iter().map(|r| r.area()).sum()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // Small rects on a 32x32 grid, including empty and off-grid ones
+    fn random_rects(seed: u64, count: usize) -> Vec<Rect> {
+        let mut state = seed;
+        let mut next = move |range: i32| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            (state % range as u64) as i32
+        };
+        (0..count)
+            .map(|_| Rect::new(next(36) - 2, next(36) - 2, next(12), next(12)))
+            .collect()
+    }
+
+    fn covered(rects: &[Rect], x: i32, y: i32) -> bool {
+        rects.iter().any(|r| r.contains_point(x, y))
+    }
+
+    #[test]
+    fn add_keeps_rects_apart_and_covers_input() {
+        for seed in 1..200 {
+            let input = random_rects(seed, 1 + seed as usize % 12);
+            let mut region = DamageRegion::new();
+            for &rect in &input {
+                region.add(rect);
+            }
+
+            let rects = region.rects();
+            assert!(rects.len() <= MAX_RECTS, "seed {}: {} rects", seed, rects.len());
+            for (i, a) in rects.iter().enumerate() {
+                assert!(!a.is_empty());
+                for b in &rects[i + 1..] {
+                    assert!(!a.touches(b), "seed {}: {:?} touches {:?}", seed, a, b);
+                }
+            }
+            // Nothing added is lost, and `area` can sum the rects
+            for y in -4..50 {
+                for x in -4..50 {
+                    if covered(&input, x, y) {
+                        assert!(region.contains_point(x, y), "seed {}: ({}, {}) lost", seed, x, y);
+                    }
+                }
+            }
+            let pixels = (-4..50).flat_map(|y| (-4..50).map(move |x| (x, y)));
+            let area = pixels.filter(|&(x, y)| region.contains_point(x, y)).count();
+            assert_eq!(region.area(), area as i64, "seed {}", seed);
+        }
+    }
+
+    #[test]
+    fn add_merges_touching_rects() {
+        let mut region = DamageRegion::new();
+        region.add(Rect::new(0, 0, 10, 10));
+        region.add(Rect::new(10, 0, 10, 10));
+        assert_eq!(region.rects(), &[Rect::new(0, 0, 20, 10)]);
+
+        // A rect bridging two others pulls both in
+        let mut region = DamageRegion::new();
+        region.add(Rect::new(0, 0, 4, 4));
+        region.add(Rect::new(20, 0, 4, 4));
+        region.add(Rect::new(4, 0, 16, 2));
+        assert_eq!(region.rects(), &[Rect::new(0, 0, 24, 4)]);
+    }
+
+    #[test]
+    fn add_collapses_past_max_rects() {
+        let mut region = DamageRegion::new();
+        for i in 0..=MAX_RECTS as i32 {
+            region.add(Rect::new(i * 10, i * 10, 2, 2));
+        }
+        let last = MAX_RECTS as i32 * 10;
+        assert_eq!(region.rects(), &[Rect::new(0, 0, last + 2, last + 2)]);
+    }
+
+    #[test]
+    fn union_and_clip() {
+        let mut region = DamageRegion::full(100, 50);
+        let mut other = DamageRegion::new();
+        other.add(Rect::new(90, 40, 20, 20));
+        other.add(Rect::new(-10, -10, 5, 5));
+        region.union(&other);
+        region.clip(100, 50);
+        assert_eq!(region.rects(), &[Rect::new(0, 0, 100, 50)]);
+        assert_eq!(region.area(), 5000);
+    }
+}
@@ -1,7 +1,9 @@
-use super::ui::{Element, Rect};
+use super::ui::{hash_with, opaque_fill, Element, Rect};
 use crate::core::{canvas::Canvas, color::Color, text::TextRenderer};
+use std::any::Any;
+use std::hash::Hash;
 
-#[derive(Debug, Clone, Copy, PartialEq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub enum DialogButtonStyle {
     Primary,     // Blue, prominent
     Secondary,   // Gray, less prominent
@@ -82,62 +84,6 @@ impl Dialog {
         self
     }
 
-    fn draw_rounded_rect(
-        &self,
-        canvas: &mut Canvas,
-        x: i32,
-        y: i32,
-        width: i32,
-        height: i32,
-        color: Color,
-    ) {
-        let radius = self.corner_radius;
-
-        // Fill main body
-        canvas.fill_rect(x + radius, y, width - radius * 2, height, color);
-        canvas.fill_rect(x, y + radius, width, height - radius * 2, color);
-
-        // Draw corners with anti-aliasing for smoother appearance
-        for corner_x in [x, x + width - radius] {
-            for corner_y in [y, y + height - radius] {
-                for dy in 0..radius {
-                    for dx in 0..radius {
-                        let center_x = if corner_x == x { radius } else { 0 };
-                        let center_y = if corner_y == y { radius } else { 0 };
-
-                        let dist = (((dx - center_x) * (dx - center_x)
-                            + (dy - center_y) * (dy - center_y))
-                            as f32)
-                            .sqrt();
-                        let radius_f = radius as f32;
-
-                        if dist <= radius_f {
-                            let px = if corner_x == x {
-                                corner_x + dx
-                            } else {
-                                corner_x + dx
-                            };
-                            let py = if corner_y == y {
-                                corner_y + dy
-                            } else {
-                                corner_y + dy
-                            };
-
-                            // Anti-aliasing: blend at edges
-                            if dist > radius_f - 1.5 {
-                                let alpha = ((radius_f - dist) * 255.0).max(0.0).min(255.0) as u8;
-                                let blended = Color::rgba(color.r, color.g, color.b, alpha);
-                                canvas.blend_pixel(px, py, blended);
-                            } else {
-                                canvas.set_pixel(px, py, color);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-
     fn draw_button(
         &self,
         canvas: &mut Canvas,
@@ -149,69 +95,15 @@ impl Dialog {
         let text_color = button.text_color();
 
         // Draw rounded button background with anti-aliasing
-        let button_radius = 10;
-        let radius = button_radius;
-
-        // Fill main body
-        canvas.fill_rect(
-            rect.x + radius,
-            rect.y,
-            rect.width - radius * 2,
-            rect.height,
-            bg_color,
-        );
-        canvas.fill_rect(
-            rect.x,
-            rect.y + radius,
-            rect.width,
-            rect.height - radius * 2,
-            bg_color,
-        );
-
-        // Draw corners with anti-aliasing
-        for corner_x in [rect.x, rect.x + rect.width - radius] {
-            for corner_y in [rect.y, rect.y + rect.height - radius] {
-                for dy in 0..radius {
-                    for dx in 0..radius {
-                        let center_x = if corner_x == rect.x { radius } else { 0 };
-                        let center_y = if corner_y == rect.y { radius } else { 0 };
-
-                        let dist = (((dx - center_x) * (dx - center_x)
-                            + (dy - center_y) * (dy - center_y))
-                            as f32)
-                            .sqrt();
-                        let radius_f = radius as f32;
-
-                        if dist <= radius_f {
-                            let px = if corner_x == rect.x {
-                                corner_x + dx
-                            } else {
-                                corner_x + dx
-                            };
-                            let py = if corner_y == rect.y {
-                                corner_y + dy
-                            } else {
-                                corner_y + dy
-                            };
-
-                            // Anti-aliasing: blend at edges
-                            if dist > radius_f - 1.5 {
-                                let alpha = ((radius_f - dist) * 255.0).max(0.0).min(255.0) as u8;
-                                let blended =
-                                    Color::rgba(bg_color.r, bg_color.g, bg_color.b, alpha);
-                                canvas.blend_pixel(px, py, blended);
-                            } else {
-                                canvas.set_pixel(px, py, bg_color);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+        let button_radius = 10.0;
+        canvas.fill_rounded_rect(rect.x, rect.y, rect.width, rect.height, button_radius, bg_color);
 
-        // Draw button text (centered)
+        // Draw button text (centered on its measured width)
         let text_size = 16.0;
-        let text_width = (button.label.len() as f32 * text_size * 0.5) as i32;
+        let text_width = text_renderer
+            .layout(&button.label, text_size, "semibold", None)
+            .map(|run| run.width_px())
+            .unwrap_or(0);
         let text_x = rect.x + (rect.width - text_width) / 2;
         let text_y = rect.y + (rect.height / 2) + 5; // Vertically centered
 
@@ -236,88 +128,68 @@ impl Element for Dialog {
 
         // Draw shadow (simple offset)
         let shadow_color = Color::rgba(0, 0, 0, 50);
-        self.draw_rounded_rect(canvas, x + 3, y + 3, width, height, shadow_color);
+        let radius = self.corner_radius as f32;
+        canvas.fill_rounded_rect(x + 3, y + 3, width, height, radius, shadow_color);
 
         // Draw dialog background
-        self.draw_rounded_rect(canvas, x, y, width, height, self.background);
+        canvas.fill_rounded_rect(x, y, width, height, radius, self.background);
 
         let mut current_y = y + self.padding;
 
         // Draw icon if present (as emoji/text for now)
         if let Some(ref icon) = self.icon {
             let icon_size = 48.0;
-            let icon_x = x + (width / 2) - 24;
-            text_renderer.render(
-                canvas,
-                icon,
-                icon_x,
-                current_y + 10,
-                icon_size,
-                Color::rgb(0, 122, 255),
-                "regular",
-            );
+            if let Some(run) = text_renderer.layout(icon, icon_size, "regular", None) {
+                let icon_x = x + (width - run.width_px()) / 2;
+                text_renderer.render_run(
+                    canvas,
+                    &run,
+                    icon_x,
+                    current_y + 10,
+                    Color::rgb(0, 122, 255),
+                    "regular",
+                );
+            }
             current_y += 65;
         }
 
         // Draw title
         let title_size = 17.0;
-        let title_width = (self.title.len() as f32 * title_size * 0.5) as i32;
-        let title_x = x + (width - title_width) / 2;
-        text_renderer.render(
-            canvas,
-            &self.title,
-            title_x,
-            current_y,
-            title_size,
-            Color::rgb(0, 0, 0),
-            "semibold",
-        );
+        if let Some(run) = text_renderer.layout(&self.title, title_size, "semibold", None) {
+            let title_x = x + (width - run.width_px()) / 2;
+            text_renderer.render_run(
+                canvas,
+                &run,
+                title_x,
+                current_y,
+                Color::rgb(0, 0, 0),
+                "semibold",
+            );
+        }
         current_y += 30;
 
-        // Draw message (word-wrapped, centered)
+        // Draw message (word-wrapped by the layout engine, each line centered)
         let message_size = 13.0;
         let message_color = Color::rgb(100, 100, 100);
         let max_line_width = width - self.padding * 3;
 
-        // Simple word wrapping
-        let words: Vec<&str> = self.message.split_whitespace().collect();
-        let mut lines = Vec::new();
-        let mut current_line = String::new();
-
-        for word in words {
-            let test_line = if current_line.is_empty() {
-                word.to_string()
-            } else {
-                format!("{} {}", current_line, word)
-            };
-
-            let test_width = (test_line.len() as f32 * message_size * 0.5) as i32;
-            if test_width > max_line_width && !current_line.is_empty() {
-                lines.push(current_line.clone());
-                current_line = word.to_string();
-            } else {
-                current_line = test_line;
+        if let Some(run) =
+            text_renderer.layout(&self.message, message_size, "regular", Some(max_line_width))
+        {
+            for line in &run.lines {
+                let line_x = x + (width - line.width.ceil() as i32) / 2;
+                text_renderer.render_line(
+                    canvas,
+                    &run,
+                    line,
+                    line_x,
+                    current_y,
+                    message_color,
+                    "regular",
+                );
+                current_y += 20;
             }
         }
-        if !current_line.is_empty() {
-            lines.push(current_line);
-        }
-
-        // Render centered lines
-        for line in &lines {
-            let line_width = (line.len() as f32 * message_size * 0.5) as i32;
-            let line_x = x + (width - line_width) / 2;
-            text_renderer.render(
-                canvas,
-                line,
-                line_x,
-                current_y,
-                message_size,
-                message_color,
-                "regular",
-            );
-            current_y += 20;
-        }
 
         current_y += 15;
 
@@ -337,6 +209,39 @@ impl Element for Dialog {
     fn bounds(&self) -> Rect {
         self.rect.clone()
     }
+
+    fn paint_hash(&self) -> Option<u64> {
+        Some(hash_with(|h| {
+            self.rect.hash(h);
+            self.title.hash(h);
+            self.message.hash(h);
+            self.icon.hash(h);
+            for button in &self.buttons {
+                button.label.hash(h);
+                button.style.hash(h);
+            }
+            self.background.hash(h);
+            self.corner_radius.hash(h);
+            self.padding.hash(h);
+        }))
+    }
+
+    fn opaque_rect(&self) -> Option<Rect> {
+        opaque_fill(self.rect, self.background, None, self.corner_radius as f32)
+    }
+
+    fn translucent_rect(&self) -> Option<Rect> {
+        (self.background.a < 255).then_some(self.rect)
+    }
+
+    fn paint_bounds(&self, _text_renderer: &TextRenderer) -> Rect {
+        // Includes the offset drop shadow
+        Rect::new(self.rect.x, self.rect.y, self.rect.width + 3, self.rect.height + 3)
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
 }
 
 // Convenience function
@@ -0,0 +1,396 @@
+// Display lists: Canvas draw calls captured for later replay
+//
+// A recording Canvas appends one command per primitive instead of touching
+// pixels. Replaying the list onto a pixel Canvas gives the same result as
+// drawing directly, and since every primitive is clipped per pixel, a list
+// can be replayed onto disjoint tiles independently (see tiles.rs).
+
+use crate::core::canvas::Canvas;
+use crate::core::color::Color;
+use crate::core::damage::DamageRegion;
+use crate::core::glyph_cache::GlyphBitmap;
+use crate::core::gradient::Gradient;
+use crate::core::profiler;
+use crate::core::rounded::{Border, CornerRadii};
+use crate::core::shadow::{self, ShadowMask};
+use crate::core::ui::Rect;
+use std::ops::{Deref, DerefMut, Range};
+use std::sync::Arc;
+
+// Opaque rects remembered while culling; the largest are kept
+const MAX_OCCLUDERS: usize = 16;
+// Fills that would be cut into more pieces than this are kept whole
+const MAX_PIECES: usize = 16;
+
+#[derive(Debug, Clone)]
+pub enum DrawCommand {
+    FillRect { rect: Rect, color: Color },
+    RoundedRect { rect: Rect, radii: CornerRadii, fill: Option<Color>, border: Option<Border> },
+    /// The gradient's color table is built once and shared by every replay
+    Gradient { rect: Rect, radii: CornerRadii, gradient: Arc<Gradient> },
+    /// A cached shadow mask for `rect`, shared rather than copied
+    Shadow { rect: Rect, mask: Arc<ShadowMask>, color: Color },
+    SetPixel { x: i32, y: i32, color: Color },
+    BlendPixel { x: i32, y: i32, color: Color },
+    /// Coverage lives in `DisplayList::data`
+    BlendSpan { x: i32, y: i32, coverage: Range<usize>, color: Color },
+    BlendMask { rect: Rect, mask: Range<usize>, color: Color },
+    /// The part `rect` of a layer covering `layer`. Its premultiplied BGRA
+    /// pixels are shared with the layer rather than copied.
+    Composite { rect: Rect, layer: Rect, pixels: Arc<Vec<u8>> },
+    /// A cached glyph, shared with the glyph cache rather than copied
+    Glyph { x: i32, y: i32, bitmap: Arc<GlyphBitmap>, color: Color },
+}
+
+impl DrawCommand {
+    /// Profiler scope name for replaying the command
+    pub fn name(&self) -> &'static str {
+        match self {
+            DrawCommand::FillRect { .. } => "draw.fill_rect",
+            DrawCommand::RoundedRect { .. } => "draw.rounded_rect",
+            DrawCommand::Gradient { .. } => "draw.gradient",
+            DrawCommand::Shadow { .. } => "draw.shadow",
+            DrawCommand::SetPixel { .. } => "draw.set_pixel",
+            DrawCommand::BlendPixel { .. } => "draw.blend_pixel",
+            DrawCommand::BlendSpan { .. } => "draw.blend_span",
+            DrawCommand::BlendMask { .. } => "draw.blend_mask",
+            DrawCommand::Composite { .. } => "draw.composite",
+            DrawCommand::Glyph { .. } => "draw.glyph",
+        }
+    }
+
+    /// Every pixel the command may touch
+    pub fn bounds(&self) -> Rect {
+        match *self {
+            DrawCommand::FillRect { rect, .. }
+            | DrawCommand::RoundedRect { rect, .. }
+            | DrawCommand::Gradient { rect, .. }
+            | DrawCommand::BlendMask { rect, .. }
+            | DrawCommand::Composite { rect, .. } => rect,
+            DrawCommand::Shadow { rect, ref mask, .. } => shadow::bounds(rect, mask.key.blur),
+            DrawCommand::SetPixel { x, y, .. } | DrawCommand::BlendPixel { x, y, .. } => {
+                Rect::new(x, y, 1, 1)
+            }
+            DrawCommand::BlendSpan { x, y, ref coverage, .. } => {
+                Rect::new(x, y, coverage.len() as i32, 1)
+            }
+            DrawCommand::Glyph { x, y, ref bitmap, .. } => {
+                Rect::new(x, y, bitmap.width as i32, bitmap.height as i32)
+            }
+        }
+    }
+
+    /// Areas the command overwrites completely, whatever was there before.
+    /// Fills store their color without blending, so even translucent fills
+    /// hide everything beneath them.
+    fn opaque_rects(&self) -> [Option<Rect>; 2] {
+        match *self {
+            DrawCommand::FillRect { rect, .. } => [Some(rect), None],
+            DrawCommand::RoundedRect { rect, radii, fill: Some(_), .. }
+            | DrawCommand::Gradient { rect, radii, .. } => {
+                let limit = rect.width.min(rect.height) as f32 * 0.5;
+                let r = |a: f32, b: f32| a.max(b).min(limit).max(0.0).ceil() as i32;
+                let (top, bottom) = (r(radii.top_left, radii.top_right), r(radii.bottom_left, radii.bottom_right));
+                let (left, right) = (r(radii.top_left, radii.bottom_left), r(radii.top_right, radii.bottom_right));
+                if top.max(bottom).max(left).max(right) == 0 {
+                    return [Some(rect), None];
+                }
+                // The corners are blended; the cross between them is filled
+                [
+                    Some(Rect::new(rect.x + left, rect.y, rect.width - left - right, rect.height)),
+                    Some(Rect::new(rect.x, rect.y + top, rect.width, rect.height - top - bottom)),
+                ]
+            }
+            _ => [None, None],
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct OptimizeStats {
+    pub commands: usize,
+    pub culled: usize,
+    /// Fills cut down to their visible part
+    pub split: usize,
+    pub coalesced: usize,
+    /// Sum of command bounds before and after optimizing
+    pub painted_before: i64,
+    pub painted_after: i64,
+}
+
+impl OptimizeStats {
+    /// Average number of times each damaged pixel is painted
+    pub fn overdraw(&self, damaged_area: i64) -> (f32, f32) {
+        if damaged_area == 0 {
+            return (0.0, 0.0);
+        }
+        (
+            self.painted_before as f32 / damaged_area as f32,
+            self.painted_after as f32 / damaged_area as f32,
+        )
+    }
+}
+
+// Split `rect` into the parts not covered by any occluder. Returns the
+// number of pieces written, or `rect` itself if it would take too many.
+fn visible_pieces(rect: Rect, occluders: &[Rect], pieces: &mut [Rect; MAX_PIECES]) -> usize {
+    pieces[0] = rect;
+    let mut count = 1;
+    for occluder in occluders {
+        let mut next = [Rect::new(0, 0, 0, 0); MAX_PIECES];
+        let mut next_count = 0;
+        for piece in &pieces[..count] {
+            for part in piece.subtract(occluder) {
+                if next_count == MAX_PIECES {
+                    pieces[0] = rect;
+                    return 1;
+                }
+                next[next_count] = part;
+                next_count += 1;
+            }
+        }
+        *pieces = next;
+        count = next_count;
+    }
+    count
+}
+
+/// Recorded draw calls. Clearing keeps the allocations, so a list reused
+/// every frame stops allocating once it has grown to the frame's size.
+#[derive(Debug, Default)]
+pub struct DisplayList {
+    commands: Vec<DrawCommand>,
+    data: Vec<u8>,
+    // Survivors of optimize(), in reverse
+    scratch: Vec<DrawCommand>,
+    stats: OptimizeStats,
+}
+
+impl DisplayList {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn clear(&mut self) {
+        self.commands.clear();
+        self.data.clear();
+    }
+
+    pub fn len(&self) -> usize {
+        self.commands.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.commands.is_empty()
+    }
+
+    pub fn commands(&self) -> &[DrawCommand] {
+        &self.commands
+    }
+
+    pub fn push(&mut self, command: DrawCommand) {
+        self.commands.push(command);
+    }
+
+    /// Copy a coverage mask or pixel block into the list's data
+    pub fn push_data(&mut self, bytes: &[u8]) -> Range<usize> {
+        let start = self.data.len();
+        self.data.extend_from_slice(bytes);
+        start..self.data.len()
+    }
+
+    pub(crate) fn data_len(&self) -> usize {
+        self.data.len()
+    }
+
+    pub(crate) fn truncate_data(&mut self, len: usize) {
+        self.data.truncate(len);
+    }
+
+    /// Drop the parts of commands that later commands overwrite completely,
+    /// and merge runs of same-colored fills that form a single rect.
+    /// Replaying the optimized list gives exactly the same pixels.
+    pub fn optimize(&mut self) -> OptimizeStats {
+        let mut stats = OptimizeStats {
+            commands: self.commands.len(),
+            painted_before: self.painted_area(),
+            ..OptimizeStats::default()
+        };
+
+        // Walk back to front, remembering the largest opaque rects seen.
+        // Survivors are collected in reverse into `scratch`.
+        let mut occluders = [Rect::new(0, 0, 0, 0); MAX_OCCLUDERS];
+        let mut occluder_count = 0;
+        self.scratch.clear();
+        while let Some(command) = self.commands.pop() {
+            let bounds = command.bounds();
+            if bounds.is_empty() || occluders[..occluder_count].iter().any(|o| o.contains(&bounds)) {
+                stats.culled += 1;
+                continue;
+            }
+
+            let opaque = command.opaque_rects();
+            match command {
+                // Plain fills can be cut down to the part still visible
+                DrawCommand::FillRect { rect, color } => {
+                    let mut pieces = [Rect::new(0, 0, 0, 0); MAX_PIECES];
+                    let count = visible_pieces(rect, &occluders[..occluder_count], &mut pieces);
+                    if count == 1 && pieces[0] == rect {
+                        self.scratch.push(command);
+                    } else {
+                        stats.split += 1;
+                        for &piece in &pieces[..count] {
+                            self.scratch.push(DrawCommand::FillRect { rect: piece, color });
+                        }
+                    }
+                }
+                command => self.scratch.push(command),
+            }
+
+            for rect in opaque.into_iter().flatten() {
+                if rect.is_empty() {
+                    continue;
+                }
+                if occluder_count < MAX_OCCLUDERS {
+                    occluders[occluder_count] = rect;
+                    occluder_count += 1;
+                } else if let Some(smallest) = occluders.iter_mut().min_by_key(|o| o.area()) {
+                    if smallest.area() < rect.area() {
+                        *smallest = rect;
+                    }
+                }
+            }
+        }
+
+        // Merge neighbouring fills: two fills of one color that share a
+        // full edge are the same as one fill of their union
+        while let Some(command) = self.scratch.pop() {
+            if let (
+                Some(DrawCommand::FillRect { rect: a, color: ca }),
+                DrawCommand::FillRect { rect: b, color: cb },
+            ) = (self.commands.last_mut(), &command)
+            {
+                let side_by_side =
+                    a.y == b.y && a.height == b.height && (a.right() == b.x || b.right() == a.x);
+                let stacked =
+                    a.x == b.x && a.width == b.width && (a.bottom() == b.y || b.bottom() == a.y);
+                if *ca == *cb && (side_by_side || stacked) {
+                    *a = a.union(b);
+                    stats.coalesced += 1;
+                    continue;
+                }
+            }
+            self.commands.push(command);
+        }
+
+        stats.painted_after = self.painted_area();
+        self.stats = stats;
+        debug_log!(
+            "{} commands: {} culled, {} split, {} coalesced",
+            stats.commands,
+            stats.culled,
+            stats.split,
+            stats.coalesced
+        );
+        stats
+    }
+
+    /// Counters from the last optimize()
+    pub fn stats(&self) -> OptimizeStats {
+        self.stats
+    }
+
+    // Pixels touched by all commands, counting overlaps once per command
+    fn painted_area(&self) -> i64 {
+        self.commands.iter().map(|c| c.bounds().area()).sum()
+    }
+
+    /// Replay every command onto `canvas`
+    pub fn replay(&self, canvas: &mut Canvas) {
+        for command in &self.commands {
+            self.replay_command(command, canvas);
+        }
+    }
+
+    /// Replay the commands at `indices`, in the order given
+    pub fn replay_indices(&self, canvas: &mut Canvas, indices: &[u32]) {
+        for &index in indices {
+            self.replay_command(&self.commands[index as usize], canvas);
+        }
+    }
+
+    fn replay_command(&self, command: &DrawCommand, canvas: &mut Canvas) {
+        let _scope = profiler::scope(command.name());
+        match *command {
+            DrawCommand::FillRect { rect, color } => {
+                canvas.fill_rect(rect.x, rect.y, rect.width, rect.height, color)
+            }
+            DrawCommand::RoundedRect { rect, radii, fill, border } => {
+                canvas.draw_rounded_rect(rect, radii, fill, border)
+            }
+            DrawCommand::Gradient { rect, radii, ref gradient } => canvas.fill_gradient(rect, radii, gradient),
+            DrawCommand::Shadow { rect, ref mask, color } => canvas.draw_shadow_mask(rect, mask, color),
+            DrawCommand::SetPixel { x, y, color } => canvas.set_pixel(x, y, color),
+            DrawCommand::BlendPixel { x, y, color } => canvas.blend_pixel(x, y, color),
+            DrawCommand::BlendSpan { x, y, ref coverage, color } => {
+                canvas.blend_span(x, y, &self.data[coverage.clone()], color)
+            }
+            DrawCommand::BlendMask { rect, ref mask, color } => canvas.blend_mask(
+                rect.x,
+                rect.y,
+                rect.width,
+                rect.height,
+                &self.data[mask.clone()],
+                color,
+            ),
+            DrawCommand::Composite { rect, layer, ref pixels } => canvas.composite_layer(rect, layer, pixels),
+            DrawCommand::Glyph { x, y, ref bitmap, color } => canvas.draw_glyph(x, y, bitmap, color),
+        }
+    }
+}
+
+/// A Canvas that records instead of drawing. Elements render into it as
+/// into any Canvas; `finish` returns the optimized display list, ready to
+/// be replayed onto a real Canvas or a TiledRenderer.
+pub struct RecordingCanvas {
+    canvas: Canvas<'static>,
+}
+
+impl RecordingCanvas {
+    pub fn new(width: u32, height: u32, damage: DamageRegion) -> Self {
+        Self::with_list(width, height, damage, DisplayList::new())
+    }
+
+    /// Record into `list`, reusing its allocations
+    pub fn with_list(width: u32, height: u32, damage: DamageRegion, list: DisplayList) -> Self {
+        Self {
+            canvas: Canvas::recording(width, height, damage, list),
+        }
+    }
+
+    /// The optimized list and the damage it was recorded against
+    pub fn finish(mut self) -> (DisplayList, DamageRegion) {
+        let (mut list, damage) = self
+            .canvas
+            .finish_recording()
+            .expect("recording canvas always has a display list");
+        let stats = list.optimize();
+        let (before, after) = stats.overdraw(damage.area());
+        debug_log!("Overdraw {:.2}x -> {:.2}x", before, after);
+        (list, damage)
+    }
+}
+
+impl Deref for RecordingCanvas {
+    type Target = Canvas<'static>;
+
+    fn deref(&self) -> &Self::Target {
+        &self.canvas
+    }
+}
+
+impl DerefMut for RecordingCanvas {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        &mut self.canvas
+    }
+}
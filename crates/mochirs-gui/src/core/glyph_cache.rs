@@ -0,0 +1,252 @@
+// Glyph cache for TextRenderer
+//
+// Rasterized glyph coverage is kept across frames, keyed by font, glyph,
+// quantized size and subpixel x offset. Metrics are cached separately so
+// layout and measuring never have to rasterize.
+
+use fontdue::{Font, Metrics};
+use std::collections::HashMap;
+use std::sync::Arc;
+
+/// Font sizes are quantized to quarter pixels
+pub const SIZE_STEPS: f32 = 4.0;
+/// Horizontal pen positions are quantized to quarter pixels
+pub const SUBPIXEL_STEPS: u32 = 4;
+
+// Default coverage budget, roughly a few thousand UI-sized glyphs
+const DEFAULT_CAPACITY_BYTES: usize = 4 * 1024 * 1024;
+
+// Metrics are small and cheap to recompute, so once this many are cached
+// the map is emptied rather than aged like the bitmaps
+const MAX_METRICS: usize = 4096;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct GlyphKey {
+    pub font: usize,
+    pub glyph: u16,
+    pub size: u32,
+    pub subpixel: u8,
+}
+
+impl GlyphKey {
+    pub fn new(font: &Font, glyph: u16, font_size: f32, subpixel: u8) -> Self {
+        Self {
+            font: font.file_hash(),
+            glyph,
+            size: quantize_size(font_size),
+            subpixel,
+        }
+    }
+
+    fn px(&self) -> f32 {
+        self.size as f32 / SIZE_STEPS
+    }
+}
+
+pub fn quantize_size(font_size: f32) -> u32 {
+    (font_size * SIZE_STEPS).round().max(1.0) as u32
+}
+
+/// Split a pen position into whole pixels and a subpixel bin
+pub fn split_subpixel(x: f32) -> (i32, u8) {
+    let whole = x.floor();
+    let bin = ((x - whole) * SUBPIXEL_STEPS as f32).floor() as u32;
+    (whole as i32, bin.min(SUBPIXEL_STEPS - 1) as u8)
+}
+
+/// Coverage for one glyph at one subpixel offset, ready for Canvas::blend_mask
+#[derive(Debug)]
+pub struct GlyphBitmap {
+    pub xmin: i32,
+    pub ymin: i32,
+    pub width: usize,
+    pub height: usize,
+    pub coverage: Vec<u8>,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct GlyphCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub metric_misses: u64,
+    pub entries: usize,
+    pub bytes: usize,
+}
+
+struct Entry {
+    bitmap: Arc<GlyphBitmap>,
+    last_used: u64,
+}
+
+pub struct GlyphCache {
+    bitmaps: HashMap<GlyphKey, Entry>,
+    metrics: HashMap<(usize, u16, u32), Metrics>,
+    capacity_bytes: usize,
+    used_bytes: usize,
+    clock: u64,
+    stats: GlyphCacheStats,
+}
+
+impl GlyphCache {
+    pub fn new() -> Self {
+        Self::with_capacity(DEFAULT_CAPACITY_BYTES)
+    }
+
+    pub fn with_capacity(capacity_bytes: usize) -> Self {
+        Self {
+            bitmaps: HashMap::new(),
+            metrics: HashMap::new(),
+            capacity_bytes,
+            used_bytes: 0,
+            clock: 0,
+            stats: GlyphCacheStats::default(),
+        }
+    }
+
+    /// Layout metrics for a glyph, without rasterizing it
+    pub fn metrics(&mut self, font: &Font, glyph: u16, font_size: f32) -> Metrics {
+        let size = quantize_size(font_size);
+        let key = (font.file_hash(), glyph, size);
+        if let Some(metrics) = self.metrics.get(&key) {
+            return *metrics;
+        }
+
+        self.stats.metric_misses += 1;
+        if self.metrics.len() >= MAX_METRICS {
+            self.metrics.clear();
+        }
+        let metrics = font.metrics_indexed(glyph, size as f32 / SIZE_STEPS);
+        self.metrics.insert(key, metrics);
+        metrics
+    }
+
+    /// Coverage for a glyph, rasterizing it only on a cache miss
+    pub fn rasterize(&mut self, font: &Font, key: GlyphKey) -> Arc<GlyphBitmap> {
+        self.clock += 1;
+
+        if let Some(entry) = self.bitmaps.get_mut(&key) {
+            entry.last_used = self.clock;
+            self.stats.hits += 1;
+            return entry.bitmap.clone();
+        }
+
+        self.stats.misses += 1;
+        let (metrics, coverage) = font.rasterize_indexed(key.glyph, key.px());
+        let bitmap = Arc::new(shift_subpixel(&metrics, coverage, key.subpixel));
+
+        self.used_bytes += bitmap.coverage.len();
+        self.bitmaps.insert(
+            key,
+            Entry {
+                bitmap: bitmap.clone(),
+                last_used: self.clock,
+            },
+        );
+        if self.used_bytes > self.capacity_bytes {
+            self.evict();
+        }
+
+        bitmap
+    }
+
+    // Drop least recently used glyphs until a quarter of the budget is free,
+    // so the O(n) scan is amortized over many insertions
+    fn evict(&mut self) {
+        let target = self.capacity_bytes * 3 / 4;
+        let mut by_age: Vec<(u64, GlyphKey, usize)> = self
+            .bitmaps
+            .iter()
+            .map(|(key, entry)| (entry.last_used, *key, entry.bitmap.coverage.len()))
+            .collect();
+        by_age.sort_unstable_by_key(|(last_used, _, _)| *last_used);
+
+        for (_, key, bytes) in by_age {
+            if self.used_bytes <= target {
+                break;
+            }
+            self.bitmaps.remove(&key);
+            self.used_bytes -= bytes;
+        }
+    }
+
+    pub fn stats(&self) -> GlyphCacheStats {
+        GlyphCacheStats {
+            entries: self.bitmaps.len(),
+            bytes: self.used_bytes,
+            ..self.stats
+        }
+    }
+
+    pub fn reset_stats(&mut self) {
+        self.stats = GlyphCacheStats::default();
+    }
+
+    pub fn clear(&mut self) {
+        self.bitmaps.clear();
+        self.metrics.clear();
+        self.used_bytes = 0;
+    }
+}
+
+// fontdue rasterizes at integer pen positions; shift the coverage right by
+// `subpixel / SUBPIXEL_STEPS` of a pixel with a two-tap linear filter
+fn shift_subpixel(metrics: &Metrics, coverage: Vec<u8>, subpixel: u8) -> GlyphBitmap {
+    if subpixel == 0 || metrics.width == 0 {
+        return GlyphBitmap {
+            xmin: metrics.xmin,
+            ymin: metrics.ymin,
+            width: metrics.width,
+            height: metrics.height,
+            coverage,
+        };
+    }
+
+    let weight = subpixel as u32 * 256 / SUBPIXEL_STEPS;
+    let width = metrics.width + 1;
+    let mut shifted = vec![0u8; width * metrics.height];
+    for (src, dst) in coverage
+        .chunks_exact(metrics.width)
+        .zip(shifted.chunks_exact_mut(width))
+    {
+        let mut prev = 0u32;
+        for (i, &c) in src.iter().enumerate() {
+            dst[i] = ((c as u32 * (256 - weight) + prev * weight) >> 8) as u8;
+            prev = c as u32;
+        }
+        dst[width - 1] = ((prev * weight) >> 8) as u8;
+    }
+
+    GlyphBitmap {
+        xmin: metrics.xmin,
+        ymin: metrics.ymin,
+        width,
+        height: metrics.height,
+        coverage: shifted,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn font() -> Font {
+        let bytes = include_bytes!("../../../../fs/library/shared/fonts/Inter-Regular.ttf");
+        Font::from_bytes(bytes as &[u8], fontdue::FontSettings::default()).unwrap()
+    }
+
+    #[test]
+    fn metrics_stay_bounded() {
+        let font = font();
+        let mut cache = GlyphCache::new();
+        let first = cache.metrics(&font, 36, 13.0).advance_width;
+        assert_eq!(cache.metrics(&font, 36, 13.0).advance_width, first);
+        assert_eq!(cache.stats().metric_misses, 1);
+
+        // Every size of a text zoom, far more keys than the map holds
+        for step in 0..MAX_METRICS as u32 * 2 {
+            cache.metrics(&font, 36 + (step % 8) as u16, 8.0 + step as f32 / SIZE_STEPS);
+            assert!(cache.metrics.len() <= MAX_METRICS);
+        }
+        assert_eq!(cache.metrics(&font, 36, 13.0).advance_width, first);
+    }
+}
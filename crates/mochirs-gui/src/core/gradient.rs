@@ -0,0 +1,299 @@
+// Gradient fills
+//
+// A gradient's colors are sampled once into a lookup table of premultiplied
+// pixels. Filling a row is then only a table lookup per pixel: a linear
+// gradient's table index changes by the same amount at every step along a
+// row, so it is carried in fixed point and advanced with one add, and rows
+// that don't change down the rect are shaded once and copied.
+
+use crate::core::color::Color;
+use crate::core::raster;
+use std::fmt;
+use std::sync::OnceLock;
+
+// Table entries from the first stop to the last. Four times the 256 levels
+// a channel can take, so adjacent entries never skip a level.
+const LUT_SIZE: usize = 1024;
+const LUT_MAX: f64 = (LUT_SIZE - 1) as f64;
+// Pixels per batch of table indices on the slower paths
+const BATCH: usize = 64;
+
+// 4x4 ordered dither thresholds, scaled to the 1/256ths of a level kept in
+// the wide table
+const BAYER: [[u16; 4]; 4] = [
+    [8, 136, 40, 168],
+    [200, 72, 232, 104],
+    [56, 184, 24, 152],
+    [248, 120, 216, 88],
+];
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct ColorStop {
+    /// Position along the gradient, 0 at its start and 1 at its end
+    pub offset: f32,
+    pub color: Color,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum GradientKind {
+    /// Across the rect at `angle` degrees: 0 runs left to right, 90 top to
+    /// bottom
+    Linear { angle: f32 },
+    /// Out from `center`, given as fractions of the rect's size. `radius` is
+    /// a fraction of the distance from the center to the farthest corner.
+    Radial { center: (f32, f32), radius: f32 },
+}
+
+#[derive(Clone)]
+pub struct Gradient {
+    kind: GradientKind,
+    stops: Vec<ColorStop>,
+    dither: bool,
+    // Built on first use and shared by everything holding the gradient
+    lut: OnceLock<Lut>,
+}
+
+impl Gradient {
+    pub fn linear(angle: f32) -> Self {
+        Self::new(GradientKind::Linear { angle })
+    }
+
+    pub fn radial(center: (f32, f32), radius: f32) -> Self {
+        Self::new(GradientKind::Radial { center, radius })
+    }
+
+    /// Two-color linear gradient, as taken by `Canvas::fill_gradient_rect`
+    pub fn between(start: Color, end: Color, angle: f32) -> Self {
+        Self::linear(angle).stop(0.0, start).stop(1.0, end)
+    }
+
+    /// Whether this is `Gradient::between(start, end, angle)`
+    pub fn is_between(&self, start: Color, end: Color, angle: f32) -> bool {
+        self.kind == GradientKind::Linear { angle }
+            && !self.dither
+            && self.stops
+                == [
+                    ColorStop { offset: 0.0, color: start },
+                    ColorStop { offset: 1.0, color: end },
+                ]
+    }
+
+    fn new(kind: GradientKind) -> Self {
+        Self {
+            kind,
+            stops: Vec::new(),
+            dither: false,
+            lut: OnceLock::new(),
+        }
+    }
+
+    /// Add a color stop. Stops may be added in any order.
+    pub fn stop(mut self, offset: f32, color: Color) -> Self {
+        let offset = offset.clamp(0.0, 1.0);
+        let index = self.stops.partition_point(|s| s.offset <= offset);
+        self.stops.insert(index, ColorStop { offset, color });
+        self.lut = OnceLock::new();
+        self
+    }
+
+    /// Break up banding in slow, wide gradients with an ordered dither
+    pub fn dithered(mut self) -> Self {
+        self.dither = true;
+        self.lut = OnceLock::new();
+        self
+    }
+
+    pub fn kind(&self) -> GradientKind {
+        self.kind
+    }
+
+    pub fn stops(&self) -> &[ColorStop] {
+        &self.stops
+    }
+
+    pub fn is_opaque(&self) -> bool {
+        !self.stops.is_empty() && self.stops.iter().all(|s| s.color.a == 255)
+    }
+
+    /// Lay the gradient out over a `width` x `height` rect
+    pub fn shader(&self, width: i32, height: i32) -> Shader<'_> {
+        let lut = self.lut.get_or_init(|| Lut::build(&self.stops, self.dither));
+        let (width, height) = (width.max(1) as f64, height.max(1) as f64);
+        let geometry = match self.kind {
+            GradientKind::Linear { angle } => {
+                let (sin, cos) = (angle as f64).to_radians().sin_cos();
+                Geometry::Linear {
+                    dx: cos / width * LUT_MAX,
+                    dy: sin / height * LUT_MAX,
+                }
+            }
+            GradientKind::Radial { center, radius } => {
+                let (cx, cy) = (center.0 as f64 * width, center.1 as f64 * height);
+                let farthest = cx.max(width - cx).hypot(cy.max(height - cy));
+                let radius = (radius as f64 * farthest).max(1e-3);
+                Geometry::Radial {
+                    cx: cx as f32,
+                    cy: cy as f32,
+                    scale: (LUT_MAX / radius) as f32,
+                }
+            }
+        };
+        Shader {
+            lut,
+            dither: self.dither,
+            geometry,
+        }
+    }
+}
+
+impl PartialEq for Gradient {
+    fn eq(&self, other: &Self) -> bool {
+        self.kind == other.kind && self.stops == other.stops && self.dither == other.dither
+    }
+}
+
+impl fmt::Debug for Gradient {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Gradient")
+            .field("kind", &self.kind)
+            .field("stops", &self.stops)
+            .field("dither", &self.dither)
+            .finish()
+    }
+}
+
+#[derive(Clone)]
+struct Lut {
+    // Premultiplied BGRA, rounded
+    pixels: Vec<u32>,
+    // The same in 8.8 fixed point, kept only for dithering
+    wide: Vec<[u16; 4]>,
+}
+
+impl Lut {
+    fn build(stops: &[ColorStop], dither: bool) -> Self {
+        let mut pixels = Vec::with_capacity(LUT_SIZE);
+        let mut wide = Vec::with_capacity(if dither { LUT_SIZE } else { 0 });
+        for i in 0..LUT_SIZE {
+            let color = sample(stops, i as f32 / LUT_MAX as f32);
+            pixels.push(u32::from_le_bytes(color.map(|c| c.round() as u8)));
+            if dither {
+                wide.push(color.map(|c| (c * 256.0) as u16));
+            }
+        }
+        Self { pixels, wide }
+    }
+}
+
+// Premultiplied BGRA at `t`, interpolated between the stops around it.
+// Interpolating premultiplied keeps fades to transparent from darkening.
+fn sample(stops: &[ColorStop], t: f32) -> [f32; 4] {
+    let premultiplied = |c: Color| {
+        let a = c.a as f32 / 255.0;
+        [c.b as f32 * a, c.g as f32 * a, c.r as f32 * a, c.a as f32]
+    };
+    let next = stops.partition_point(|s| s.offset <= t);
+    let (from, to) = match (next.checked_sub(1), stops.get(next)) {
+        (Some(prev), Some(to)) => (&stops[prev], to),
+        (Some(prev), None) => return premultiplied(stops[prev].color),
+        (None, Some(to)) => return premultiplied(to.color),
+        (None, None) => return [0.0; 4],
+    };
+
+    let span = to.offset - from.offset;
+    let f = if span > 0.0 { (t - from.offset) / span } else { 1.0 };
+    let (a, b) = (premultiplied(from.color), premultiplied(to.color));
+    std::array::from_fn(|i| a[i] + (b[i] - a[i]) * f)
+}
+
+#[derive(Debug, Clone, Copy)]
+enum Geometry {
+    // Table index per pixel across and down
+    Linear { dx: f64, dy: f64 },
+    // Center in pixels, table index per pixel of distance
+    Radial { cx: f32, cy: f32, scale: f32 },
+}
+
+/// A gradient laid out over a rect. Coordinates are relative to the rect.
+pub struct Shader<'a> {
+    lut: &'a Lut,
+    dither: bool,
+    geometry: Geometry,
+}
+
+impl Shader<'_> {
+    /// Every row is the same, so one can be shaded and copied down
+    pub fn rows_repeat(&self) -> bool {
+        matches!(self.geometry, Geometry::Linear { dy, .. } if dy == 0.0) && !self.dither
+    }
+
+    /// Shade the pixels of row `y` from column `x`
+    pub fn row(&self, dst: &mut [u8], x: i32, y: i32) {
+        match self.geometry {
+            Geometry::Linear { dx, dy } if !self.dither => {
+                let start = x as f64 * dx + y as f64 * dy;
+                let step = (dx * 65536.0).round() as i32;
+                if step == 0 {
+                    raster::fill_span(dst, self.lut.pixels[index(start)]);
+                } else {
+                    raster::lut_span(dst, &self.lut.pixels, (start * 65536.0).round() as i32, step);
+                }
+            }
+            geometry => {
+                // Indices are worked out a batch at a time, in a loop simple
+                // enough to vectorize, then looked up
+                let mut indices = [0u16; BATCH];
+                for (n, chunk) in dst.chunks_mut(BATCH * 4).enumerate() {
+                    let x = x + (n * BATCH) as i32;
+                    let indices = &mut indices[..chunk.len() / 4];
+                    match geometry {
+                        Geometry::Linear { dx, dy } => {
+                            let start = x as f64 * dx + y as f64 * dy;
+                            let (start, dx) = (start as f32, dx as f32);
+                            for (i, index) in indices.iter_mut().enumerate() {
+                                *index = (start + i as f32 * dx).clamp(0.0, LUT_MAX as f32) as u16;
+                            }
+                        }
+                        Geometry::Radial { cx, cy, scale } => {
+                            let dy = y as f32 + 0.5 - cy;
+                            let start = x as f32 + 0.5 - cx;
+                            for (i, index) in indices.iter_mut().enumerate() {
+                                let dx = start + i as f32;
+                                *index = ((dx * dx + dy * dy).sqrt() * scale).min(LUT_MAX as f32) as u16;
+                            }
+                        }
+                    }
+                    self.store(chunk, indices, x, y);
+                }
+            }
+        }
+    }
+
+    fn store(&self, dst: &mut [u8], indices: &[u16], x: i32, y: i32) {
+        let pixels = dst.chunks_exact_mut(4).zip(indices);
+        if !self.dither {
+            for (pixel, &at) in pixels {
+                pixel.copy_from_slice(&self.lut.pixels[at as usize].to_le_bytes());
+            }
+            return;
+        }
+
+        // Round each wide entry up or down by the pixel's threshold. Color
+        // channels stay within alpha so the pixel is still premultiplied.
+        let thresholds = &BAYER[(y & 3) as usize];
+        for (i, (pixel, &at)) in pixels.enumerate() {
+            let threshold = thresholds[(x + i as i32) as usize & 3] as u32;
+            let wide = self.lut.wide[at as usize];
+            let level = |c: u16| ((c as u32 + threshold) >> 8).min(255) as u8;
+            let alpha = level(wide[3]);
+            pixel[0] = level(wide[0]).min(alpha);
+            pixel[1] = level(wide[1]).min(alpha);
+            pixel[2] = level(wide[2]).min(alpha);
+            pixel[3] = alpha;
+        }
+    }
+}
+
+fn index(t: f64) -> usize {
+    t.clamp(0.0, LUT_MAX) as usize
+}
@@ -0,0 +1,198 @@
+// SVG icon cache
+//
+// Icons are parsed once when registered. Each (icon, size, scale) is
+// rasterized the first time it is drawn into a coverage mask, which is
+// then kept and blitted with `Canvas::draw_glyph` in whatever color the
+// caller wants, so drawing a cached icon is a hash lookup and a blend.
+
+use crate::core::glyph_cache::GlyphBitmap;
+use crate::core::ui::hash_with;
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::sync::Arc;
+
+/// Built-in titlebar icons, always registered
+pub const MINIMIZE: &str = "minimize";
+pub const MAXIMIZE: &str = "maximize";
+pub const RESTORE: &str = "restore";
+pub const QUIT: &str = "quit";
+
+// SVG icon assets embedded at compile time
+const BUILTIN: [(&str, &str); 4] = [
+    (MINIMIZE, include_str!("../assets/ui_minimize.svg")),
+    (MAXIMIZE, include_str!("../assets/ui_maximize.svg")),
+    (RESTORE, include_str!("../assets/ui_restore.svg")),
+    (QUIT, include_str!("../assets/ui_quit.svg")),
+];
+
+// Masks kept; the least recently used half is dropped past this
+const MAX_MASKS: usize = 256;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct IconKey {
+    id: u64,
+    width: u32,
+    height: u32,
+    scale: u32,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct IconCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub icons: usize,
+    pub masks: usize,
+}
+
+struct CachedMask {
+    mask: Arc<GlyphBitmap>,
+    last_used: u64,
+}
+
+struct IconCache {
+    trees: HashMap<u64, resvg::usvg::Tree>,
+    masks: HashMap<IconKey, CachedMask>,
+    clock: u64,
+    stats: IconCacheStats,
+}
+
+// Icons are rasterized on the thread that builds the frame; the masks
+// themselves are shared freely once made
+thread_local! {
+    static ICONS: RefCell<IconCache> = RefCell::new(IconCache::new());
+}
+
+fn icon_id(id: &str) -> u64 {
+    hash_with(|h| id.hash(h))
+}
+
+/// Parse `svg` and make it drawable as `id`, replacing any icon already
+/// registered under that name. Returns false if the SVG doesn't parse.
+pub fn register(id: &str, svg: &str) -> bool {
+    ICONS.with(|icons| icons.borrow_mut().register(id, svg))
+}
+
+/// Coverage mask for icon `id` fitted into `width` x `height`, at `scale`
+/// device pixels per logical pixel. None if no such icon is registered.
+pub fn mask(id: &str, width: u32, height: u32, scale: u32) -> Option<Arc<GlyphBitmap>> {
+    let key = IconKey {
+        id: icon_id(id),
+        width,
+        height,
+        scale: scale.max(1),
+    };
+    ICONS.with(|icons| icons.borrow_mut().get(key))
+}
+
+/// Cache counters for this thread. Misses are rasterizations, so a steady
+/// state frame should only add hits.
+pub fn cache_stats() -> IconCacheStats {
+    ICONS.with(|icons| {
+        let icons = icons.borrow();
+        IconCacheStats {
+            icons: icons.trees.len(),
+            masks: icons.masks.len(),
+            ..icons.stats
+        }
+    })
+}
+
+impl IconCache {
+    fn new() -> Self {
+        let mut cache = Self {
+            trees: HashMap::new(),
+            masks: HashMap::new(),
+            clock: 0,
+            stats: IconCacheStats::default(),
+        };
+        for (id, svg) in BUILTIN {
+            cache.register(id, svg);
+        }
+        cache
+    }
+
+    fn register(&mut self, id: &str, svg: &str) -> bool {
+        let tree = match resvg::usvg::Tree::from_str(svg, &resvg::usvg::Options::default()) {
+            Ok(tree) => tree,
+            Err(err) => {
+                debug_log!("Failed to parse icon {}: {}", id, err);
+                return false;
+            }
+        };
+        let id = icon_id(id);
+        self.trees.insert(id, tree);
+        // Masks of an icon being replaced are stale
+        self.masks.retain(|key, _| key.id != id);
+        true
+    }
+
+    fn get(&mut self, key: IconKey) -> Option<Arc<GlyphBitmap>> {
+        self.clock += 1;
+        if let Some(cached) = self.masks.get_mut(&key) {
+            cached.last_used = self.clock;
+            self.stats.hits += 1;
+            return Some(cached.mask.clone());
+        }
+
+        let start = std::time::Instant::now();
+        let mask = Arc::new(rasterize(self.trees.get(&key.id)?, key)?);
+        self.stats.misses += 1;
+        debug_log!(
+            "Rasterized {}x{}@{} icon in {:.2}ms",
+            key.width,
+            key.height,
+            key.scale,
+            start.elapsed().as_secs_f64() * 1000.0
+        );
+
+        self.masks.insert(
+            key,
+            CachedMask {
+                mask: mask.clone(),
+                last_used: self.clock,
+            },
+        );
+        if self.masks.len() > MAX_MASKS {
+            let mut ages: Vec<u64> = self.masks.values().map(|m| m.last_used).collect();
+            ages.sort_unstable();
+            let cutoff = ages[ages.len() / 2];
+            self.masks.retain(|_, m| m.last_used > cutoff);
+        }
+        Some(mask)
+    }
+}
+
+// Render the icon at twice its size, scaled to fit, then average each 2x2
+// block of alpha
+fn rasterize(tree: &resvg::usvg::Tree, key: IconKey) -> Option<GlyphBitmap> {
+    use tiny_skia::{Pixmap, Transform};
+
+    let (width, height) = (key.width * key.scale, key.height * key.scale);
+    let (render_width, render_height) = (width * 2, height * 2);
+    let mut pixmap = Pixmap::new(render_width, render_height)?;
+
+    let size = tree.size();
+    let scale = (render_width as f32 / size.width()).min(render_height as f32 / size.height());
+    resvg::render(tree, Transform::from_scale(scale, scale), &mut pixmap.as_mut());
+
+    let (pixels, stride) = (pixmap.data(), render_width as usize * 4);
+    let mut coverage = vec![0u8; (width * height) as usize];
+    for (py, row) in coverage.chunks_exact_mut(width as usize).enumerate() {
+        let top = &pixels[py * 2 * stride..(py * 2 + 1) * stride];
+        let bottom = &pixels[(py * 2 + 1) * stride..(py * 2 + 2) * stride];
+        for (px, out) in row.iter_mut().enumerate() {
+            let alpha = |line: &[u8], x: usize| line[x * 4 + 3] as u32;
+            let sum = alpha(top, px * 2) + alpha(top, px * 2 + 1) + alpha(bottom, px * 2) + alpha(bottom, px * 2 + 1);
+            *out = ((sum + 2) / 4) as u8;
+        }
+    }
+
+    Some(GlyphBitmap {
+        xmin: 0,
+        ymin: 0,
+        width: width as usize,
+        height: height as usize,
+        coverage,
+    })
+}
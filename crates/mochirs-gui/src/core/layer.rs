@@ -0,0 +1,93 @@
+// Offscreen layers for cached subtrees
+//
+// A layer holds a subtree rendered once into premultiplied pixels. It stays
+// valid while the subtree's paint hashes and bounds are unchanged, and later
+// frames only composite it.
+
+use crate::core::canvas::Canvas;
+use crate::core::text::TextRenderer;
+use crate::core::ui::{Element, Rect};
+use std::collections::hash_map::DefaultHasher;
+use std::hash::{Hash, Hasher};
+use std::sync::Arc;
+
+// Larger subtrees are drawn directly rather than cached (64 MiB of pixels)
+const MAX_LAYER_PIXELS: i64 = 16 * 1024 * 1024;
+
+pub struct Layer {
+    hash: u64,
+    bounds: Rect,
+    // Shared with the display lists that composite the layer
+    pixels: Arc<Vec<u8>>,
+}
+
+impl Layer {
+    pub fn new() -> Self {
+        Self {
+            hash: 0,
+            bounds: Rect::new(0, 0, 0, 0),
+            pixels: Arc::new(Vec::new()),
+        }
+    }
+
+    pub fn bounds(&self) -> Rect {
+        self.bounds
+    }
+
+    pub fn is_valid(&self, hash: u64, bounds: Rect) -> bool {
+        self.hash == hash && self.bounds == bounds && !self.pixels.is_empty()
+    }
+
+    /// Re-render `element` into the layer
+    pub fn update(&mut self, element: &dyn Element, text_renderer: &TextRenderer, hash: u64, bounds: Rect) {
+        let start = std::time::Instant::now();
+
+        // Reuse the allocation when only the contents changed. Last frame's
+        // display list has been cleared by now, so nothing else holds it.
+        let pixels = Arc::make_mut(&mut self.pixels);
+        pixels.clear();
+        pixels.resize(bounds.area() as usize * 4, 0);
+        self.hash = hash;
+        self.bounds = bounds;
+
+        let mut canvas = Canvas::layer(pixels, bounds);
+        element.render(&mut canvas, text_renderer);
+
+        debug_log!(
+            "Rendered {}x{} layer in {:.2}ms",
+            bounds.width,
+            bounds.height,
+            start.elapsed().as_secs_f64() * 1000.0
+        );
+    }
+
+    pub fn composite(&self, canvas: &mut Canvas) {
+        canvas.composite_layer(self.bounds, self.bounds, &self.pixels);
+    }
+}
+
+/// Combined paint hash of an element and all its descendants, or None if
+/// any of them can't describe its paint state
+pub fn subtree_hash(element: &dyn Element) -> Option<u64> {
+    let mut hasher = DefaultHasher::new();
+    element.paint_hash()?.hash(&mut hasher);
+    for child in element.children() {
+        subtree_hash(child.as_ref())?.hash(&mut hasher);
+    }
+    Some(hasher.finish())
+}
+
+/// Area painted by an element and all its descendants
+pub fn subtree_bounds(element: &dyn Element, text_renderer: &TextRenderer) -> Rect {
+    element
+        .children()
+        .iter()
+        .fold(element.paint_bounds(text_renderer), |bounds, child| {
+            bounds.union(&subtree_bounds(child.as_ref(), text_renderer))
+        })
+}
+
+/// Whether a subtree with these bounds is worth caching
+pub fn cacheable(bounds: &Rect) -> bool {
+    !bounds.is_empty() && bounds.area() <= MAX_LAYER_PIXELS
+}
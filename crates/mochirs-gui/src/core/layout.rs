@@ -0,0 +1,224 @@
+// Text layout: shapes a string once into positioned glyph runs
+//
+// Shaping covers per-glyph advances, pair kerning and greedy word wrapping.
+// Runs are cached by (text hash, font, size, max width) so unchanged labels
+// skip shaping entirely and only blit cached glyphs.
+
+use crate::core::glyph_cache::{quantize_size, GlyphCache, SIZE_STEPS};
+use fontdue::Font;
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::hash::{Hash, Hasher};
+use std::sync::Arc;
+
+// Shaped runs kept before the least recently used half is dropped
+const MAX_RUNS: usize = 512;
+
+#[derive(Debug, Clone, Copy)]
+pub struct PositionedGlyph {
+    pub glyph: u16,
+    /// Pen position relative to the start of the glyph's line
+    pub x: f32,
+}
+
+#[derive(Debug, Clone, Copy)]
+pub struct TextLine {
+    /// Range into `TextRun::glyphs`
+    pub start: usize,
+    pub end: usize,
+    pub width: f32,
+}
+
+#[derive(Debug)]
+pub struct TextRun {
+    pub text: String,
+    pub font_size: f32,
+    pub glyphs: Vec<PositionedGlyph>,
+    pub lines: Vec<TextLine>,
+    /// Widest line, in pixels
+    pub width: f32,
+    /// Distance from the top of the run to the first baseline
+    pub ascent: i32,
+    /// Tallest glyph bitmap in the run
+    pub max_glyph_height: i32,
+    pub line_height: f32,
+}
+
+impl TextRun {
+    pub fn line_glyphs(&self, line: &TextLine) -> &[PositionedGlyph] {
+        &self.glyphs[line.start..line.end]
+    }
+
+    pub fn width_px(&self) -> i32 {
+        self.width.ceil() as i32
+    }
+
+    pub fn height_px(&self) -> i32 {
+        (self.line_height * self.lines.len() as f32).ceil() as i32
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct RunKey {
+    text: u64,
+    font: usize,
+    size: u32,
+    max_width: Option<i32>,
+}
+
+struct CachedRun {
+    run: Arc<TextRun>,
+    last_used: u64,
+}
+
+pub struct LayoutCache {
+    runs: HashMap<RunKey, CachedRun>,
+    clock: u64,
+}
+
+impl LayoutCache {
+    pub fn new() -> Self {
+        Self {
+            runs: HashMap::new(),
+            clock: 0,
+        }
+    }
+
+    pub fn layout(
+        &mut self,
+        glyphs: &mut GlyphCache,
+        font: &Font,
+        text: &str,
+        font_size: f32,
+        max_width: Option<i32>,
+    ) -> Arc<TextRun> {
+        let mut hasher = DefaultHasher::new();
+        text.hash(&mut hasher);
+        let key = RunKey {
+            text: hasher.finish(),
+            font: font.file_hash(),
+            size: quantize_size(font_size),
+            max_width,
+        };
+
+        self.clock += 1;
+        if let Some(cached) = self.runs.get_mut(&key) {
+            // Guard against hash collisions
+            if cached.run.text == text {
+                cached.last_used = self.clock;
+                return cached.run.clone();
+            }
+        }
+
+        let run = Arc::new(shape(glyphs, font, text, font_size, max_width));
+        self.runs.insert(
+            key,
+            CachedRun {
+                run: run.clone(),
+                last_used: self.clock,
+            },
+        );
+        if self.runs.len() > MAX_RUNS {
+            self.evict();
+        }
+        run
+    }
+
+    fn evict(&mut self) {
+        let mut ages: Vec<u64> = self.runs.values().map(|r| r.last_used).collect();
+        ages.sort_unstable();
+        let cutoff = ages[ages.len() / 2];
+        self.runs.retain(|_, r| r.last_used > cutoff);
+    }
+}
+
+fn shape(
+    glyphs: &mut GlyphCache,
+    font: &Font,
+    text: &str,
+    font_size: f32,
+    max_width: Option<i32>,
+) -> TextRun {
+    let px = quantize_size(font_size) as f32 / SIZE_STEPS;
+    let max_width = max_width.map(|w| w as f32);
+
+    let mut positioned: Vec<PositionedGlyph> = Vec::with_capacity(text.len());
+    let mut lines = Vec::new();
+    let mut line_start = 0;
+    let mut pen = 0.0f32;
+    let mut prev: Option<u16> = None;
+    // Last wrap opportunity on this line: (next line's first glyph, its pen
+    // position, width of this line if broken there)
+    let mut wrap_at: Option<(usize, f32, f32)> = None;
+    let mut ascent = 0;
+    let mut max_glyph_height = 0;
+
+    for ch in text.chars() {
+        if ch == '\n' {
+            lines.push(TextLine {
+                start: line_start,
+                end: positioned.len(),
+                width: pen,
+            });
+            line_start = positioned.len();
+            pen = 0.0;
+            prev = None;
+            wrap_at = None;
+            continue;
+        }
+
+        let glyph = font.lookup_glyph_index(ch);
+        let metrics = glyphs.metrics(font, glyph, font_size);
+        if let Some(left) = prev {
+            pen += font.horizontal_kern_indexed(left, glyph, px).unwrap_or(0.0);
+        }
+
+        if ch.is_whitespace() {
+            wrap_at = Some((positioned.len() + 1, pen + metrics.advance_width, pen));
+        } else if let (Some(max), Some((next_start, next_pen, width))) = (max_width, wrap_at) {
+            if pen + metrics.advance_width > max {
+                lines.push(TextLine {
+                    start: line_start,
+                    end: next_start - 1,
+                    width,
+                });
+                for g in &mut positioned[next_start..] {
+                    g.x -= next_pen;
+                }
+                pen -= next_pen;
+                line_start = next_start;
+                wrap_at = None;
+            }
+        }
+
+        if metrics.height > 0 {
+            ascent = ascent.max(metrics.height as i32 + metrics.ymin);
+            max_glyph_height = max_glyph_height.max(metrics.height as i32);
+        }
+        positioned.push(PositionedGlyph { glyph, x: pen });
+        pen += metrics.advance_width;
+        prev = Some(glyph);
+    }
+    lines.push(TextLine {
+        start: line_start,
+        end: positioned.len(),
+        width: pen,
+    });
+
+    let width = lines.iter().fold(0.0f32, |w, line| w.max(line.width));
+    let line_height = font
+        .horizontal_line_metrics(px)
+        .map(|m| m.new_line_size)
+        .unwrap_or(px * 1.2);
+
+    TextRun {
+        text: text.to_string(),
+        font_size,
+        glyphs: positioned,
+        lines,
+        width,
+        ascent,
+        max_glyph_height,
+        line_height,
+    }
+}
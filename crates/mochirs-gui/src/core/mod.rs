@@ -1,7 +1,31 @@
+// Debug logging shared by every module below; enabled with MOCHI_DEBUG
+macro_rules! debug_log {
+    ($($arg:tt)*) => {
+        if crate::core::profiler::debug_enabled() {
+            eprintln!("[MOCHI DEBUG] {}", format!($($arg)*));
+        }
+    };
+}
+
 pub mod canvas;
 pub mod color;
+pub mod damage;
 pub mod dialog;
+pub mod display_list;
+pub mod glyph_cache;
+pub mod gradient;
+pub mod icons;
+pub mod layer;
+pub mod layout;
+pub mod profiler;
+pub mod raster;
+pub mod retained;
+pub mod rounded;
+pub mod shadow;
+pub mod stretch;
+pub mod swapchain;
 pub mod text;
+pub mod tiles;
 pub mod ui;
 pub mod window;
 pub mod rsx;
@@ -9,7 +33,12 @@ pub mod rsx;
 pub use canvas::Canvas;
 pub use color::Color;
 pub use dialog::Dialog;
+pub use display_list::{DisplayList, RecordingCanvas};
+pub use gradient::Gradient;
+pub use retained::RetainedTree;
+pub use rounded::{Border, CornerRadii};
 pub use text::TextRenderer;
 pub use ui::*;
-pub use window::{Window, WindowConfig};
+pub use stretch::ScaleFilter;
+pub use window::{AppState, ResizeMode, Window, WindowConfig};
 pub use rsx::*;
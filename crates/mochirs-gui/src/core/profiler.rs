@@ -0,0 +1,405 @@
+// Frame profiler
+//
+// Compiled in with the `profiler` feature and switched on at run time with
+// MOCHI_PROFILE, which is read once:
+//
+//   MOCHI_PROFILE=1         a summary on stderr every second of drawing
+//   MOCHI_PROFILE=overlay   the same, plus a frame time graph in the window
+//   MOCHI_PROFILE_TRACE=f   also write a Chrome trace to f when the window
+//                           closes (chrome://tracing or ui.perfetto.dev)
+//
+// Code is instrumented with `let _scope = profiler::scope("name");`, timed
+// until the guard drops. Scopes are buffered per thread and handed over
+// when the outermost scope on that thread ends, so tile workers don't
+// contend on every primitive. Without the feature `Scope` is zero-sized and
+// every function here is empty, so instrumentation costs nothing.
+
+use std::sync::OnceLock;
+use std::time::Duration;
+
+pub use imp::*;
+
+/// Whether MOCHI_DEBUG is set, looked up on first use
+pub fn debug_enabled() -> bool {
+    static DEBUG: OnceLock<bool> = OnceLock::new();
+    *DEBUG.get_or_init(|| std::env::var("MOCHI_DEBUG").is_ok())
+}
+
+/// Timings of one drawn frame
+#[derive(Debug, Clone, Default)]
+pub struct FrameProfile {
+    pub number: u64,
+    /// From the start of the draw to the commit
+    pub total: Duration,
+    /// From the commit until the compositor reported the frame on screen;
+    /// None without presentation-time feedback
+    pub present: Option<Duration>,
+    /// Time and calls per scope, summed over threads. Nested scopes are
+    /// also counted in their parents.
+    pub scopes: Vec<(&'static str, Duration, u32)>,
+}
+
+#[cfg(feature = "profiler")]
+mod imp {
+    use super::FrameProfile;
+    use crate::core::canvas::Canvas;
+    use crate::core::color::Color;
+    use crate::core::ui::Rect;
+    use std::cell::RefCell;
+    use std::collections::VecDeque;
+    use std::io::Write;
+    use std::sync::atomic::{AtomicU64, Ordering};
+    use std::sync::{Mutex, OnceLock};
+    use std::time::{Duration, Instant};
+
+    // Frames kept for the overlay and `history`
+    const HISTORY: usize = 120;
+    // Trace events kept before further ones are dropped (~40MB)
+    const MAX_TRACE_EVENTS: usize = 1 << 20;
+    // Overlay graph: pixels per bar and per millisecond
+    const BAR_WIDTH: i32 = 2;
+    const PX_PER_MS: f64 = 2.0;
+    const GRAPH_HEIGHT: i32 = 66;
+    const FRAME_BUDGET_MS: f64 = 1000.0 / 60.0;
+
+    struct Config {
+        overlay: bool,
+        trace: Option<String>,
+        origin: Instant,
+    }
+
+    fn config() -> Option<&'static Config> {
+        static CONFIG: OnceLock<Option<Config>> = OnceLock::new();
+        CONFIG
+            .get_or_init(|| {
+                let mode = std::env::var("MOCHI_PROFILE").ok()?;
+                Some(Config {
+                    overlay: mode == "overlay",
+                    trace: std::env::var("MOCHI_PROFILE_TRACE").ok(),
+                    origin: Instant::now(),
+                })
+            })
+            .as_ref()
+    }
+
+    #[derive(Clone, Copy)]
+    struct TraceEvent {
+        name: &'static str,
+        thread: u64,
+        start: Instant,
+        duration: Duration,
+    }
+
+    struct Local {
+        thread: u64,
+        depth: u32,
+        scopes: Vec<(&'static str, Duration, u32)>,
+        events: Vec<TraceEvent>,
+    }
+
+    // Handed over from every thread, emptied into a FrameProfile at the
+    // end of each frame
+    #[derive(Default)]
+    struct Shared {
+        scopes: Vec<(&'static str, Duration, u32)>,
+        events: Vec<TraceEvent>,
+        history: VecDeque<FrameProfile>,
+        // Since the last summary
+        report_start: Option<Instant>,
+        committed: u32,
+        presented: u32,
+    }
+
+    thread_local! {
+        static LOCAL: RefCell<Local> = RefCell::new(Local {
+            thread: {
+                static NEXT: AtomicU64 = AtomicU64::new(1);
+                NEXT.fetch_add(1, Ordering::Relaxed)
+            },
+            depth: 0,
+            scopes: Vec::new(),
+            events: Vec::new(),
+        });
+    }
+
+    static SHARED: Mutex<Option<Shared>> = Mutex::new(None);
+
+    fn with_shared<R>(f: impl FnOnce(&mut Shared) -> R) -> R {
+        let mut shared = SHARED.lock().unwrap_or_else(|e| e.into_inner());
+        f(shared.get_or_insert_with(Shared::default))
+    }
+
+    fn add(scopes: &mut Vec<(&'static str, Duration, u32)>, name: &'static str, time: Duration, calls: u32) {
+        match scopes.iter_mut().find(|(n, ..)| *n == name) {
+            Some(entry) => {
+                entry.1 += time;
+                entry.2 += calls;
+            }
+            None => scopes.push((name, time, calls)),
+        }
+    }
+
+    fn flush(local: &mut Local) {
+        with_shared(|shared| {
+            for (name, time, calls) in local.scopes.drain(..) {
+                add(&mut shared.scopes, name, time, calls);
+            }
+            let room = MAX_TRACE_EVENTS.saturating_sub(shared.events.len());
+            shared.events.extend(local.events.drain(..).take(room));
+        });
+    }
+
+    pub fn enabled() -> bool {
+        config().is_some()
+    }
+
+    pub fn overlay_enabled() -> bool {
+        config().map_or(false, |c| c.overlay)
+    }
+
+    /// Times the enclosing block until dropped
+    pub struct Scope {
+        name: &'static str,
+        start: Option<Instant>,
+    }
+
+    pub fn scope(name: &'static str) -> Scope {
+        let start = enabled().then(|| {
+            LOCAL.with(|local| local.borrow_mut().depth += 1);
+            Instant::now()
+        });
+        Scope { name, start }
+    }
+
+    impl Drop for Scope {
+        fn drop(&mut self) {
+            let Some(start) = self.start else {
+                return;
+            };
+            let duration = start.elapsed();
+            let trace = config().map_or(false, |c| c.trace.is_some());
+            LOCAL.with(|local| {
+                let mut local = local.borrow_mut();
+                add(&mut local.scopes, self.name, duration, 1);
+                if trace {
+                    let thread = local.thread;
+                    local.events.push(TraceEvent {
+                        name: self.name,
+                        thread,
+                        start,
+                        duration,
+                    });
+                }
+                local.depth -= 1;
+                if local.depth == 0 {
+                    flush(&mut local);
+                }
+            });
+        }
+    }
+
+    /// Close frame `number`, which took `total` to draw and commit. Scopes
+    /// still open on other threads are counted in the next frame.
+    pub fn end_frame(number: u64, total: Duration) {
+        if !enabled() {
+            return;
+        }
+        LOCAL.with(|local| flush(&mut local.borrow_mut()));
+        let report = with_shared(|shared| {
+            let mut scopes = std::mem::take(&mut shared.scopes);
+            scopes.sort_by(|a, b| b.1.cmp(&a.1));
+            if shared.history.len() == HISTORY {
+                shared.history.pop_front();
+            }
+            shared.history.push_back(FrameProfile {
+                number,
+                total,
+                present: None,
+                scopes,
+            });
+            shared.committed += 1;
+
+            let start = *shared.report_start.get_or_insert_with(Instant::now);
+            let elapsed = start.elapsed();
+            if elapsed < Duration::from_secs(1) {
+                return None;
+            }
+            let report = summary(shared, elapsed);
+            shared.report_start = Some(Instant::now());
+            shared.committed = 0;
+            shared.presented = 0;
+            Some(report)
+        });
+        if let Some(report) = report {
+            eprintln!("[PROFILE] {}", report);
+        }
+    }
+
+    // One line over the frames drawn since the last summary
+    fn summary(shared: &Shared, elapsed: Duration) -> String {
+        let count = (shared.committed as usize).min(shared.history.len());
+        let frames: Vec<&FrameProfile> = shared.history.iter().rev().take(count).collect();
+        let ms = |d: Duration| d.as_secs_f64() * 1000.0;
+
+        let mut totals: Vec<f64> = frames.iter().map(|f| ms(f.total)).collect();
+        totals.sort_by(|a, b| a.total_cmp(b));
+        let average = totals.iter().sum::<f64>() / totals.len().max(1) as f64;
+        let p95 = totals.get(totals.len() * 95 / 100).copied().unwrap_or(0.0);
+        let max = totals.last().copied().unwrap_or(0.0);
+        let seconds = elapsed.as_secs_f64();
+
+        let mut line = format!(
+            "{:.1} fps ({:.1} presented), frame avg {:.2}ms p95 {:.2}ms max {:.2}ms",
+            shared.committed as f64 / seconds,
+            shared.presented as f64 / seconds,
+            average,
+            p95,
+            max
+        );
+        let presents: Vec<f64> = frames.iter().filter_map(|f| f.present.map(ms)).collect();
+        if !presents.is_empty() {
+            let average = presents.iter().sum::<f64>() / presents.len() as f64;
+            line += &format!(", present latency avg {:.2}ms", average);
+        }
+
+        let mut scopes = Vec::new();
+        for frame in &frames {
+            for &(name, time, calls) in &frame.scopes {
+                add(&mut scopes, name, time, calls);
+            }
+        }
+        scopes.sort_by(|a, b| b.1.cmp(&a.1));
+        for (name, time, calls) in scopes.iter().take(6) {
+            let n = frames.len().max(1) as f64;
+            line += &format!(" | {} {:.2}ms x{:.0}", name, ms(*time) / n, *calls as f64 / n);
+        }
+        line
+    }
+
+    /// The compositor put frame `number` on screen `latency` after its
+    /// commit
+    pub fn presented(number: u64, latency: Duration) {
+        if !enabled() {
+            return;
+        }
+        with_shared(|shared| {
+            shared.presented += 1;
+            if let Some(frame) = shared.history.iter_mut().rev().find(|f| f.number == number) {
+                frame.present = Some(latency);
+            }
+        });
+    }
+
+    /// The most recent frames, oldest first
+    pub fn history() -> Vec<FrameProfile> {
+        with_shared(|shared| shared.history.iter().cloned().collect())
+    }
+
+    /// Draw a graph of recent frame times in the top right corner: one bar
+    /// per frame, green within half a 60Hz frame, yellow within one, red
+    /// beyond. The line marks 16.7ms.
+    pub fn draw_overlay(canvas: &mut Canvas) {
+        if !overlay_enabled() {
+            return;
+        }
+        let totals: Vec<f64> =
+            with_shared(|shared| shared.history.iter().map(|f| f.total.as_secs_f64() * 1000.0).collect());
+
+        let width = HISTORY as i32 * BAR_WIDTH + 8;
+        let height = GRAPH_HEIGHT + 8;
+        let x = (canvas.width() as i32 - width - 8).max(0);
+        let y = 8;
+        canvas.add_damage(Rect::new(x, y, width, height));
+        canvas.fill_rect(x, y, width, height, Color::rgba(0, 0, 0, 180));
+
+        let base = y + 4 + GRAPH_HEIGHT;
+        let start = x + 4 + (HISTORY - totals.len()) as i32 * BAR_WIDTH;
+        for (i, &ms) in totals.iter().enumerate() {
+            let bar = ((ms * PX_PER_MS).ceil() as i32).clamp(1, GRAPH_HEIGHT);
+            let color = if ms <= FRAME_BUDGET_MS / 2.0 {
+                Color::rgb(80, 200, 120)
+            } else if ms <= FRAME_BUDGET_MS {
+                Color::rgb(230, 190, 60)
+            } else {
+                Color::rgb(230, 70, 70)
+            };
+            canvas.fill_rect(start + i as i32 * BAR_WIDTH, base - bar, BAR_WIDTH - 1, bar, color);
+        }
+        let budget = (FRAME_BUDGET_MS * PX_PER_MS) as i32;
+        canvas.fill_rect(x + 4, base - budget, width - 8, 1, Color::rgba(255, 255, 255, 120));
+    }
+
+    /// Write the Chrome trace, if MOCHI_PROFILE_TRACE asked for one
+    pub fn write_trace() {
+        let Some((path, origin)) = config().and_then(|c| Some((c.trace.as_ref()?, c.origin))) else {
+            return;
+        };
+        LOCAL.with(|local| flush(&mut local.borrow_mut()));
+        let events = with_shared(|shared| std::mem::take(&mut shared.events));
+
+        let result = std::fs::File::create(path).and_then(|file| {
+            let mut out = std::io::BufWriter::new(file);
+            write!(out, "{{\"traceEvents\":[")?;
+            for (i, event) in events.iter().enumerate() {
+                let start = event.start.saturating_duration_since(origin);
+                write!(
+                    out,
+                    "{}{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3},\"dur\":{:.3}}}",
+                    if i == 0 { "" } else { "," },
+                    event.name.escape_default(),
+                    event.thread,
+                    start.as_secs_f64() * 1e6,
+                    event.duration.as_secs_f64() * 1e6
+                )?;
+            }
+            writeln!(out, "]}}")?;
+            out.flush()
+        });
+        match result {
+            Ok(()) => eprintln!("[PROFILE] Wrote {} trace events to {}", events.len(), path),
+            Err(e) => eprintln!("[PROFILE] Failed to write trace to {}: {}", path, e),
+        }
+    }
+}
+
+#[cfg(not(feature = "profiler"))]
+mod imp {
+    use super::FrameProfile;
+    use crate::core::canvas::Canvas;
+    use std::time::Duration;
+
+    #[inline(always)]
+    pub fn enabled() -> bool {
+        false
+    }
+
+    #[inline(always)]
+    pub fn overlay_enabled() -> bool {
+        false
+    }
+
+    /// Times the enclosing block until dropped; with the profiler compiled
+    /// out, nothing
+    pub struct Scope;
+
+    #[inline(always)]
+    pub fn scope(_name: &'static str) -> Scope {
+        Scope
+    }
+
+    #[inline(always)]
+    pub fn end_frame(_number: u64, _total: Duration) {}
+
+    #[inline(always)]
+    pub fn presented(_number: u64, _latency: Duration) {}
+
+    pub fn history() -> Vec<FrameProfile> {
+        Vec::new()
+    }
+
+    #[inline(always)]
+    pub fn draw_overlay(_canvas: &mut Canvas) {}
+
+    #[inline(always)]
+    pub fn write_trace() {}
+}
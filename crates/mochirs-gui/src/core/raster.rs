@@ -0,0 +1,789 @@
+// Span kernels for the software rasterizer
+//
+// Canvas primitives clip their geometry once and hand whole rows of BGRA
+// pixels to these kernels. The widest available instruction set is picked
+// at runtime the first time a kernel runs and cached for the process.
+
+use crate::core::color::Color;
+use std::sync::OnceLock;
+
+type FillFn = unsafe fn(&mut [u8], u32);
+type BlendFn = unsafe fn(&mut [u8], &[u8], Color);
+type CompositeFn = unsafe fn(&mut [u8], &[u8]);
+type LutFn = unsafe fn(&mut [u8], &[u32], i32, i32);
+
+static FILL_SPAN: OnceLock<FillFn> = OnceLock::new();
+static BLEND_SPAN: OnceLock<BlendFn> = OnceLock::new();
+static COMPOSITE_SPAN: OnceLock<CompositeFn> = OnceLock::new();
+static LUT_SPAN: OnceLock<LutFn> = OnceLock::new();
+
+/// Name of the fill kernel selected for this CPU (for debug output)
+pub fn fill_backend() -> &'static str {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            return "avx2";
+        }
+        return "sse2";
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        return "neon";
+    }
+    #[allow(unreachable_code)]
+    "scalar"
+}
+
+fn select_fill() -> FillFn {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            return fill_span_avx2;
+        }
+        return fill_span_sse2;
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        return fill_span_neon;
+    }
+    #[allow(unreachable_code)]
+    fill_span_scalar_unsafe
+}
+
+/// Fill a row of BGRA pixels with a packed pixel value.
+/// `dst.len()` must be a multiple of 4.
+#[inline]
+pub fn fill_span(dst: &mut [u8], pixel: u32) {
+    debug_assert!(dst.len() % 4 == 0);
+    let kernel = *FILL_SPAN.get_or_init(select_fill);
+    // Safety: select_fill returns the AVX2 kernel only once AVX2 has been
+    // detected, and SSE2 and NEON are part of the x86_64 and aarch64
+    // baselines. Every kernel stores through whole 16-, 32-, 64- or
+    // 128-byte chunks of `dst` and hands the rest to the scalar loop.
+    unsafe { kernel(dst, pixel) }
+}
+
+/// Portable fallback: 16-byte packed stores, then single pixels
+pub fn fill_span_scalar(dst: &mut [u8], pixel: u32) {
+    let wide = (pixel as u128) * 0x0000_0001_0000_0001_0000_0001_0000_0001u128;
+    let wide = wide.to_le_bytes();
+    let mut chunks = dst.chunks_exact_mut(16);
+    for chunk in &mut chunks {
+        chunk.copy_from_slice(&wide);
+    }
+    let px = pixel.to_le_bytes();
+    for chunk in chunks.into_remainder().chunks_exact_mut(4) {
+        chunk.copy_from_slice(&px);
+    }
+}
+
+unsafe fn fill_span_scalar_unsafe(dst: &mut [u8], pixel: u32) {
+    fill_span_scalar(dst, pixel)
+}
+
+#[cfg(target_arch = "x86_64")]
+unsafe fn fill_span_sse2(dst: &mut [u8], pixel: u32) {
+    use std::arch::x86_64::*;
+
+    let v = _mm_set1_epi32(pixel as i32);
+    let mut chunks = dst.chunks_exact_mut(64);
+    for chunk in &mut chunks {
+        let p = chunk.as_mut_ptr() as *mut __m128i;
+        _mm_storeu_si128(p, v);
+        _mm_storeu_si128(p.add(1), v);
+        _mm_storeu_si128(p.add(2), v);
+        _mm_storeu_si128(p.add(3), v);
+    }
+    fill_span_scalar(chunks.into_remainder(), pixel);
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn fill_span_avx2(dst: &mut [u8], pixel: u32) {
+    use std::arch::x86_64::*;
+
+    let v = _mm256_set1_epi32(pixel as i32);
+    let mut chunks = dst.chunks_exact_mut(128);
+    for chunk in &mut chunks {
+        let p = chunk.as_mut_ptr() as *mut __m256i;
+        _mm256_storeu_si256(p, v);
+        _mm256_storeu_si256(p.add(1), v);
+        _mm256_storeu_si256(p.add(2), v);
+        _mm256_storeu_si256(p.add(3), v);
+    }
+    let mut rest = chunks.into_remainder().chunks_exact_mut(32);
+    for chunk in &mut rest {
+        _mm256_storeu_si256(chunk.as_mut_ptr() as *mut __m256i, v);
+    }
+    fill_span_scalar(rest.into_remainder(), pixel);
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn fill_span_neon(dst: &mut [u8], pixel: u32) {
+    use std::arch::aarch64::*;
+
+    let v = vreinterpretq_u8_u32(vdupq_n_u32(pixel));
+    let mut chunks = dst.chunks_exact_mut(64);
+    for chunk in &mut chunks {
+        let p = chunk.as_mut_ptr();
+        vst1q_u8(p, v);
+        vst1q_u8(p.add(16), v);
+        vst1q_u8(p.add(32), v);
+        vst1q_u8(p.add(48), v);
+    }
+    fill_span_scalar(chunks.into_remainder(), pixel);
+}
+
+fn select_blend() -> BlendFn {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            return blend_span_avx2;
+        }
+        return blend_span_sse2;
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        return blend_span_neon;
+    }
+    #[allow(unreachable_code)]
+    blend_span_scalar_unsafe
+}
+
+/// Exact x / 255 for x in 0..=65025, rounded to nearest
+#[inline(always)]
+pub fn div255(x: u32) -> u32 {
+    let t = x + 128;
+    (t + (t >> 8)) >> 8
+}
+
+/// Composite `color` over a row of premultiplied BGRA pixels.
+///
+/// Each pixel's source alpha is `coverage[i] * color.a / 255`; the result is
+/// `src * a + dst * (255 - a)` divided by 255 with exact rounding, so the
+/// alpha channel stays premultiplied. `dst.len()` must be `coverage.len() * 4`.
+#[inline]
+pub fn blend_span(dst: &mut [u8], coverage: &[u8], color: Color) {
+    debug_assert!(dst.len() == coverage.len() * 4);
+    if color.a == 0 {
+        return;
+    }
+    let kernel = *BLEND_SPAN.get_or_init(select_blend);
+    // Safety: AVX2 is used only once detected, and SSE2 and NEON are
+    // baseline. The kernels zip whole chunks of `dst` with the matching
+    // chunks of `coverage`, so a length mismatch only leaves pixels
+    // unblended and never reads past either slice.
+    unsafe { kernel(dst, coverage, color) }
+}
+
+#[inline(always)]
+fn blend_one(px: &mut [u8], coverage: u8, color: Color) {
+    let a = div255(coverage as u32 * color.a as u32);
+    if a == 0 {
+        return;
+    }
+    if a == 255 {
+        px.copy_from_slice(&[color.b, color.g, color.r, 255]);
+        return;
+    }
+    let inv = 255 - a;
+    px[0] = div255(color.b as u32 * a + px[0] as u32 * inv) as u8;
+    px[1] = div255(color.g as u32 * a + px[1] as u32 * inv) as u8;
+    px[2] = div255(color.r as u32 * a + px[2] as u32 * inv) as u8;
+    px[3] = div255(255 * a + px[3] as u32 * inv) as u8;
+}
+
+/// Portable fallback, one pixel at a time
+pub fn blend_span_scalar(dst: &mut [u8], coverage: &[u8], color: Color) {
+    for (px, &c) in dst.chunks_exact_mut(4).zip(coverage) {
+        if c != 0 {
+            blend_one(px, c, color);
+        }
+    }
+}
+
+unsafe fn blend_span_scalar_unsafe(dst: &mut [u8], coverage: &[u8], color: Color) {
+    blend_span_scalar(dst, coverage, color)
+}
+
+// Four pixels per iteration: pixels are widened to 16 bits two at a time and
+// the lerp numerator (at most 255 * 255) fits a u16 lane, so one exact
+// div255 per channel suffices.
+#[cfg(target_arch = "x86_64")]
+unsafe fn blend_span_sse2(dst: &mut [u8], coverage: &[u8], color: Color) {
+    use std::arch::x86_64::*;
+
+    #[inline(always)]
+    unsafe fn div255_epu16(x: __m128i) -> __m128i {
+        let t = _mm_add_epi16(x, _mm_set1_epi16(128));
+        _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8)
+    }
+
+    let zero = _mm_setzero_si128();
+    let full = _mm_set1_epi16(255);
+    let src_alpha = _mm_set1_epi16(color.a as i16);
+    let src = _mm_set_epi16(
+        255, color.r as i16, color.g as i16, color.b as i16,
+        255, color.r as i16, color.g as i16, color.b as i16,
+    );
+
+    let mut px_chunks = dst.chunks_exact_mut(16);
+    let mut cov_chunks = coverage.chunks_exact(4);
+    for (px, cov) in (&mut px_chunks).zip(&mut cov_chunks) {
+        let c = u32::from_le_bytes([cov[0], cov[1], cov[2], cov[3]]);
+        if c == 0 {
+            continue;
+        }
+
+        // [a0 a1 a2 a3] as u16, then broadcast each across its pixel's channels
+        let a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(c as i32), zero);
+        let a = div255_epu16(_mm_mullo_epi16(a, src_alpha));
+        let a = _mm_unpacklo_epi16(a, a);
+        let a_lo = _mm_unpacklo_epi32(a, a);
+        let a_hi = _mm_unpackhi_epi32(a, a);
+
+        let d = _mm_loadu_si128(px.as_ptr() as *const __m128i);
+        let d_lo = _mm_unpacklo_epi8(d, zero);
+        let d_hi = _mm_unpackhi_epi8(d, zero);
+
+        let lo = _mm_add_epi16(
+            _mm_mullo_epi16(src, a_lo),
+            _mm_mullo_epi16(d_lo, _mm_sub_epi16(full, a_lo)),
+        );
+        let hi = _mm_add_epi16(
+            _mm_mullo_epi16(src, a_hi),
+            _mm_mullo_epi16(d_hi, _mm_sub_epi16(full, a_hi)),
+        );
+
+        let out = _mm_packus_epi16(div255_epu16(lo), div255_epu16(hi));
+        _mm_storeu_si128(px.as_mut_ptr() as *mut __m128i, out);
+    }
+    blend_span_scalar(px_chunks.into_remainder(), cov_chunks.remainder(), color);
+}
+
+// Eight pixels per iteration, four per 256-bit register
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn blend_span_avx2(dst: &mut [u8], coverage: &[u8], color: Color) {
+    use std::arch::x86_64::*;
+
+    #[inline(always)]
+    unsafe fn div255_epu16(x: __m256i) -> __m256i {
+        let t = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+        _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8)
+    }
+
+    let full = _mm256_set1_epi16(255);
+    let src_alpha = _mm256_set1_epi16(color.a as i16);
+    let src = _mm256_set_epi16(
+        255, color.r as i16, color.g as i16, color.b as i16,
+        255, color.r as i16, color.g as i16, color.b as i16,
+        255, color.r as i16, color.g as i16, color.b as i16,
+        255, color.r as i16, color.g as i16, color.b as i16,
+    );
+    // Repeats coverage byte i across the four channels of pixel i
+    let spread_lo = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    let spread_hi = _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+
+    let mut px_chunks = dst.chunks_exact_mut(32);
+    let mut cov_chunks = coverage.chunks_exact(8);
+    for (px, cov) in (&mut px_chunks).zip(&mut cov_chunks) {
+        let c = u64::from_le_bytes([cov[0], cov[1], cov[2], cov[3], cov[4], cov[5], cov[6], cov[7]]);
+        if c == 0 {
+            continue;
+        }
+
+        let c = _mm_cvtsi64_si128(c as i64);
+        let a_lo = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(c, spread_lo));
+        let a_hi = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(c, spread_hi));
+        let a_lo = div255_epu16(_mm256_mullo_epi16(a_lo, src_alpha));
+        let a_hi = div255_epu16(_mm256_mullo_epi16(a_hi, src_alpha));
+
+        let d_lo = _mm256_cvtepu8_epi16(_mm_loadu_si128(px.as_ptr() as *const __m128i));
+        let d_hi = _mm256_cvtepu8_epi16(_mm_loadu_si128(px.as_ptr().add(16) as *const __m128i));
+
+        let lo = _mm256_add_epi16(
+            _mm256_mullo_epi16(src, a_lo),
+            _mm256_mullo_epi16(d_lo, _mm256_sub_epi16(full, a_lo)),
+        );
+        let hi = _mm256_add_epi16(
+            _mm256_mullo_epi16(src, a_hi),
+            _mm256_mullo_epi16(d_hi, _mm256_sub_epi16(full, a_hi)),
+        );
+
+        // packus works per 128-bit lane; restore pixel order afterwards
+        let out = _mm256_packus_epi16(div255_epu16(lo), div255_epu16(hi));
+        let out = _mm256_permute4x64_epi64(out, 0b11_01_10_00);
+        _mm256_storeu_si256(px.as_mut_ptr() as *mut __m256i, out);
+    }
+    blend_span_scalar(px_chunks.into_remainder(), cov_chunks.remainder(), color);
+}
+
+// Eight pixels per iteration using de-interleaving loads
+#[cfg(target_arch = "aarch64")]
+unsafe fn blend_span_neon(dst: &mut [u8], coverage: &[u8], color: Color) {
+    use std::arch::aarch64::*;
+
+    #[inline(always)]
+    unsafe fn div255_u16(x: uint16x8_t) -> uint8x8_t {
+        vraddhn_u16(x, vrshrq_n_u16(x, 8))
+    }
+
+    let src_alpha = vdup_n_u8(color.a);
+    let src_b = vdup_n_u8(color.b);
+    let src_g = vdup_n_u8(color.g);
+    let src_r = vdup_n_u8(color.r);
+    let full = vdup_n_u8(255);
+
+    let mut px_chunks = dst.chunks_exact_mut(32);
+    let mut cov_chunks = coverage.chunks_exact(8);
+    for (px, cov) in (&mut px_chunks).zip(&mut cov_chunks) {
+        let c = vld1_u8(cov.as_ptr());
+        if vget_lane_u64(vreinterpret_u64_u8(c), 0) == 0 {
+            continue;
+        }
+
+        let a = div255_u16(vmull_u8(c, src_alpha));
+        let inv = vmvn_u8(a);
+        let mut d = vld4_u8(px.as_ptr());
+        d.0 = div255_u16(vmlal_u8(vmull_u8(src_b, a), d.0, inv));
+        d.1 = div255_u16(vmlal_u8(vmull_u8(src_g, a), d.1, inv));
+        d.2 = div255_u16(vmlal_u8(vmull_u8(src_r, a), d.2, inv));
+        d.3 = div255_u16(vmlal_u8(vmull_u8(full, a), d.3, inv));
+        vst4_u8(px.as_mut_ptr(), d);
+    }
+    blend_span_scalar(px_chunks.into_remainder(), cov_chunks.remainder(), color);
+}
+
+fn select_composite() -> CompositeFn {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            return composite_span_avx2;
+        }
+        return composite_span_sse2;
+    }
+    #[cfg(target_arch = "aarch64")]
+    {
+        return composite_span_neon;
+    }
+    #[allow(unreachable_code)]
+    composite_span_scalar_unsafe
+}
+
+/// Composite a row of premultiplied BGRA pixels over another:
+/// `dst = src + dst * (255 - src.a) / 255`. Used to blit offscreen layers.
+/// `dst` and `src` must have the same length.
+#[inline]
+pub fn composite_span(dst: &mut [u8], src: &[u8]) {
+    debug_assert!(dst.len() == src.len() && dst.len() % 4 == 0);
+    let kernel = *COMPOSITE_SPAN.get_or_init(select_composite);
+    // Safety: AVX2 is used only once detected, and SSE2 and NEON are
+    // baseline. Loads and stores go through whole chunks zipped from both
+    // slices, so neither is accessed past its end.
+    unsafe { kernel(dst, src) }
+}
+
+/// Portable fallback, one pixel at a time
+pub fn composite_span_scalar(dst: &mut [u8], src: &[u8]) {
+    for (d, s) in dst.chunks_exact_mut(4).zip(src.chunks_exact(4)) {
+        let inv = 255 - s[3] as u32;
+        if inv == 255 {
+            continue;
+        }
+        if inv == 0 {
+            d.copy_from_slice(s);
+            continue;
+        }
+        for i in 0..4 {
+            d[i] = (s[i] as u32 + div255(d[i] as u32 * inv)).min(255) as u8;
+        }
+    }
+}
+
+unsafe fn composite_span_scalar_unsafe(dst: &mut [u8], src: &[u8]) {
+    composite_span_scalar(dst, src)
+}
+
+// Four pixels per iteration. Fully transparent groups are skipped and fully
+// opaque groups are copied, which covers most of a typical layer.
+#[cfg(target_arch = "x86_64")]
+unsafe fn composite_span_sse2(dst: &mut [u8], src: &[u8]) {
+    use std::arch::x86_64::*;
+
+    #[inline(always)]
+    unsafe fn div255_epu16(x: __m128i) -> __m128i {
+        let t = _mm_add_epi16(x, _mm_set1_epi16(128));
+        _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8)
+    }
+
+    let zero = _mm_setzero_si128();
+    let full = _mm_set1_epi16(255);
+    let alpha_mask = _mm_set1_epi32(0xff00_0000u32 as i32);
+
+    let mut dst_chunks = dst.chunks_exact_mut(16);
+    let mut src_chunks = src.chunks_exact(16);
+    for (d, s) in (&mut dst_chunks).zip(&mut src_chunks) {
+        let sv = _mm_loadu_si128(s.as_ptr() as *const __m128i);
+        let alpha = _mm_and_si128(sv, alpha_mask);
+        if _mm_movemask_epi8(_mm_cmpeq_epi8(alpha, zero)) == 0xffff {
+            continue;
+        }
+        if _mm_movemask_epi8(_mm_cmpeq_epi8(alpha, alpha_mask)) == 0xffff {
+            _mm_storeu_si128(d.as_mut_ptr() as *mut __m128i, sv);
+            continue;
+        }
+
+        let s_lo = _mm_unpacklo_epi8(sv, zero);
+        let s_hi = _mm_unpackhi_epi8(sv, zero);
+        // Broadcast each pixel's alpha (lane 3 of every four) to its channels
+        let inv_lo = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, 0xff), 0xff));
+        let inv_hi = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, 0xff), 0xff));
+
+        let dv = _mm_loadu_si128(d.as_ptr() as *const __m128i);
+        let d_lo = div255_epu16(_mm_mullo_epi16(_mm_unpacklo_epi8(dv, zero), inv_lo));
+        let d_hi = div255_epu16(_mm_mullo_epi16(_mm_unpackhi_epi8(dv, zero), inv_hi));
+
+        let out = _mm_packus_epi16(_mm_add_epi16(s_lo, d_lo), _mm_add_epi16(s_hi, d_hi));
+        _mm_storeu_si128(d.as_mut_ptr() as *mut __m128i, out);
+    }
+    composite_span_scalar(dst_chunks.into_remainder(), src_chunks.remainder());
+}
+
+// Eight pixels per iteration, four per 256-bit register
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn composite_span_avx2(dst: &mut [u8], src: &[u8]) {
+    use std::arch::x86_64::*;
+
+    #[inline(always)]
+    unsafe fn div255_epu16(x: __m256i) -> __m256i {
+        let t = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+        _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8)
+    }
+
+    let zero = _mm256_setzero_si256();
+    let full = _mm256_set1_epi16(255);
+    let alpha_mask = _mm256_set1_epi32(0xff00_0000u32 as i32);
+
+    let mut dst_chunks = dst.chunks_exact_mut(32);
+    let mut src_chunks = src.chunks_exact(32);
+    for (d, s) in (&mut dst_chunks).zip(&mut src_chunks) {
+        let sv = _mm256_loadu_si256(s.as_ptr() as *const __m256i);
+        let alpha = _mm256_and_si256(sv, alpha_mask);
+        if _mm256_movemask_epi8(_mm256_cmpeq_epi8(alpha, zero)) == -1 {
+            continue;
+        }
+        if _mm256_movemask_epi8(_mm256_cmpeq_epi8(alpha, alpha_mask)) == -1 {
+            _mm256_storeu_si256(d.as_mut_ptr() as *mut __m256i, sv);
+            continue;
+        }
+
+        let s_lo = _mm256_cvtepu8_epi16(_mm_loadu_si128(s.as_ptr() as *const __m128i));
+        let s_hi = _mm256_cvtepu8_epi16(_mm_loadu_si128(s.as_ptr().add(16) as *const __m128i));
+        let inv_lo = _mm256_sub_epi16(
+            full,
+            _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_lo, 0xff), 0xff),
+        );
+        let inv_hi = _mm256_sub_epi16(
+            full,
+            _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_hi, 0xff), 0xff),
+        );
+
+        let d_lo = _mm256_cvtepu8_epi16(_mm_loadu_si128(d.as_ptr() as *const __m128i));
+        let d_hi = _mm256_cvtepu8_epi16(_mm_loadu_si128(d.as_ptr().add(16) as *const __m128i));
+        let d_lo = div255_epu16(_mm256_mullo_epi16(d_lo, inv_lo));
+        let d_hi = div255_epu16(_mm256_mullo_epi16(d_hi, inv_hi));
+
+        // packus works per 128-bit lane; restore pixel order afterwards
+        let out = _mm256_packus_epi16(_mm256_add_epi16(s_lo, d_lo), _mm256_add_epi16(s_hi, d_hi));
+        let out = _mm256_permute4x64_epi64(out, 0b11_01_10_00);
+        _mm256_storeu_si256(d.as_mut_ptr() as *mut __m256i, out);
+    }
+    composite_span_scalar(dst_chunks.into_remainder(), src_chunks.remainder());
+}
+
+// Eight pixels per iteration using de-interleaving loads
+#[cfg(target_arch = "aarch64")]
+unsafe fn composite_span_neon(dst: &mut [u8], src: &[u8]) {
+    use std::arch::aarch64::*;
+
+    #[inline(always)]
+    unsafe fn div255_u16(x: uint16x8_t) -> uint8x8_t {
+        vraddhn_u16(x, vrshrq_n_u16(x, 8))
+    }
+
+    let mut dst_chunks = dst.chunks_exact_mut(32);
+    let mut src_chunks = src.chunks_exact(32);
+    for (d, s) in (&mut dst_chunks).zip(&mut src_chunks) {
+        let sv = vld4_u8(s.as_ptr());
+        let alpha = vget_lane_u64(vreinterpret_u64_u8(sv.3), 0);
+        if alpha == 0 {
+            continue;
+        }
+        if alpha == u64::MAX {
+            vst4_u8(d.as_mut_ptr(), sv);
+            continue;
+        }
+
+        let inv = vmvn_u8(sv.3);
+        let mut dv = vld4_u8(d.as_ptr());
+        dv.0 = vqadd_u8(sv.0, div255_u16(vmull_u8(dv.0, inv)));
+        dv.1 = vqadd_u8(sv.1, div255_u16(vmull_u8(dv.1, inv)));
+        dv.2 = vqadd_u8(sv.2, div255_u16(vmull_u8(dv.2, inv)));
+        dv.3 = vqadd_u8(sv.3, div255_u16(vmull_u8(dv.3, inv)));
+        vst4_u8(d.as_mut_ptr(), dv);
+    }
+    composite_span_scalar(dst_chunks.into_remainder(), src_chunks.remainder());
+}
+
+fn select_lut() -> LutFn {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            return lut_span_avx2;
+        }
+    }
+    lut_span_scalar_unsafe
+}
+
+/// Fill a row of BGRA pixels from a lookup table. `t` is a 16.16 fixed
+/// point table index that advances by `step` per pixel; indices past
+/// either end of the table are clamped to it. Used for gradients.
+#[inline]
+pub fn lut_span(dst: &mut [u8], lut: &[u32], t: i32, step: i32) {
+    debug_assert!(dst.len() % 4 == 0);
+    // The AVX2 gather reads lut[index] with no bounds check, and an empty
+    // table would clamp indices to -1
+    assert!(!lut.is_empty(), "lut_span needs a non-empty table");
+    let kernel = *LUT_SPAN.get_or_init(select_lut);
+    // Safety: the AVX2 kernel is selected only once AVX2 has been detected.
+    // Its gathers use indices clamped to 0..lut.len() (non-empty, checked
+    // above), and its stores go through whole 32-byte chunks of `dst`.
+    unsafe { kernel(dst, lut, t, step) }
+}
+
+/// Portable fallback, one pixel at a time
+pub fn lut_span_scalar(dst: &mut [u8], lut: &[u32], t: i32, step: i32) {
+    let max = lut.len() as i32 - 1;
+    let mut t = t;
+    for pixel in dst.chunks_exact_mut(4) {
+        let index = (t >> 16).clamp(0, max);
+        pixel.copy_from_slice(&lut[index as usize].to_le_bytes());
+        t = t.wrapping_add(step);
+    }
+}
+
+unsafe fn lut_span_scalar_unsafe(dst: &mut [u8], lut: &[u32], t: i32, step: i32) {
+    lut_span_scalar(dst, lut, t, step)
+}
+
+// Eight indices per iteration, clamped in registers and gathered in one
+// instruction
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn lut_span_avx2(dst: &mut [u8], lut: &[u32], t: i32, step: i32) {
+    use std::arch::x86_64::*;
+
+    let zero = _mm256_setzero_si256();
+    let max = _mm256_set1_epi32(lut.len() as i32 - 1);
+    let lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    let mut tv = _mm256_add_epi32(_mm256_set1_epi32(t), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(step)));
+    let step8 = _mm256_set1_epi32(step.wrapping_mul(8));
+
+    let mut chunks = dst.chunks_exact_mut(32);
+    let mut done = 0i32;
+    for chunk in &mut chunks {
+        let index = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(tv, 16), zero), max);
+        let pixels = _mm256_i32gather_epi32(lut.as_ptr() as *const i32, index, 4);
+        _mm256_storeu_si256(chunk.as_mut_ptr() as *mut __m256i, pixels);
+        tv = _mm256_add_epi32(tv, step8);
+        done += 8;
+    }
+    lut_span_scalar(chunks.into_remainder(), lut, t.wrapping_add(step.wrapping_mul(done)), step);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // Lengths in pixels: every tail length around the vector widths, plus a
+    // few long spans
+    const LENGTHS: &[usize] = &[0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 257, 1023];
+
+    // xorshift64, so runs are reproducible without a rand dependency
+    struct Rng(u64);
+
+    impl Rng {
+        fn next(&mut self) -> u64 {
+            self.0 ^= self.0 << 13;
+            self.0 ^= self.0 >> 7;
+            self.0 ^= self.0 << 17;
+            self.0
+        }
+
+        fn byte(&mut self) -> u8 {
+            self.next() as u8
+        }
+
+        // Biased towards 0 and 255, which take the kernels' shortcuts
+        fn alpha(&mut self) -> u8 {
+            match self.next() % 4 {
+                0 => 0,
+                1 => 255,
+                _ => self.byte(),
+            }
+        }
+
+        fn bytes(&mut self, len: usize) -> Vec<u8> {
+            (0..len).map(|_| self.byte()).collect()
+        }
+
+        // Premultiplied BGRA pixels
+        fn pixels(&mut self, len: usize) -> Vec<u8> {
+            let mut pixels = Vec::with_capacity(len * 4);
+            for _ in 0..len {
+                let a = self.alpha();
+                for _ in 0..3 {
+                    pixels.push((self.next() % (a as u64 + 1)) as u8);
+                }
+                pixels.push(a);
+            }
+            pixels
+        }
+    }
+
+    fn fill_kernels() -> Vec<(&'static str, FillFn)> {
+        let mut kernels: Vec<(&'static str, FillFn)> = vec![("dispatch", |d, p| fill_span(d, p))];
+        #[cfg(target_arch = "x86_64")]
+        {
+            kernels.push(("sse2", fill_span_sse2));
+            if is_x86_feature_detected!("avx2") {
+                kernels.push(("avx2", fill_span_avx2));
+            }
+        }
+        #[cfg(target_arch = "aarch64")]
+        kernels.push(("neon", fill_span_neon));
+        kernels
+    }
+
+    fn blend_kernels() -> Vec<(&'static str, BlendFn)> {
+        let mut kernels: Vec<(&'static str, BlendFn)> = vec![("dispatch", |d, c, color| blend_span(d, c, color))];
+        #[cfg(target_arch = "x86_64")]
+        {
+            kernels.push(("sse2", blend_span_sse2));
+            if is_x86_feature_detected!("avx2") {
+                kernels.push(("avx2", blend_span_avx2));
+            }
+        }
+        #[cfg(target_arch = "aarch64")]
+        kernels.push(("neon", blend_span_neon));
+        kernels
+    }
+
+    fn composite_kernels() -> Vec<(&'static str, CompositeFn)> {
+        let mut kernels: Vec<(&'static str, CompositeFn)> = vec![("dispatch", |d, s| composite_span(d, s))];
+        #[cfg(target_arch = "x86_64")]
+        {
+            kernels.push(("sse2", composite_span_sse2));
+            if is_x86_feature_detected!("avx2") {
+                kernels.push(("avx2", composite_span_avx2));
+            }
+        }
+        #[cfg(target_arch = "aarch64")]
+        kernels.push(("neon", composite_span_neon));
+        kernels
+    }
+
+    fn lut_kernels() -> Vec<(&'static str, LutFn)> {
+        let mut kernels: Vec<(&'static str, LutFn)> = vec![("dispatch", |d, l, t, s| lut_span(d, l, t, s))];
+        #[cfg(target_arch = "x86_64")]
+        {
+            if is_x86_feature_detected!("avx2") {
+                kernels.push(("avx2", lut_span_avx2));
+            }
+        }
+        kernels
+    }
+
+    #[test]
+    fn fill_matches_scalar() {
+        let mut rng = Rng(0x9e37_79b9_7f4a_7c15);
+        for (name, kernel) in fill_kernels() {
+            for &len in LENGTHS {
+                // Also start part way into the buffer, off any alignment
+                for offset in 0..3 {
+                    let pixel = rng.next() as u32;
+                    let before = rng.bytes((offset + len + 2) * 4);
+                    let span = offset * 4..(offset + len) * 4;
+                    let mut expected = before.clone();
+                    fill_span_scalar(&mut expected[span.clone()], pixel);
+                    let mut actual = before;
+                    unsafe { kernel(&mut actual[span], pixel) };
+                    assert_eq!(actual, expected, "{} fill, {} pixels at {}", name, len, offset);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn blend_matches_scalar() {
+        let mut rng = Rng(0x2545_f491_4f6c_dd1d);
+        for (name, kernel) in blend_kernels() {
+            for &len in LENGTHS {
+                for round in 0..16 {
+                    // Kernels are only called with visible colors
+                    let a = if round == 0 { 255 } else { rng.byte().max(1) };
+                    let color = Color::rgba(rng.byte(), rng.byte(), rng.byte(), a);
+                    let coverage: Vec<u8> = (0..len).map(|_| rng.alpha()).collect();
+                    let before = rng.pixels(len);
+                    let mut expected = before.clone();
+                    blend_span_scalar(&mut expected, &coverage, color);
+                    let mut actual = before;
+                    unsafe { kernel(&mut actual, &coverage, color) };
+                    assert_eq!(actual, expected, "{} blend, {} pixels, {:?}", name, len, color);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn composite_matches_scalar() {
+        let mut rng = Rng(0x1405_7b7e_f767_814f);
+        for (name, kernel) in composite_kernels() {
+            for &len in LENGTHS {
+                for _ in 0..16 {
+                    let src = rng.pixels(len);
+                    let before = rng.pixels(len);
+                    let mut expected = before.clone();
+                    composite_span_scalar(&mut expected, &src);
+                    let mut actual = before;
+                    unsafe { kernel(&mut actual, &src) };
+                    assert_eq!(actual, expected, "{} composite, {} pixels", name, len);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn lut_matches_scalar() {
+        let mut rng = Rng(0xd1b5_4a32_d192_ed03);
+        for (name, kernel) in lut_kernels() {
+            for &len in LENGTHS {
+                for _ in 0..16 {
+                    let lut: Vec<u32> = (0..1 + rng.next() % 1024).map(|_| rng.next() as u32).collect();
+                    // Start and step run past both ends of the table
+                    let range = lut.len() as i64 * 65536 * 2;
+                    let t = (rng.next() as i64 % range) as i32;
+                    let step = (rng.next() as i64 % 0x40000) as i32;
+                    let before = rng.bytes(len * 4);
+                    let mut expected = before.clone();
+                    lut_span_scalar(&mut expected, &lut, t, step);
+                    let mut actual = before;
+                    unsafe { kernel(&mut actual, &lut, t, step) };
+                    assert_eq!(actual, expected, "{} lut, {} pixels, t {} step {}", name, len, t, step);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,239 @@
+// Retained element tree
+//
+// The tree is built once and updated in place between frames. Each render
+// diffs every node's paint hash and bounds against the previous frame and
+// reports only what changed as damage, so the canvas repaints just those
+// areas on top of the retained frame.
+
+use crate::core::canvas::Canvas;
+use crate::core::damage::{DamageRegion, MAX_RECTS};
+use crate::core::text::TextRenderer;
+use crate::core::ui::{hash_with, Element, Rect};
+use std::any::Any;
+use std::collections::HashMap;
+use std::hash::Hash;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct NodeRecord {
+    // None when the element can't describe its paint state
+    hash: Option<u64>,
+    bounds: Rect,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct TreeStats {
+    pub nodes: usize,
+    pub dirty_nodes: usize,
+    pub damaged_area: i64,
+    pub opaque_area: i64,
+}
+
+// Opaque parts of the frame, built in painter's order. Only the largest
+// MAX_RECTS rects are kept, which is plenty for a compositor hint.
+#[derive(Clone, Copy)]
+struct OpaqueRects {
+    rects: [Rect; MAX_RECTS],
+    len: usize,
+}
+
+impl OpaqueRects {
+    fn new() -> Self {
+        Self {
+            rects: [Rect::new(0, 0, 0, 0); MAX_RECTS],
+            len: 0,
+        }
+    }
+
+    fn add(&mut self, rect: Rect) {
+        if rect.is_empty() || self.rects[..self.len].iter().any(|r| r.contains(&rect)) {
+            return;
+        }
+        if self.len < MAX_RECTS {
+            self.rects[self.len] = rect;
+            self.len += 1;
+        } else if let Some(smallest) = self.rects.iter_mut().min_by_key(|r| r.area()) {
+            if smallest.area() < rect.area() {
+                *smallest = rect;
+            }
+        }
+    }
+
+    // Remove `hole` from every rect
+    fn punch(&mut self, hole: &Rect) {
+        let old = *self;
+        self.len = 0;
+        for rect in &old.rects[..old.len] {
+            for piece in rect.subtract(hole) {
+                self.add(piece);
+            }
+        }
+    }
+
+    fn as_slice(&self) -> &[Rect] {
+        &self.rects[..self.len]
+    }
+}
+
+pub struct RetainedTree {
+    root: Option<Box<dyn Element>>,
+    // Keyed by node path: the hash of the parent's path and the node's key,
+    // or its sibling index when it has none
+    records: HashMap<u64, NodeRecord>,
+    next: HashMap<u64, NodeRecord>,
+    damage: DamageRegion,
+    stats: TreeStats,
+}
+
+impl RetainedTree {
+    pub fn new() -> Self {
+        Self {
+            root: None,
+            records: HashMap::new(),
+            next: HashMap::new(),
+            damage: DamageRegion::new(),
+            stats: TreeStats::default(),
+        }
+    }
+
+    /// Replace the whole tree. Nodes are still matched against the previous
+    /// tree by path, so only what actually differs is repainted.
+    pub fn set_root(&mut self, root: impl Element + 'static) {
+        self.root = Some(Box::new(root));
+    }
+
+    /// Build the tree on first use, then keep it
+    pub fn root_or_insert_with<E: Element + 'static>(
+        &mut self,
+        build: impl FnOnce() -> E,
+    ) -> &mut Box<dyn Element> {
+        self.root.get_or_insert_with(|| Box::new(build()))
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.root.is_none()
+    }
+
+    /// Find an element added with `.keyed(key)` to update it in place
+    pub fn find_mut<T: 'static>(&mut self, key: &str) -> Option<&mut T> {
+        let key = hash_with(|h| key.hash(h));
+        find_in(self.root.as_deref_mut()?, key)
+    }
+
+    pub fn stats(&self) -> TreeStats {
+        self.stats
+    }
+
+    /// Report what changed since the last frame to the canvas, then paint
+    pub fn render(&mut self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        self.stats = TreeStats::default();
+        self.damage.clear();
+        self.next.clear();
+        let mut opaque = OpaqueRects::new();
+
+        if let Some(root) = self.root.as_deref() {
+            diff(
+                root,
+                0,
+                text_renderer,
+                &self.records,
+                &mut self.next,
+                &mut self.damage,
+                &mut self.stats,
+                &mut opaque,
+            );
+        }
+
+        // Whatever was drawn last frame but is gone now
+        for (path, old) in &self.records {
+            if !self.next.contains_key(path) {
+                self.damage.add(old.bounds);
+            }
+        }
+        std::mem::swap(&mut self.records, &mut self.next);
+
+        for rect in self.damage.rects() {
+            canvas.add_damage(*rect);
+        }
+        canvas.set_opaque_region(opaque.as_slice());
+        self.stats.damaged_area = self.damage.area();
+        self.stats.opaque_area = opaque.as_slice().iter().map(|r| r.area()).sum();
+        debug_log!(
+            "{} nodes, {} dirty, {} px damaged, {} px opaque",
+            self.stats.nodes,
+            self.stats.dirty_nodes,
+            self.stats.damaged_area,
+            self.stats.opaque_area
+        );
+
+        if let Some(root) = self.root.as_deref() {
+            root.render(canvas, text_renderer);
+        }
+    }
+}
+
+fn diff(
+    node: &dyn Element,
+    path: u64,
+    text_renderer: &TextRenderer,
+    previous: &HashMap<u64, NodeRecord>,
+    next: &mut HashMap<u64, NodeRecord>,
+    damage: &mut DamageRegion,
+    stats: &mut TreeStats,
+    opaque: &mut OpaqueRects,
+) {
+    let record = NodeRecord {
+        hash: node.paint_hash(),
+        bounds: node.paint_bounds(text_renderer),
+    };
+    stats.nodes += 1;
+
+    match previous.get(&path) {
+        Some(old) if record.hash.is_some() && *old == record => {}
+        Some(old) => {
+            stats.dirty_nodes += 1;
+            damage.add(old.bounds);
+            damage.add(record.bounds);
+        }
+        None => {
+            stats.dirty_nodes += 1;
+            damage.add(record.bounds);
+        }
+    }
+    next.insert(path, record);
+
+    if let Some(hole) = node.translucent_rect() {
+        opaque.punch(&hole);
+    }
+    if let Some(rect) = node.opaque_rect() {
+        opaque.add(rect);
+    }
+
+    for (index, child) in node.children().iter().enumerate() {
+        let child_path = match child.key() {
+            Some(key) => hash_with(|h| (path, 1u8, key).hash(h)),
+            None => hash_with(|h| (path, 0u8, index).hash(h)),
+        };
+        diff(
+            child.as_ref(),
+            child_path,
+            text_renderer,
+            previous,
+            next,
+            damage,
+            stats,
+            opaque,
+        );
+    }
+}
+
+fn find_in<T: 'static>(node: &mut dyn Element, key: u64) -> Option<&mut T> {
+    if node.key() == Some(key) {
+        return node.as_any_mut().and_then(|any: &mut dyn Any| any.downcast_mut::<T>());
+    }
+    for child in node.children_mut() {
+        if let Some(found) = find_in(child.as_mut(), key) {
+            return Some(found);
+        }
+    }
+    None
+}
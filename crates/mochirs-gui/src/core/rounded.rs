@@ -0,0 +1,296 @@
+// Analytic rounded-rect rasterization
+//
+// A rounded rect is described by its signed distance field. For each row
+// the left and right extents are solved analytically from the corner
+// circles, which splits the row into a fully covered interior span, filled
+// without any per-pixel work, and a few edge pixels whose coverage comes
+// from the distance field. A corner costs a couple of square roots per row
+// instead of one per pixel of its radius x radius box.
+
+use crate::core::color::Color;
+use crate::core::ui::Rect;
+
+/// Radius of each corner, clockwise from the top left
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct CornerRadii {
+    pub top_left: f32,
+    pub top_right: f32,
+    pub bottom_right: f32,
+    pub bottom_left: f32,
+}
+
+impl CornerRadii {
+    pub const fn new(top_left: f32, top_right: f32, bottom_right: f32, bottom_left: f32) -> Self {
+        Self {
+            top_left,
+            top_right,
+            bottom_right,
+            bottom_left,
+        }
+    }
+
+    pub const fn all(radius: f32) -> Self {
+        Self::new(radius, radius, radius, radius)
+    }
+
+    pub fn max(&self) -> f32 {
+        self.top_left
+            .max(self.top_right)
+            .max(self.bottom_right)
+            .max(self.bottom_left)
+    }
+
+    pub fn to_bits(&self) -> [u32; 4] {
+        [
+            self.top_left.to_bits(),
+            self.top_right.to_bits(),
+            self.bottom_right.to_bits(),
+            self.bottom_left.to_bits(),
+        ]
+    }
+
+    fn map(self, f: impl Fn(f32) -> f32) -> Self {
+        Self::new(
+            f(self.top_left),
+            f(self.top_right),
+            f(self.bottom_right),
+            f(self.bottom_left),
+        )
+    }
+}
+
+impl From<f32> for CornerRadii {
+    fn from(radius: f32) -> Self {
+        Self::all(radius)
+    }
+}
+
+/// A stroke drawn inside the edge of a rounded rect
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Border {
+    pub width: f32,
+    pub color: Color,
+}
+
+impl Border {
+    pub fn new(width: f32, color: Color) -> Self {
+        Self { width, color }
+    }
+}
+
+/// Columns one row of a shape touches. `[start, full_start)` and
+/// `[full_end, end)` are edge pixels that need their coverage computed;
+/// `[full_start, full_end)` is covered completely.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct RowSpans {
+    pub start: i32,
+    pub full_start: i32,
+    pub full_end: i32,
+    pub end: i32,
+}
+
+/// A rounded rect with float edges (insetting by a border can make them
+/// fractional) and radii limited to half the shorter side
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct RoundedShape {
+    left: f32,
+    top: f32,
+    right: f32,
+    bottom: f32,
+    radii: CornerRadii,
+}
+
+impl RoundedShape {
+    pub fn new(rect: Rect, radii: CornerRadii) -> Self {
+        Self::from_edges(
+            rect.x as f32,
+            rect.y as f32,
+            rect.right() as f32,
+            rect.bottom() as f32,
+            radii,
+        )
+    }
+
+    fn from_edges(left: f32, top: f32, right: f32, bottom: f32, radii: CornerRadii) -> Self {
+        let limit = ((right - left).min(bottom - top) * 0.5).max(0.0);
+        Self {
+            left,
+            top,
+            right,
+            bottom,
+            radii: radii.map(|r| r.clamp(0.0, limit)),
+        }
+    }
+
+    /// The shape shrunk by `amount` on every side, with radii shrunk to
+    /// match. None once nothing is left.
+    pub fn inset(&self, amount: f32) -> Option<Self> {
+        let (left, top) = (self.left + amount, self.top + amount);
+        let (right, bottom) = (self.right - amount, self.bottom - amount);
+        if right <= left || bottom <= top {
+            return None;
+        }
+        let radii = self.radii.map(|r| (r - amount).max(0.0));
+        Some(Self::from_edges(left, top, right, bottom, radii))
+    }
+
+    /// Pixel rows the shape touches, end exclusive
+    pub fn rows(&self) -> (i32, i32) {
+        (self.top.floor() as i32, self.bottom.ceil() as i32)
+    }
+
+    /// Fraction of pixel (x, y) inside the shape, sampled at its center
+    pub fn coverage(&self, x: i32, y: i32) -> f32 {
+        let (px, py) = (x as f32 + 0.5, y as f32 + 0.5);
+        let (cx, cy) = ((self.left + self.right) * 0.5, (self.top + self.bottom) * 0.5);
+        let radius = match (px < cx, py < cy) {
+            (true, true) => self.radii.top_left,
+            (false, true) => self.radii.top_right,
+            (false, false) => self.radii.bottom_right,
+            (true, false) => self.radii.bottom_left,
+        };
+
+        // Distance to the box shrunk by the radius, less the radius
+        let qx = (px - cx).abs() - (self.right - self.left) * 0.5 + radius;
+        let qy = (py - cy).abs() - (self.bottom - self.top) * 0.5 + radius;
+        let dist = if qx > 0.0 && qy > 0.0 {
+            (qx * qx + qy * qy).sqrt() - radius
+        } else {
+            qx.max(qy) - radius
+        };
+        (0.5 - dist).clamp(0.0, 1.0)
+    }
+
+    /// Spans of row `y`, or None if the row misses the shape
+    pub fn row(&self, y: i32) -> Option<RowSpans> {
+        let py = y as f32 + 0.5;
+        // A pixel has coverage while its center is within half a pixel
+        // outside the edge, and full coverage from half a pixel inside it
+        if py <= self.top - 0.5 || py >= self.bottom + 0.5 {
+            return None;
+        }
+
+        let (left_out, left_in) = self.side(py, self.radii.top_left, self.radii.bottom_left);
+        let (right_out, right_in) = self.side(py, self.radii.top_right, self.radii.bottom_right);
+        let start = (self.left + left_out - 0.5).floor() as i32 + 1;
+        let end = (self.right - right_out - 0.5).ceil() as i32;
+        if end <= start {
+            return None;
+        }
+
+        // Rows cut by the top or bottom edge are all edge pixels
+        if py < self.top + 0.5 || py > self.bottom - 0.5 {
+            return Some(RowSpans {
+                start,
+                full_start: end,
+                full_end: end,
+                end,
+            });
+        }
+
+        let full_start = ((self.left + left_in - 0.5).ceil() as i32).clamp(start, end);
+        let full_end = ((self.right - right_in - 0.5).floor() as i32 + 1).clamp(full_start, end);
+        Some(RowSpans {
+            start,
+            full_start,
+            full_end,
+            end,
+        })
+    }
+
+    // How far in from the left or right edge a row's coverage begins and
+    // its full coverage begins, given that side's top and bottom radii
+    fn side(&self, py: f32, top_radius: f32, bottom_radius: f32) -> (f32, f32) {
+        let (radius, dy) = if py < self.top + top_radius {
+            (top_radius, self.top + top_radius - py)
+        } else if py > self.bottom - bottom_radius {
+            (bottom_radius, py - (self.bottom - bottom_radius))
+        } else {
+            return (-0.5, 0.5);
+        };
+
+        // Where the row crosses the circles half a pixel outside and inside
+        // the corner arc
+        let chord = |r: f32| (r * r - dy * dy).max(0.0).sqrt();
+        let outer = radius - chord(radius + 0.5);
+        let inner = if radius > 0.5 {
+            radius - chord(radius - 0.5)
+        } else {
+            radius
+        };
+        (outer, inner)
+    }
+}
+
+/// Straight-alpha blend from `a` to `b`, `t` in 0..=1
+pub(crate) fn mix(a: Color, b: Color, t: f32) -> Color {
+    let lerp = |a: u8, b: u8| (a as f32 + (b as f32 - a as f32) * t).round() as u8;
+    Color::rgba(lerp(a.r, b.r), lerp(a.g, b.g), lerp(a.b, b.b), lerp(a.a, b.a))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // Every pixel around `shape`: none outside a row's spans has coverage,
+    // and every one in its full span is covered completely
+    fn check_spans(shape: &RoundedShape) {
+        let (top, bottom) = shape.rows();
+        let (left, right) = (shape.left.floor() as i32, shape.right.ceil() as i32);
+        for y in top - 2..bottom + 2 {
+            let spans = shape.row(y);
+            for x in left - 2..right + 2 {
+                let coverage = shape.coverage(x, y);
+                match spans {
+                    Some(s) if (s.full_start..s.full_end).contains(&x) => {
+                        assert_eq!(coverage, 1.0, "{:?} ({}, {}) in {:?}", shape, x, y, s)
+                    }
+                    Some(s) if (s.start..s.end).contains(&x) => {}
+                    _ => assert_eq!(coverage, 0.0, "{:?} ({}, {}) in {:?}", shape, x, y, spans),
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn row_spans_bound_coverage() {
+        let radii = [0.0, 0.3, 0.5, 0.7, 1.0, 1.5, 2.0, 3.5, 6.0, 10.0, 25.0, 100.0];
+        // Fractional insets give the fractional edges a border leaves
+        let insets = [0.0, 0.25, 0.5, 1.0, 1.5, 2.75];
+        for w in [1, 2, 3, 5, 8, 13, 21, 40] {
+            for h in [1, 2, 3, 7, 16, 33] {
+                for &radius in &radii {
+                    let shape = RoundedShape::new(Rect::new(3, 5, w, h), CornerRadii::all(radius));
+                    for &amount in &insets {
+                        if let Some(inset) = shape.inset(amount) {
+                            check_spans(&inset);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn asymmetric_radii() {
+        let shape = RoundedShape::new(Rect::new(0, 0, 40, 30), CornerRadii::new(0.0, 4.0, 12.0, 20.0));
+        check_spans(&shape);
+        check_spans(&shape.inset(1.5).unwrap());
+
+        // The square top-left corner is solid; the others are cut away
+        assert_eq!(shape.coverage(0, 0), 1.0);
+        assert_eq!(shape.coverage(39, 0), 0.0);
+        assert_eq!(shape.coverage(39, 29), 0.0);
+        assert_eq!(shape.coverage(0, 29), 0.0);
+        // Each side's spans follow its own corners: the top row runs from
+        // the left edge, and the bottom row is cut more on the left (20,
+        // limited to 15) than on the right (12)
+        let top = shape.row(0).unwrap();
+        assert_eq!((top.start, top.full_start), (0, 0));
+        assert!(top.full_end < top.end && top.end < 40);
+        let bottom = shape.row(29).unwrap();
+        assert!(bottom.start > 40 - bottom.end);
+        let middle = shape.row(8).unwrap();
+        assert_eq!(middle, RowSpans { start: 0, full_start: 0, full_end: 40, end: 40 });
+    }
+}
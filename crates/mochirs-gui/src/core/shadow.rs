@@ -0,0 +1,394 @@
+// Blurred shadow masks
+//
+// A shadow is the shape's coverage blurred by an approximate Gaussian:
+// three box blurs per axis, each a running sum, so the cost per pixel does
+// not depend on the blur radius. A mask only depends on the shape's size,
+// corner radii and blur, so masks are cached and every shape of the same
+// size shares one. Compositing is a single blend_mask pass.
+
+use crate::core::rounded::{CornerRadii, RoundedShape};
+use crate::core::ui::Rect;
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex, OnceLock};
+
+/// Blur radii are clamped to this
+pub const MAX_BLUR: i32 = 64;
+
+// Three box passes are within a few percent of a true Gaussian
+const PASSES: usize = 3;
+
+// Default mask budget, enough for a few dozen window-sized shadows
+const DEFAULT_CAPACITY_BYTES: usize = 16 * 1024 * 1024;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct ShadowKey {
+    pub width: i32,
+    pub height: i32,
+    pub radii: [u32; 4],
+    pub blur: i32,
+}
+
+/// Shadow alpha for a shape, with `spread` pixels of falloff on every side
+#[derive(Debug)]
+pub struct ShadowMask {
+    pub key: ShadowKey,
+    pub spread: i32,
+    pub width: usize,
+    pub height: usize,
+    pub alpha: Vec<u8>,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct ShadowCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub entries: usize,
+    pub bytes: usize,
+}
+
+// Box radius for one pass. Each pass of width w adds (w² - 1) / 12 to the
+// variance, and the blur radius is taken as two standard deviations. Any
+// blur at all gets at least a 3-pixel box, which rounding would otherwise
+// turn into a hard edge for blur 1.
+fn box_radius(blur: i32) -> usize {
+    if blur < 1 {
+        return 0;
+    }
+    let sigma = blur.min(MAX_BLUR) as f32 * 0.5;
+    let width = (12.0 * sigma * sigma / PASSES as f32 + 1.0).sqrt();
+    (((width - 1.0) * 0.5).round() as usize).max(1)
+}
+
+/// How far a shadow reaches past its shape on each side: the blur's reach,
+/// plus one pixel so every mask fades out to 0 at its border
+pub fn spread(blur: i32) -> i32 {
+    match box_radius(blur) {
+        0 => 0,
+        radius => (radius * PASSES) as i32 + 1,
+    }
+}
+
+/// Shadows fall slightly down and to the right of their shape
+pub fn offset(blur: i32) -> i32 {
+    (blur.min(6) / 2).max(1)
+}
+
+/// Every pixel a shadow of `rect` may touch
+pub fn bounds(rect: Rect, blur: i32) -> Rect {
+    if blur < 1 || rect.is_empty() {
+        return Rect::new(rect.x, rect.y, 0, 0);
+    }
+    let (spread, offset) = (spread(blur), offset(blur));
+    Rect::new(
+        rect.x - spread + offset,
+        rect.y - spread + offset,
+        rect.width + spread * 2,
+        rect.height + spread * 2,
+    )
+}
+
+// Shared by every canvas, including the tiled renderer's workers
+fn cache() -> &'static Mutex<ShadowCache> {
+    static CACHE: OnceLock<Mutex<ShadowCache>> = OnceLock::new();
+    CACHE.get_or_init(|| Mutex::new(ShadowCache::new()))
+}
+
+/// The cached shadow mask for a `width` x `height` shape
+pub fn mask(width: i32, height: i32, radii: CornerRadii, blur: i32) -> Arc<ShadowMask> {
+    let key = ShadowKey {
+        width,
+        height,
+        radii: radii.to_bits(),
+        blur: blur.clamp(0, MAX_BLUR),
+    };
+    cache().lock().unwrap().get(key, radii)
+}
+
+/// Mask cache hit/miss counters. Misses are blurs, so a steady-state frame
+/// should only add hits.
+pub fn cache_stats() -> ShadowCacheStats {
+    let cache = cache().lock().unwrap();
+    ShadowCacheStats {
+        entries: cache.masks.len(),
+        bytes: cache.used_bytes,
+        ..cache.stats
+    }
+}
+
+struct Entry {
+    mask: Arc<ShadowMask>,
+    last_used: u64,
+}
+
+struct ShadowCache {
+    masks: HashMap<ShadowKey, Entry>,
+    capacity_bytes: usize,
+    used_bytes: usize,
+    clock: u64,
+    stats: ShadowCacheStats,
+}
+
+impl ShadowCache {
+    fn new() -> Self {
+        Self {
+            masks: HashMap::new(),
+            capacity_bytes: DEFAULT_CAPACITY_BYTES,
+            used_bytes: 0,
+            clock: 0,
+            stats: ShadowCacheStats::default(),
+        }
+    }
+
+    fn get(&mut self, key: ShadowKey, radii: CornerRadii) -> Arc<ShadowMask> {
+        self.clock += 1;
+
+        if let Some(entry) = self.masks.get_mut(&key) {
+            entry.last_used = self.clock;
+            self.stats.hits += 1;
+            return entry.mask.clone();
+        }
+
+        self.stats.misses += 1;
+        let start = std::time::Instant::now();
+        let mask = Arc::new(build(key, radii));
+        debug_log!(
+            "Built {}x{} mask (blur {}) in {:.2}ms",
+            mask.width,
+            mask.height,
+            key.blur,
+            start.elapsed().as_secs_f64() * 1000.0
+        );
+
+        self.used_bytes += mask.alpha.len();
+        self.masks.insert(
+            key,
+            Entry {
+                mask: mask.clone(),
+                last_used: self.clock,
+            },
+        );
+        if self.used_bytes > self.capacity_bytes {
+            self.evict();
+        }
+
+        mask
+    }
+
+    // Drop least recently used masks until a quarter of the budget is free
+    fn evict(&mut self) {
+        let target = self.capacity_bytes * 3 / 4;
+        let mut by_age: Vec<(u64, ShadowKey, usize)> = self
+            .masks
+            .iter()
+            .map(|(key, entry)| (entry.last_used, *key, entry.mask.alpha.len()))
+            .collect();
+        by_age.sort_unstable_by_key(|(last_used, _, _)| *last_used);
+
+        for (_, key, bytes) in by_age {
+            if self.used_bytes <= target {
+                break;
+            }
+            self.masks.remove(&key);
+            self.used_bytes -= bytes;
+        }
+        debug_log!("Evicted down to {} masks, {}KB", self.masks.len(), self.used_bytes / 1024);
+    }
+}
+
+// Rasterize the shape's coverage with room for the falloff, then blur it
+fn build(key: ShadowKey, radii: CornerRadii) -> ShadowMask {
+    let spread = spread(key.blur);
+    let width = (key.width.max(0) + spread * 2) as usize;
+    let height = (key.height.max(0) + spread * 2) as usize;
+    let mut alpha = vec![0u8; width * height];
+
+    let shape = RoundedShape::new(Rect::new(spread, spread, key.width, key.height), radii);
+    for (y, row) in alpha.chunks_exact_mut(width.max(1)).enumerate() {
+        let spans = match shape.row(y as i32) {
+            Some(spans) => spans,
+            None => continue,
+        };
+        row[spans.full_start as usize..spans.full_end as usize].fill(255);
+        for x in (spans.start..spans.full_start).chain(spans.full_end..spans.end) {
+            row[x as usize] = (shape.coverage(x, y as i32) * 255.0).round() as u8;
+        }
+    }
+
+    blur(&mut alpha, width, height, key.blur);
+    ShadowMask {
+        key,
+        spread,
+        width,
+        height,
+        alpha,
+    }
+}
+
+/// Blur a `width` x `height` coverage mask in place. Pixels past the edges
+/// count as zero, so pad the mask by `spread(blur)` to keep the falloff.
+pub fn blur(alpha: &mut [u8], width: usize, height: usize, blur: i32) {
+    let radius = box_radius(blur);
+    if radius == 0 || width == 0 || height == 0 {
+        return;
+    }
+    let mut scratch = vec![0u8; alpha.len()];
+    let mut sums = vec![0u32; width];
+
+    // Each pass blurs the rows of `alpha` into `scratch`, then the columns
+    // of `scratch` back into `alpha`, keeping one row of running column
+    // sums. Every pass starts and ends in `alpha`.
+    for _ in 0..PASSES {
+        for (src, dst) in alpha.chunks_exact(width).zip(scratch.chunks_exact_mut(width)) {
+            box_row(src, dst, radius);
+        }
+        box_columns(&scratch, alpha, &mut sums, width, height, radius);
+    }
+}
+
+// Fixed-point 1 / (2r + 1), so averaging is a multiply and a shift
+fn reciprocal(radius: usize) -> u32 {
+    let window = (radius * 2 + 1) as u32;
+    ((1 << 16) + window / 2) / window
+}
+
+// Average over a window of 2r + 1, treating pixels past the ends as zero
+fn box_row(src: &[u8], dst: &mut [u8], radius: usize) {
+    let (n, window) = (src.len(), radius * 2 + 1);
+    let scale = reciprocal(radius);
+    let mut sum = 0u32;
+    for i in 0..n + radius {
+        if i < n {
+            sum += src[i] as u32;
+        }
+        if i >= window {
+            sum -= src[i - window] as u32;
+        }
+        if i >= radius {
+            dst[i - radius] = ((sum * scale + (1 << 15)) >> 16).min(255) as u8;
+        }
+    }
+}
+
+// The same running sum down every column at once, a row at a time
+fn box_columns(src: &[u8], dst: &mut [u8], sums: &mut [u32], width: usize, height: usize, radius: usize) {
+    let window = radius * 2 + 1;
+    let scale = reciprocal(radius);
+    sums.fill(0);
+    for i in 0..height + radius {
+        if i < height {
+            for (sum, &a) in sums.iter_mut().zip(&src[i * width..(i + 1) * width]) {
+                *sum += a as u32;
+            }
+        }
+        if i >= window {
+            let old = i - window;
+            for (sum, &a) in sums.iter_mut().zip(&src[old * width..(old + 1) * width]) {
+                *sum -= a as u32;
+            }
+        }
+        if i >= radius {
+            let row = i - radius;
+            for (out, &sum) in dst[row * width..(row + 1) * width].iter_mut().zip(sums.iter()) {
+                *out = ((sum * scale + (1 << 15)) >> 16).min(255) as u8;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const BLURS: &[i32] = &[1, 2, 3, 5, 8, 13, 24, MAX_BLUR];
+
+    fn key(width: i32, height: i32, radii: CornerRadii, blur: i32) -> ShadowKey {
+        ShadowKey {
+            width,
+            height,
+            radii: radii.to_bits(),
+            blur,
+        }
+    }
+
+    #[test]
+    fn box_radius_follows_blur() {
+        assert_eq!(box_radius(0), 0);
+        assert_eq!(box_radius(-4), 0);
+        assert_eq!(box_radius(MAX_BLUR * 4), box_radius(MAX_BLUR));
+        let mut last = 1;
+        for blur in 1..=MAX_BLUR {
+            let radius = box_radius(blur);
+            assert!(radius >= last, "blur {} radius {} after {}", blur, radius, last);
+            // The passes together spread about as far as two standard
+            // deviations of blur / 2
+            let width = (radius * 2 + 1) as f32;
+            let sigma = (PASSES as f32 * (width * width - 1.0) / 12.0).sqrt();
+            assert!((sigma - blur as f32 * 0.5).abs() <= 1.0, "blur {} sigma {}", blur, sigma);
+            assert_eq!(spread(blur), (radius * PASSES) as i32 + 1);
+            last = radius;
+        }
+        assert_eq!(spread(0), 0);
+    }
+
+    #[test]
+    fn mask_fills_bounds_and_fades_to_zero() {
+        assert!(bounds(Rect::new(5, 5, 20, 20), 0).is_empty());
+        for &blur in BLURS {
+            for (width, height) in [(1, 1), (7, 30), (40, 25)] {
+                for radius in [0.0, 6.0] {
+                    let radii = CornerRadii::all(radius);
+                    let rect = Rect::new(10, -3, width, height);
+                    let mask = build(key(width, height, radii, blur), radii);
+                    let area = bounds(rect, blur);
+                    assert_eq!((mask.width as i32, mask.height as i32), (area.width, area.height));
+                    assert_eq!(mask.spread, spread(blur));
+                    assert_eq!(area.x, rect.x - mask.spread + offset(blur));
+
+                    let (w, h) = (mask.width, mask.height);
+                    let edge = |x: usize, y: usize| mask.alpha[y * w + x];
+                    for x in 0..w {
+                        assert_eq!((edge(x, 0), edge(x, h - 1)), (0, 0), "blur {} column {}", blur, x);
+                    }
+                    for y in 0..h {
+                        assert_eq!((edge(0, y), edge(w - 1, y)), (0, 0), "blur {} row {}", blur, y);
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn small_blur_keeps_a_solid_interior() {
+        for blur in [1, 2, 3, 5] {
+            let radii = CornerRadii::all(4.0);
+            let mask = build(key(60, 40, radii, blur), radii);
+            // Pixels further than the blur's reach inside the shape
+            let inner = mask.spread * 2;
+            for y in inner..mask.height as i32 - inner {
+                for x in inner..mask.width as i32 - inner {
+                    assert_eq!(mask.alpha[y as usize * mask.width + x as usize], 255, "blur {} ({}, {})", blur, x, y);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn blur_keeps_constant_input_constant() {
+        let (width, height) = (50, 37);
+        for &blur in BLURS {
+            let reach = box_radius(blur) * PASSES;
+            if reach * 2 >= height {
+                continue;
+            }
+            for value in [1, 128, 200, 255] {
+                let mut alpha = vec![value; width * height];
+                super::blur(&mut alpha, width, height, blur);
+                for y in reach..height - reach {
+                    for x in reach..width - reach {
+                        assert_eq!(alpha[y * width + x], value, "blur {} ({}, {})", blur, x, y);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,77 @@
+// Image stretching for the live-resize preview
+//
+// While a window is being resized, the last fully rendered frame is
+// stretched to the new size instead of rendering from scratch. Source
+// coordinates are carried in 16.16 fixed point and worked out once per
+// column, so a row is only loads, and for bilinear, a few multiplies.
+// Pixels are premultiplied, so filtering them directly is correct.
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum ScaleFilter {
+    /// Nearest source pixel; blocky but about the cost of a copy
+    Nearest,
+    /// Weighted average of the four nearest source pixels
+    #[default]
+    Bilinear,
+}
+
+/// Stretch `src` (`src_width` x `src_height` BGRA) over the whole of `dst`
+pub fn stretch(
+    dst: &mut [u8],
+    dst_width: u32,
+    dst_height: u32,
+    src: &[u8],
+    src_width: u32,
+    src_height: u32,
+    filter: ScaleFilter,
+) {
+    let (dw, dh) = (dst_width as usize, dst_height as usize);
+    let (sw, sh) = (src_width as usize, src_height as usize);
+    if dw == 0 || dh == 0 || sw == 0 || sh == 0 || src.len() < sw * sh * 4 || dst.len() < dw * dh * 4 {
+        return;
+    }
+    let src_stride = sw * 4;
+    let rows = dst.chunks_exact_mut(dw * 4).take(dh);
+
+    match filter {
+        ScaleFilter::Nearest => {
+            let columns: Vec<usize> = (0..dw).map(|x| (x * sw / dw) * 4).collect();
+            for (y, row) in rows.enumerate() {
+                let line = &src[(y * sh / dh) * src_stride..][..src_stride];
+                for (pixel, &at) in row.chunks_exact_mut(4).zip(&columns) {
+                    pixel.copy_from_slice(&line[at..at + 4]);
+                }
+            }
+        }
+        ScaleFilter::Bilinear => {
+            // Pixel centers map onto pixel centers
+            let columns: Vec<(usize, usize, u32)> = (0..dw)
+                .map(|x| {
+                    let (left, right, weight) = sample(x, dw, sw);
+                    (left * 4, right * 4, weight)
+                })
+                .collect();
+            for (y, row) in rows.enumerate() {
+                let (top, bottom, wy) = sample(y, dh, sh);
+                let top = &src[top * src_stride..][..src_stride];
+                let bottom = &src[bottom * src_stride..][..src_stride];
+                for (pixel, &(left, right, wx)) in row.chunks_exact_mut(4).zip(&columns) {
+                    for c in 0..4 {
+                        let upper = top[left + c] as u32 * (256 - wx) + top[right + c] as u32 * wx;
+                        let lower = bottom[left + c] as u32 * (256 - wx) + bottom[right + c] as u32 * wx;
+                        pixel[c] = ((upper * (256 - wy) + lower * wy + 32768) >> 16) as u8;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The two source pixels around destination pixel `at` and the weight of
+// the second, in 1/256ths
+fn sample(at: usize, dst_len: usize, src_len: usize) -> (usize, usize, u32) {
+    let pos = ((at as i64 * 2 + 1) * src_len as i64 * 65536 / (dst_len as i64 * 2) - 32768).max(0);
+    let first = ((pos >> 16) as usize).min(src_len - 1);
+    let second = (first + 1).min(src_len - 1);
+    (first, second, ((pos >> 8) & 0xff) as u32)
+}
@@ -0,0 +1,140 @@
+// Shared-memory swapchain
+//
+// A handful of wl_shm buffers are reused from frame to frame instead of
+// allocating one per frame. A buffer attached to the surface belongs to the
+// compositor until it sends wl_buffer.release, and is never drawn into
+// before that. The pool behind the buffers only grows, geometrically, so an
+// interactive resize doesn't reallocate the memfd at every step.
+//
+// Each buffer remembers what has changed since it was last presented. When
+// it comes back around only those rects, and the new frame's damage, are
+// copied into it from the retained frame, so a small update costs time in
+// proportion to its area rather than the window's.
+
+use smithay_client_toolkit::shm::{
+    slot::{Buffer, CreateBufferError, SlotPool},
+    CreatePoolError, Shm,
+};
+use crate::core::damage::DamageRegion;
+use crate::core::ui::Rect;
+use wayland_client::protocol::wl_shm;
+
+/// Double buffering, plus a third buffer when the compositor holds on to
+/// two (one on screen, one queued)
+pub const MAX_BUFFERS: usize = 3;
+
+struct Slot {
+    buffer: Buffer,
+    // Damage presented in other buffers since this one was last presented
+    stale: DamageRegion,
+}
+
+pub struct Swapchain {
+    pool: SlotPool,
+    // All of the current size; older sizes are dropped on resize
+    slots: Vec<Slot>,
+    // Slot handed out by the last acquire
+    acquired: Option<usize>,
+    width: u32,
+    height: u32,
+}
+
+impl Swapchain {
+    pub fn new(shm: &Shm, width: u32, height: u32) -> Result<Self, CreatePoolError> {
+        // Room for double buffering up front
+        let pool = SlotPool::new(frame_bytes(width, height).max(4) * 2, shm)?;
+        Ok(Self {
+            pool,
+            slots: Vec::with_capacity(MAX_BUFFERS),
+            acquired: None,
+            width,
+            height,
+        })
+    }
+
+    /// Match the surface size. Buffers of the old size are dropped; one the
+    /// compositor still holds keeps its memory until it is released.
+    pub fn resize(&mut self, width: u32, height: u32) {
+        if (width, height) == (self.width, self.height) {
+            return;
+        }
+        self.slots.clear();
+        self.acquired = None;
+        self.width = width;
+        self.height = height;
+
+        let needed = frame_bytes(width, height) * 2;
+        if self.pool.len() < needed {
+            let len = needed.max(self.pool.len() * 2);
+            debug_log!("Growing pool {}KB -> {}KB", self.pool.len() / 1024, len / 1024);
+            if let Err(e) = self.pool.resize(len) {
+                // create_buffer grows the pool itself as a last resort
+                debug_log!("Failed to grow pool: {}", e);
+            }
+        }
+    }
+
+    /// A buffer the compositor isn't using, its pixels, and the region of
+    /// them that is out of date. None while every buffer is still held and
+    /// no more may be made; a release will follow.
+    pub fn acquire(&mut self) -> Result<Option<(&Buffer, &mut [u8], &DamageRegion)>, CreateBufferError> {
+        let (width, height) = (self.width as i32, self.height as i32);
+        let Self { pool, slots, .. } = self;
+        let index = match slots.iter().position(|slot| slot.buffer.canvas(pool).is_some()) {
+            Some(index) => index,
+            None if slots.len() < MAX_BUFFERS => {
+                let (buffer, _) = pool.create_buffer(width, height, width * 4, wl_shm::Format::Argb8888)?;
+                // A new buffer has nothing in it yet
+                slots.push(Slot {
+                    buffer,
+                    stale: DamageRegion::full(width as u32, height as u32),
+                });
+                debug_log!("Created buffer {} of {}x{}", slots.len(), width, height);
+                slots.len() - 1
+            }
+            None => return Ok(None),
+        };
+
+        self.acquired = Some(index);
+        let slot = &self.slots[index];
+        Ok(slot
+            .buffer
+            .canvas(&mut self.pool)
+            .map(|pixels| (&slot.buffer, pixels, &slot.stale)))
+    }
+
+    /// The acquired buffer was brought up to date and attached, with
+    /// `damage` changed from the frame before. Every other buffer now lacks
+    /// that damage.
+    pub fn presented(&mut self, damage: &DamageRegion) {
+        let Some(index) = self.acquired.take() else {
+            return;
+        };
+        for (i, slot) in self.slots.iter_mut().enumerate() {
+            if i == index {
+                slot.stale.clear();
+            } else {
+                slot.stale.union(damage);
+            }
+        }
+    }
+}
+
+/// Copy `rect` of a `width` pixel wide frame from `src` to `dst`
+pub fn copy_rect(dst: &mut [u8], src: &[u8], width: u32, rect: &Rect) {
+    let stride = width as usize * 4;
+    let rows = src.len().min(dst.len()) / stride.max(1);
+    let (left, right) = (rect.x.max(0) as usize, ((rect.x + rect.width).max(0) as usize).min(width as usize));
+    let (top, bottom) = (rect.y.max(0) as usize, ((rect.y + rect.height).max(0) as usize).min(rows));
+    if left >= right {
+        return;
+    }
+    for y in top..bottom {
+        let span = y * stride + left * 4..y * stride + right * 4;
+        dst[span.clone()].copy_from_slice(&src[span]);
+    }
+}
+
+fn frame_bytes(width: u32, height: u32) -> usize {
+    width as usize * height as usize * 4
+}
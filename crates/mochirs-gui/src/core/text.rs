@@ -1,15 +1,85 @@
+use crate::core::glyph_cache::{split_subpixel, GlyphBitmap, GlyphCache, GlyphCacheStats, GlyphKey};
+use crate::core::layout::{LayoutCache, TextLine, TextRun};
+use crate::core::shadow;
 use crate::core::{canvas::Canvas, color::Color};
 use fontdue::{Font, FontSettings};
+use std::cell::RefCell;
 use std::collections::HashMap;
+use std::sync::Arc;
+
+// Blurred run masks kept before the least recently used half is dropped
+const MAX_SHADOWS: usize = 128;
+
+// The run pointer is stable while the entry holds the run
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct ShadowKey {
+    run: usize,
+    font: usize,
+    blur: i32,
+}
+
+struct CachedShadow {
+    // Keeps the run alive so its address can't be reused by another run
+    _run: Arc<TextRun>,
+    mask: Arc<GlyphBitmap>,
+    last_used: u64,
+}
+
+struct ShadowCache {
+    masks: HashMap<ShadowKey, CachedShadow>,
+    clock: u64,
+}
+
+impl ShadowCache {
+    fn new() -> Self {
+        Self {
+            masks: HashMap::new(),
+            clock: 0,
+        }
+    }
+
+    fn get(&mut self, key: &ShadowKey) -> Option<Arc<GlyphBitmap>> {
+        self.clock += 1;
+        let cached = self.masks.get_mut(key)?;
+        cached.last_used = self.clock;
+        Some(cached.mask.clone())
+    }
+
+    fn insert(&mut self, key: ShadowKey, run: Arc<TextRun>, mask: Arc<GlyphBitmap>) {
+        self.masks.insert(
+            key,
+            CachedShadow {
+                _run: run,
+                mask,
+                last_used: self.clock,
+            },
+        );
+        if self.masks.len() > MAX_SHADOWS {
+            let mut ages: Vec<u64> = self.masks.values().map(|m| m.last_used).collect();
+            ages.sort_unstable();
+            let cutoff = ages[ages.len() / 2];
+            self.masks.retain(|_, m| m.last_used > cutoff);
+        }
+    }
+}
 
 pub struct TextRenderer {
     fonts: HashMap<String, Font>,
+    // Rasterized glyphs and metrics survive across frames
+    cache: RefCell<GlyphCache>,
+    // Shaped runs, so unchanged strings are never re-laid out
+    layouts: RefCell<LayoutCache>,
+    // Blurred coverage of whole runs, for text shadows
+    shadows: RefCell<ShadowCache>,
 }
 
 impl TextRenderer {
     pub fn new() -> Self {
         Self {
             fonts: HashMap::new(),
+            cache: RefCell::new(GlyphCache::new()),
+            layouts: RefCell::new(LayoutCache::new()),
+            shadows: RefCell::new(ShadowCache::new()),
         }
     }
 
@@ -32,73 +102,152 @@ impl TextRenderer {
         font_size: f32,
         color: Color,
         font_name: &str,
+    ) {
+        match self.layout(text, font_size, font_name, None) {
+            Some(run) => self.render_run(canvas, &run, x, y, color, font_name),
+            None => eprintln!("Font '{}' not found", font_name),
+        }
+    }
+
+    /// Shape `text` into a run, wrapping at `max_width` if given. The run is
+    /// cached, so calling this every frame for the same string is cheap.
+    pub fn layout(
+        &self,
+        text: &str,
+        font_size: f32,
+        font_name: &str,
+        max_width: Option<i32>,
+    ) -> Option<Arc<TextRun>> {
+        let font = self.fonts.get(font_name)?;
+        let mut glyphs = self.cache.borrow_mut();
+        Some(
+            self.layouts
+                .borrow_mut()
+                .layout(&mut glyphs, font, text, font_size, max_width),
+        )
+    }
+
+    /// Draw every line of a run with its top-left corner at (x, y)
+    pub fn render_run(
+        &self,
+        canvas: &mut Canvas,
+        run: &TextRun,
+        x: i32,
+        y: i32,
+        color: Color,
+        font_name: &str,
+    ) {
+        for (i, line) in run.lines.iter().enumerate() {
+            let line_y = y + (run.line_height * i as f32) as i32;
+            self.render_line(canvas, run, line, x, line_y, color, font_name);
+        }
+    }
+
+    /// Draw one line of a run; (x, y) is the top-left of the line box
+    pub fn render_line(
+        &self,
+        canvas: &mut Canvas,
+        run: &TextRun,
+        line: &TextLine,
+        x: i32,
+        y: i32,
+        color: Color,
+        font_name: &str,
     ) {
         let font = match self.fonts.get(font_name) {
             Some(f) => f,
-            None => {
-                eprintln!("Font '{}' not found", font_name);
-                return;
-            }
+            None => return,
         };
 
-        let mut cursor_x = x;
-        let baseline_offset = self.calculate_baseline(text, font_size, font);
-
-        for ch in text.chars() {
-            let (metrics, bitmap) = font.rasterize(ch, font_size);
-            let advance = metrics.advance_width as i32;
+        let mut cache = self.cache.borrow_mut();
+        for glyph in run.line_glyphs(line) {
+            let (whole_x, subpixel) = split_subpixel(x as f32 + glyph.x);
+            let bitmap = cache.rasterize(font, GlyphKey::new(font, glyph.glyph, run.font_size, subpixel));
+            if bitmap.width == 0 || bitmap.height == 0 {
+                continue;
+            }
 
-            if metrics.width > 0 && metrics.height > 0 {
-                let char_x = cursor_x + metrics.xmin;
-                let char_y = y + baseline_offset - metrics.height as i32 - metrics.ymin;
+            let char_x = whole_x + bitmap.xmin;
+            let char_y = y + run.ascent - bitmap.height as i32 - bitmap.ymin;
 
-                for py in 0..metrics.height {
-                    for px in 0..metrics.width {
-                        let screen_x = char_x + px as i32;
-                        let screen_y = char_y + py as i32;
+            canvas.draw_glyph(char_x, char_y, &bitmap, color);
+        }
+    }
 
-                        let bitmap_idx = py * metrics.width + px;
-                        let alpha = bitmap[bitmap_idx];
+    /// Blurred coverage of a whole run, for drawing its shadow in one blend.
+    /// `xmin` and `ymin` give the mask's top-left relative to the run's.
+    /// Built once per run and blur, so unchanged labels never re-rasterize.
+    pub fn shadow_mask(&self, run: &Arc<TextRun>, font_name: &str, blur: i32) -> Option<Arc<GlyphBitmap>> {
+        let font = self.fonts.get(font_name)?;
+        let key = ShadowKey {
+            run: Arc::as_ptr(run) as usize,
+            font: font.file_hash(),
+            blur,
+        };
+        if let Some(mask) = self.shadows.borrow_mut().get(&key) {
+            return Some(mask);
+        }
 
-                        if alpha > 0 {
-                            let pixel_color = Color::rgba(color.r, color.g, color.b, alpha);
-                            canvas.blend_pixel(screen_x, screen_y, pixel_color);
+        let spread = shadow::spread(blur);
+        let width = (run.width_px() + spread * 2).max(0) as usize;
+        let height = (run.height_px() + spread * 2).max(0) as usize;
+        let mut coverage = vec![0u8; width * height];
+
+        // Same glyph placement as render_line, with the run at (spread, spread)
+        let mut cache = self.cache.borrow_mut();
+        for (i, line) in run.lines.iter().enumerate() {
+            let line_y = spread + (run.line_height * i as f32) as i32;
+            for glyph in run.line_glyphs(line) {
+                let (whole_x, subpixel) = split_subpixel(spread as f32 + glyph.x);
+                let bitmap = cache.rasterize(font, GlyphKey::new(font, glyph.glyph, run.font_size, subpixel));
+                let char_x = whole_x + bitmap.xmin;
+                let char_y = line_y + run.ascent - bitmap.height as i32 - bitmap.ymin;
+                for (row, src) in bitmap.coverage.chunks_exact(bitmap.width.max(1)).enumerate() {
+                    let y = char_y + row as i32;
+                    if y < 0 || y >= height as i32 {
+                        continue;
+                    }
+                    for (col, &a) in src.iter().enumerate() {
+                        let x = char_x + col as i32;
+                        if a == 0 || x < 0 || x >= width as i32 {
+                            continue;
                         }
+                        // Overlapping glyphs combine like blending one over the other
+                        let dst = &mut coverage[y as usize * width + x as usize];
+                        let (a, d) = (a as u32, *dst as u32);
+                        *dst = (a + d - (a * d + 127) / 255) as u8;
                     }
                 }
             }
-
-            cursor_x += advance;
         }
+        drop(cache);
+
+        shadow::blur(&mut coverage, width, height, blur);
+        let mask = Arc::new(GlyphBitmap {
+            xmin: -spread,
+            ymin: -spread,
+            width,
+            height,
+            coverage,
+        });
+        self.shadows.borrow_mut().insert(key, run.clone(), mask.clone());
+        Some(mask)
     }
 
-    fn calculate_baseline(&self, text: &str, font_size: f32, font: &Font) -> i32 {
-        let mut max_ascent = 0;
-
-        for ch in text.chars() {
-            let (metrics, _) = font.rasterize(ch, font_size);
-            let ascent = metrics.height as i32 + metrics.ymin;
-            max_ascent = max_ascent.max(ascent);
+    pub fn measure(&self, text: &str, font_size: f32, font_name: &str) -> (i32, i32) {
+        match self.layout(text, font_size, font_name, None) {
+            Some(run) => (run.width_px(), run.max_glyph_height),
+            None => (0, 0),
         }
-
-        max_ascent
     }
 
-    pub fn measure(&self, text: &str, font_size: f32, font_name: &str) -> (i32, i32) {
-        let font = match self.fonts.get(font_name) {
-            Some(f) => f,
-            None => return (0, 0),
-        };
-
-        let mut width = 0;
-        let mut max_height = 0;
-
-        for ch in text.chars() {
-            let (metrics, _) = font.rasterize(ch, font_size);
-            width += metrics.advance_width as i32;
-            max_height = max_height.max(metrics.height as i32);
-        }
+    /// Glyph cache hit/miss counters. Misses are glyph rasterizations, so a
+    /// steady-state frame should only add hits.
+    pub fn cache_stats(&self) -> GlyphCacheStats {
+        self.cache.borrow().stats()
+    }
 
-        (width, max_height)
+    pub fn reset_cache_stats(&self) {
+        self.cache.borrow_mut().reset_stats();
     }
 }
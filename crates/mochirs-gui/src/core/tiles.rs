@@ -0,0 +1,250 @@
+// Tiled parallel replay of display lists
+//
+// The frame is split into bands of TILE_SIZE rows. Each band is a
+// contiguous slice of the buffer, so bands can be painted from different
+// threads without synchronization. Commands are binned by the bands their
+// bounds touch, and workers take the next unpainted band from a shared
+// queue until none are left. Every primitive clips per pixel, so the result
+// is bit-identical to replaying the whole list on one thread.
+//
+// The workers are started with the first parallel frame and then kept,
+// parked on a channel, for the life of the renderer. The thread calling
+// render paints bands as well and waits for the workers before returning,
+// so they only ever borrow the frame while render is running.
+
+use crate::core::canvas::Canvas;
+use crate::core::damage::DamageRegion;
+use crate::core::display_list::DisplayList;
+use crate::core::profiler;
+use crate::core::ui::Rect;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::Mutex;
+use std::thread::{self, JoinHandle};
+
+pub const TILE_SIZE: u32 = 64;
+
+// Below this much damage, waking workers costs more than it saves
+const MIN_PARALLEL_PIXELS: i64 = 256 * 256;
+
+// Upper bound for the default thread count
+const MAX_DEFAULT_THREADS: usize = 8;
+
+pub struct TiledRenderer {
+    threads: usize,
+    // Command indices per band, kept across frames to avoid reallocating
+    bins: Vec<Vec<u32>>,
+    // threads - 1 helpers, started on first use
+    pool: Option<WorkerPool>,
+}
+
+impl TiledRenderer {
+    /// Uses `MOCHI_THREADS` if set, otherwise one thread per core up to 8
+    pub fn new() -> Self {
+        let threads = std::env::var("MOCHI_THREADS")
+            .ok()
+            .and_then(|v| v.parse().ok())
+            .unwrap_or_else(|| {
+                std::thread::available_parallelism()
+                    .map(|n| n.get())
+                    .unwrap_or(1)
+                    .min(MAX_DEFAULT_THREADS)
+            });
+        Self::with_threads(threads)
+    }
+
+    pub fn with_threads(threads: usize) -> Self {
+        Self {
+            threads: threads.max(1),
+            bins: Vec::new(),
+            pool: None,
+        }
+    }
+
+    pub fn threads(&self) -> usize {
+        self.threads
+    }
+
+    /// Replay `list` into `buffer`, painting only inside `damage`
+    pub fn render(&mut self, buffer: &mut [u8], width: u32, height: u32, damage: &DamageRegion, list: &DisplayList) {
+        if self.threads == 1 || damage.area() < MIN_PARALLEL_PIXELS {
+            let mut canvas = Canvas::with_damage(buffer, width, height, damage.clone());
+            list.replay(&mut canvas);
+            return;
+        }
+
+        let start = std::time::Instant::now();
+        let band_count = ((height + TILE_SIZE - 1) / TILE_SIZE) as usize;
+        self.bin(list, band_count);
+
+        let stride = width as usize * 4;
+        let bins = &self.bins;
+        let queue = Mutex::new(
+            buffer
+                .chunks_mut(stride * TILE_SIZE as usize)
+                .enumerate()
+                .filter(|(band, _)| {
+                    let y = (*band as u32 * TILE_SIZE) as i32;
+                    !bins[*band].is_empty()
+                        && damage.intersects(&Rect::new(0, y, width as i32, TILE_SIZE as i32))
+                }),
+        );
+
+        let work = || loop {
+            let next = queue.lock().unwrap().next();
+            let (band, pixels) = match next {
+                Some(next) => next,
+                None => break,
+            };
+            let _scope = profiler::scope("tiles.band");
+            let y = band as i32 * TILE_SIZE as i32;
+            let rows = (pixels.len() / stride) as i32;
+            let bounds = Rect::new(0, y, width as i32, rows);
+            let mut canvas = Canvas::region(pixels, bounds, damage);
+            list.replay_indices(&mut canvas, &bins[band]);
+        };
+
+        let threads = self.threads;
+        let pool = self.pool.get_or_insert_with(|| WorkerPool::new(threads - 1));
+        let workers = pool.run(threads.min(band_count) - 1, &work) + 1;
+
+        debug_log!(
+            "Replayed {} commands over {} bands on {} threads in {:.2}ms",
+            list.len(),
+            band_count,
+            workers,
+            start.elapsed().as_secs_f64() * 1000.0
+        );
+    }
+
+    fn bin(&mut self, list: &DisplayList, band_count: usize) {
+        self.bins.resize_with(band_count, Vec::new);
+        for bin in &mut self.bins {
+            bin.clear();
+        }
+
+        for (index, command) in list.commands().iter().enumerate() {
+            let bounds = command.bounds();
+            if bounds.is_empty() {
+                continue;
+            }
+            let first = (bounds.y.max(0) as u32 / TILE_SIZE) as usize;
+            let last = ((bounds.bottom() - 1).max(0) as u32 / TILE_SIZE) as usize;
+            for bin in self.bins.iter_mut().take(last + 1).skip(first) {
+                bin.push(index as u32);
+            }
+        }
+    }
+}
+
+// A frame's work, run by the calling thread and the helpers at once
+type Work<'a> = dyn Fn() + Sync + 'a;
+
+// The work of the frame being rendered, with its lifetime erased. Only
+// valid until WorkerPool::run returns.
+struct Task(*const Work<'static>);
+
+// Safety: the work is Sync, and run outlives every use of it
+unsafe impl Send for Task {}
+
+struct WorkerPool {
+    tasks: Vec<Sender<Task>>,
+    // One message per finished task; false if it panicked
+    done: Receiver<bool>,
+    handles: Vec<JoinHandle<()>>,
+}
+
+impl WorkerPool {
+    fn new(helpers: usize) -> Self {
+        let (done_tx, done) = mpsc::channel();
+        let mut tasks = Vec::with_capacity(helpers);
+        let mut handles = Vec::with_capacity(helpers);
+        for i in 0..helpers {
+            let (task_tx, task_rx) = mpsc::channel::<Task>();
+            let done_tx = done_tx.clone();
+            let spawned = thread::Builder::new()
+                .name(format!("mochi-tiles-{}", i))
+                .spawn(move || {
+                    for task in task_rx {
+                        // Safety: run() waits for this message before the
+                        // work goes out of scope
+                        let result = panic::catch_unwind(AssertUnwindSafe(|| unsafe { (*task.0)() }));
+                        let _ = done_tx.send(result.is_ok());
+                    }
+                });
+            match spawned {
+                Ok(handle) => {
+                    tasks.push(task_tx);
+                    handles.push(handle);
+                }
+                // The remaining threads, and the caller, paint its share
+                Err(e) => debug_log!("Failed to start tile worker: {}", e),
+            }
+        }
+        debug_log!("Started {} tile workers", handles.len());
+        Self { tasks, done, handles }
+    }
+
+    /// Run `work` on this thread and up to `helpers` workers. Returns once
+    /// all of them are done; the number of workers that took part.
+    fn run(&self, helpers: usize, work: &Work<'_>) -> usize {
+        // Waits for the workers even if `work` panics on this thread, so
+        // none of them can outlive the borrow
+        struct Wait<'a> {
+            done: &'a Receiver<bool>,
+            pending: usize,
+            panicked: bool,
+        }
+
+        impl Wait<'_> {
+            fn drain(&mut self) {
+                while self.pending > 0 {
+                    match self.done.recv() {
+                        Ok(ok) => self.panicked |= !ok,
+                        Err(_) => break,
+                    }
+                    self.pending -= 1;
+                }
+            }
+        }
+
+        impl Drop for Wait<'_> {
+            fn drop(&mut self) {
+                self.drain();
+            }
+        }
+
+        // Safety: only the lifetime changes, and Wait keeps the work alive
+        // until every worker that got it has reported back
+        let task: *const Work<'static> = unsafe { std::mem::transmute(work as *const Work<'_>) };
+        let mut wait = Wait {
+            done: &self.done,
+            pending: 0,
+            panicked: false,
+        };
+        for sender in self.tasks.iter().take(helpers) {
+            if sender.send(Task(task)).is_ok() {
+                wait.pending += 1;
+            }
+        }
+        let helped = wait.pending;
+
+        work();
+        wait.drain();
+        // Like thread::scope, pass on a panic from a worker
+        if wait.panicked {
+            panic!("tile worker panicked");
+        }
+        helped
+    }
+}
+
+impl Drop for WorkerPool {
+    fn drop(&mut self) {
+        // Closing the channels ends the workers' loops
+        self.tasks.clear();
+        for handle in self.handles.drain(..) {
+            let _ = handle.join();
+        }
+    }
+}
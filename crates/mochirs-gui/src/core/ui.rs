@@ -1,6 +1,17 @@
-use crate::core::{canvas::Canvas, color::Color, text::TextRenderer};
-
-#[derive(Debug, Clone)]
+use crate::core::gradient::Gradient;
+use crate::core::icons;
+use crate::core::layer::{self, Layer};
+use crate::core::profiler;
+use crate::core::rounded::{Border, CornerRadii};
+use crate::core::shadow;
+use crate::core::{canvas::Canvas, color::Color, layout::TextRun, text::TextRenderer};
+use std::any::Any;
+use std::cell::RefCell;
+use std::collections::hash_map::DefaultHasher;
+use std::hash::{Hash, Hasher};
+use std::sync::Arc;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 pub struct Rect {
     pub x: i32,
     pub y: i32,
@@ -17,11 +28,334 @@ impl Rect {
             height,
         }
     }
+
+    pub fn right(&self) -> i32 {
+        self.x + self.width
+    }
+
+    pub fn bottom(&self) -> i32 {
+        self.y + self.height
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.width <= 0 || self.height <= 0
+    }
+
+    pub fn area(&self) -> i64 {
+        if self.is_empty() {
+            0
+        } else {
+            self.width as i64 * self.height as i64
+        }
+    }
+
+    pub fn intersect(&self, other: &Rect) -> Option<Rect> {
+        let x0 = self.x.max(other.x);
+        let y0 = self.y.max(other.y);
+        let x1 = self.right().min(other.right());
+        let y1 = self.bottom().min(other.bottom());
+        if x0 >= x1 || y0 >= y1 {
+            None
+        } else {
+            Some(Rect::new(x0, y0, x1 - x0, y1 - y0))
+        }
+    }
+
+    pub fn intersects(&self, other: &Rect) -> bool {
+        self.intersect(other).is_some()
+    }
+
+    // True if the rects overlap or share an edge
+    pub fn touches(&self, other: &Rect) -> bool {
+        self.x <= other.right()
+            && other.x <= self.right()
+            && self.y <= other.bottom()
+            && other.y <= self.bottom()
+    }
+
+    pub fn union(&self, other: &Rect) -> Rect {
+        if self.is_empty() {
+            return *other;
+        }
+        if other.is_empty() {
+            return *self;
+        }
+        let x0 = self.x.min(other.x);
+        let y0 = self.y.min(other.y);
+        let x1 = self.right().max(other.right());
+        let y1 = self.bottom().max(other.bottom());
+        Rect::new(x0, y0, x1 - x0, y1 - y0)
+    }
+
+    pub fn contains_point(&self, x: i32, y: i32) -> bool {
+        x >= self.x && y >= self.y && x < self.right() && y < self.bottom()
+    }
+
+    pub fn contains(&self, other: &Rect) -> bool {
+        other.x >= self.x
+            && other.y >= self.y
+            && other.right() <= self.right()
+            && other.bottom() <= self.bottom()
+    }
+
+    /// The parts of this rect outside `other`, as up to four rects
+    pub fn subtract(&self, other: &Rect) -> impl Iterator<Item = Rect> {
+        let parts = match self.intersect(other) {
+            None => [*self, Rect::new(0, 0, 0, 0), Rect::new(0, 0, 0, 0), Rect::new(0, 0, 0, 0)],
+            Some(i) => [
+                Rect::new(self.x, self.y, self.width, i.y - self.y),
+                Rect::new(self.x, i.bottom(), self.width, self.bottom() - i.bottom()),
+                Rect::new(self.x, i.y, i.x - self.x, i.height),
+                Rect::new(i.right(), i.y, self.right() - i.right(), i.height),
+            ],
+        };
+        parts.into_iter().filter(|r| !r.is_empty())
+    }
+
+    pub fn inflate(&self, amount: i32) -> Rect {
+        Rect::new(
+            self.x - amount,
+            self.y - amount,
+            self.width + amount * 2,
+            self.height + amount * 2,
+        )
+    }
 }
 
 pub trait Element {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer);
     fn bounds(&self) -> Rect;
+
+    // Hooks used by RetainedTree to diff frames. The defaults describe a
+    // leaf whose paint state is unknown, so it is repainted every frame.
+
+    /// Stable identity among siblings, set with `.keyed()`
+    fn key(&self) -> Option<u64> {
+        None
+    }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        &[]
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        &mut []
+    }
+
+    /// Hash of everything this element paints itself (children excluded).
+    /// `None` means the element cannot tell, and is always treated as dirty.
+    fn paint_hash(&self) -> Option<u64> {
+        None
+    }
+
+    /// Area this element paints, including shadows
+    fn paint_bounds(&self, _text_renderer: &TextRenderer) -> Rect {
+        self.bounds()
+    }
+
+    /// Largest rect this element itself covers with fully opaque pixels
+    fn opaque_rect(&self) -> Option<Rect> {
+        None
+    }
+
+    /// Area where this element replaces pixels with translucent ones.
+    /// Fills store their color without blending, so a translucent fill
+    /// punches through whatever opaque content was beneath it.
+    fn translucent_rect(&self) -> Option<Rect> {
+        None
+    }
+
+    /// The concrete element, for in-place updates through
+    /// RetainedTree::find_mut. Wrappers forward to the element they wrap.
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        None
+    }
+}
+
+pub(crate) fn hash_with(f: impl FnOnce(&mut DefaultHasher)) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    f(&mut hasher);
+    hasher.finish()
+}
+
+// The two-color gradient of an element's `.gradient()`, built whenever the
+// background or gradient is set rather than on every paint
+fn two_color_gradient(start: Color, gradient: Option<(Color, f32)>) -> Option<Arc<Gradient>> {
+    gradient.map(|(end, angle)| Arc::new(Gradient::between(start, end, angle)))
+}
+
+/// Opaque part of a background fill: all of it for square corners, the
+/// rect inset past the anti-aliased edge of rounded corners, and nothing
+/// if any color involved is translucent
+pub(crate) fn opaque_fill(rect: Rect, color: Color, gradient: Option<Color>, radius: f32) -> Option<Rect> {
+    if color.a != 255 || gradient.map_or(false, |end| end.a != 255) {
+        return None;
+    }
+    // A corner pixel at (k, k) is solid once it is a pixel inside the arc
+    let inset = if radius > 0.0 {
+        (radius - (radius - 1.0).max(0.0) * std::f32::consts::FRAC_1_SQRT_2).ceil() as i32
+    } else {
+        0
+    };
+    let opaque = rect.inflate(-inset);
+    if opaque.is_empty() {
+        None
+    } else {
+        Some(opaque)
+    }
+}
+
+// A translucent border is stored over the edge of the fill, so only the
+// part inside it can be opaque
+fn inside_border(rect: Rect, border: Option<Color>, width: i32) -> Rect {
+    match border {
+        Some(color) if color.a < 255 => rect.inflate(-width),
+        _ => rect,
+    }
+}
+
+// The rect plus the shadow Canvas::draw_shadow casts from it
+fn with_shadow(rect: Rect, shadow: bool, blur: i32) -> Rect {
+    if shadow && blur > 0 {
+        rect.union(&shadow::bounds(rect, blur))
+    } else {
+        rect
+    }
+}
+
+/// An element with a stable key, so RetainedTree can match it across frames
+/// even when its siblings change, and so it can be found with find_mut
+pub struct Keyed<E> {
+    pub key: u64,
+    pub inner: E,
+}
+
+pub trait ElementExt: Element + Sized {
+    fn keyed(self, key: &str) -> Keyed<Self> {
+        Keyed {
+            key: hash_with(|h| key.hash(h)),
+            inner: self,
+        }
+    }
+
+    /// Render this subtree once into an offscreen layer and composite the
+    /// layer on later frames, until the subtree's properties or size change
+    fn cached(self) -> Cached<Self> {
+        Cached {
+            inner: self,
+            layer: RefCell::new(Layer::new()),
+        }
+    }
+}
+
+impl<E: Element + Sized> ElementExt for E {}
+
+/// A subtree drawn through an offscreen layer, see `ElementExt::cached`.
+/// Subtrees containing elements without a paint hash are drawn directly.
+pub struct Cached<E> {
+    pub inner: E,
+    layer: RefCell<Layer>,
+}
+
+impl<E: Element + 'static> Element for Cached<E> {
+    fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let bounds = layer::subtree_bounds(&self.inner, text_renderer);
+        let hash = match layer::subtree_hash(&self.inner) {
+            Some(hash) if layer::cacheable(&bounds) => hash,
+            _ => {
+                self.inner.render(canvas, text_renderer);
+                return;
+            }
+        };
+
+        if !canvas.is_damaged(&bounds) {
+            return;
+        }
+
+        let mut layer = self.layer.borrow_mut();
+        if !layer.is_valid(hash, bounds) {
+            layer.update(&self.inner, text_renderer, hash, bounds);
+        }
+        layer.composite(canvas);
+    }
+
+    fn bounds(&self) -> Rect {
+        self.inner.bounds()
+    }
+
+    fn key(&self) -> Option<u64> {
+        self.inner.key()
+    }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        self.inner.children()
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        self.inner.children_mut()
+    }
+
+    fn paint_hash(&self) -> Option<u64> {
+        self.inner.paint_hash()
+    }
+
+    fn paint_bounds(&self, text_renderer: &TextRenderer) -> Rect {
+        self.inner.paint_bounds(text_renderer)
+    }
+
+    fn opaque_rect(&self) -> Option<Rect> {
+        self.inner.opaque_rect()
+    }
+
+    fn translucent_rect(&self) -> Option<Rect> {
+        self.inner.translucent_rect()
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        self.inner.as_any_mut()
+    }
+}
+
+impl<E: Element + 'static> Element for Keyed<E> {
+    fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        self.inner.render(canvas, text_renderer);
+    }
+
+    fn bounds(&self) -> Rect {
+        self.inner.bounds()
+    }
+
+    fn key(&self) -> Option<u64> {
+        Some(self.key)
+    }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        self.inner.children()
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        self.inner.children_mut()
+    }
+
+    fn paint_hash(&self) -> Option<u64> {
+        self.inner.paint_hash()
+    }
+
+    fn paint_bounds(&self, text_renderer: &TextRenderer) -> Rect {
+        self.inner.paint_bounds(text_renderer)
+    }
+
+    fn opaque_rect(&self) -> Option<Rect> {
+        self.inner.opaque_rect()
+    }
+
+    fn translucent_rect(&self) -> Option<Rect> {
+        self.inner.translucent_rect()
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        self.inner.as_any_mut()
+    }
 }
 
 pub struct Container {
@@ -77,6 +411,7 @@ impl Container {
 
 impl Element for Container {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let _scope = profiler::scope("ui.Container");
         if let Some(radius) = self.corner_radius {
             if false { // shader effects disabled
             } else {
@@ -108,6 +443,34 @@ impl Element for Container {
     fn bounds(&self) -> Rect {
         self.rect.clone()
     }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        &self.children
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        &mut self.children
+    }
+
+    fn opaque_rect(&self) -> Option<Rect> {
+        opaque_fill(self.rect, self.background, None, self.corner_radius.unwrap_or(0.0))
+    }
+
+    fn translucent_rect(&self) -> Option<Rect> {
+        (self.background.a < 255).then_some(self.rect)
+    }
+
+    fn paint_hash(&self) -> Option<u64> {
+        Some(hash_with(|h| {
+            self.rect.hash(h);
+            self.background.hash(h);
+            self.corner_radius.map(f32::to_bits).hash(h);
+        }))
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
 }
 
 pub struct Text {
@@ -121,6 +484,8 @@ pub struct Text {
     pub shadow_offset: (i32, i32),
     pub shadow_color: Color,
     pub shadow_blur: i32,
+    // Run shaped by the last render, reused by bounds()
+    layout: RefCell<Option<Arc<TextRun>>>,
 }
 
 impl Text {
@@ -136,6 +501,23 @@ impl Text {
             shadow_offset: (2, 2),
             shadow_color: Color::rgba(0, 0, 0, 128),
             shadow_blur: 2,
+            layout: RefCell::new(None),
+        }
+    }
+
+    /// Replace the text in place, reusing the existing allocation
+    pub fn set_text(&mut self, text: &str) {
+        if self.text != text {
+            self.text.clear();
+            self.text.push_str(text);
+        }
+    }
+
+    /// Exact bounds from the shaped run (cached by the text renderer)
+    pub fn measured_bounds(&self, text_renderer: &TextRenderer) -> Rect {
+        match text_renderer.layout(&self.text, self.size, &self.font, None) {
+            Some(run) => Rect::new(self.x, self.y, run.width_px(), run.height_px()),
+            None => self.bounds(),
         }
     }
 
@@ -177,89 +559,96 @@ impl Text {
 
 impl Element for Text {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let _scope = profiler::scope("ui.Text");
+        // Shape once; the shadow passes and the main pass all reuse the run
+        let run = match text_renderer.layout(&self.text, self.size, &self.font, None) {
+            Some(run) => run,
+            None => {
+                eprintln!("Font '{}' not found", self.font);
+                return;
+            }
+        };
+
+        // Skip labels outside this frame's damage (shadow included)
+        let shadow_reach = self.shadow_offset.0.abs().max(self.shadow_offset.1.abs())
+            + shadow::spread(self.shadow_blur);
+        let extent = Rect::new(self.x, self.y, run.width_px(), run.height_px()).inflate(shadow_reach + 1);
+        if !canvas.is_damaged(&extent) {
+            *self.layout.borrow_mut() = Some(run);
+            return;
+        }
+
         // Render shadow first (behind the text) if enabled
         if self.shadow && self.shadow_blur > 0 {
-            // Proper box blur with horizontal and vertical passes
-            let blur_radius = self.shadow_blur.min(4); // Limit to 4 for performance
-            
-            // Box blur: uniform weight distribution
-            let weight = 1.0 / ((blur_radius * 2 + 1) as f32);
-            
-            // Horizontal pass
-            for dx in -blur_radius..=blur_radius {
-                let shadow_alpha = ((self.shadow_color.a as f32 * weight * 0.5).min(50.0)) as u8;
-                
-                if shadow_alpha > 1 {
-                    let blur_color = Color::rgba(
-                        self.shadow_color.r,
-                        self.shadow_color.g,
-                        self.shadow_color.b,
-                        shadow_alpha,
-                    );
-                    
-                    text_renderer.render(
-                        canvas,
-                        &self.text,
-                        self.x + self.shadow_offset.0 + dx,
-                        self.y + self.shadow_offset.1,
-                        self.size,
-                        blur_color,
-                        &self.font,
-                    );
-                }
-            }
-            
-            // Vertical pass
-            for dy in -blur_radius..=blur_radius {
-                if dy == 0 { continue; } // Skip center, already done in horizontal
-                
-                let shadow_alpha = ((self.shadow_color.a as f32 * weight * 0.5).min(50.0)) as u8;
-                
-                if shadow_alpha > 1 {
-                    let blur_color = Color::rgba(
-                        self.shadow_color.r,
-                        self.shadow_color.g,
-                        self.shadow_color.b,
-                        shadow_alpha,
-                    );
-                    
-                    text_renderer.render(
-                        canvas,
-                        &self.text,
-                        self.x + self.shadow_offset.0,
-                        self.y + self.shadow_offset.1 + dy,
-                        self.size,
-                        blur_color,
-                        &self.font,
-                    );
-                }
+            // The whole run blurred once and cached, blended in one pass
+            if let Some(mask) = text_renderer.shadow_mask(&run, &self.font, self.shadow_blur) {
+                canvas.draw_glyph(
+                    self.x + self.shadow_offset.0 + mask.xmin,
+                    self.y + self.shadow_offset.1 + mask.ymin,
+                    &mask,
+                    self.shadow_color,
+                );
             }
         } else if self.shadow {
             // Simple shadow without blur
-            text_renderer.render(
+            text_renderer.render_run(
                 canvas,
-                &self.text,
+                &run,
                 self.x + self.shadow_offset.0,
                 self.y + self.shadow_offset.1,
-                self.size,
                 self.shadow_color,
                 &self.font,
             );
         }
         
         // ALWAYS render main text on top - this is the foreground layer
-        text_renderer.render(
-            canvas, &self.text, self.x, self.y, self.size, self.color, &self.font,
-        );
+        text_renderer.render_run(canvas, &run, self.x, self.y, self.color, &self.font);
+
+        *self.layout.borrow_mut() = Some(run);
     }
 
     fn bounds(&self) -> Rect {
-        // Approximate bounds based on font size
-        // For more accurate bounds, we'd need access to text_renderer
+        if let Some(run) = self.layout.borrow().as_ref() {
+            if run.text == self.text {
+                return Rect::new(self.x, self.y, run.width_px(), run.height_px());
+            }
+        }
+
+        // Not rendered yet: approximate bounds based on font size.
+        // Use measured_bounds() when a text renderer is at hand.
         let approx_width = (self.text.len() as f32 * self.size * 0.6) as i32;
         let approx_height = (self.size * 1.2) as i32;
         Rect::new(self.x, self.y, approx_width, approx_height)
     }
+
+    fn paint_hash(&self) -> Option<u64> {
+        Some(hash_with(|h| {
+            self.text.hash(h);
+            (self.x, self.y).hash(h);
+            self.size.to_bits().hash(h);
+            self.color.hash(h);
+            self.font.hash(h);
+            self.shadow.hash(h);
+            self.shadow_offset.hash(h);
+            self.shadow_color.hash(h);
+            self.shadow_blur.hash(h);
+        }))
+    }
+
+    fn paint_bounds(&self, text_renderer: &TextRenderer) -> Rect {
+        let bounds = self.measured_bounds(text_renderer);
+        if !self.shadow {
+            return bounds;
+        }
+        let (dx, dy) = self.shadow_offset;
+        bounds
+            .union(&Rect::new(bounds.x + dx, bounds.y + dy, bounds.width, bounds.height))
+            .inflate(shadow::spread(self.shadow_blur) + 1)
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
 }
 
 pub struct VStack {
@@ -292,6 +681,7 @@ impl VStack {
 
 impl Element for VStack {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let _scope = profiler::scope("ui.VStack");
         for child in &self.children {
             child.render(canvas, text_renderer);
         }
@@ -312,18 +702,40 @@ impl Element for VStack {
 
         Rect::new(self.x, self.y, max_width, total_height)
     }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        &self.children
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        &mut self.children
+    }
+
+    fn paint_hash(&self) -> Option<u64> {
+        // Paints nothing itself; children are diffed on their own
+        Some(hash_with(|h| (self.x, self.y, self.spacing).hash(h)))
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
 }
 
 // Div - A flexible container element (like HTML div)
 pub struct Div {
     pub rect: Rect,
-    pub background: Color,
+    // Private so that changing them goes through the setters, which
+    // rebuild `gradient_fill`
+    background: Color,
     pub border_color: Option<Color>,
     pub border_width: i32,
     pub shadow: bool,
     pub shadow_blur: i32,
     pub corner_radius: f32,
-    pub gradient: Option<(Color, f32)>,
+    gradient: Option<(Color, f32)>,
+    // Built from `background` and `gradient` when either is set, so
+    // painting shares one lookup table
+    gradient_fill: Option<Arc<Gradient>>,
     pub children: Vec<Box<dyn Element>>,
 }
 
@@ -338,20 +750,33 @@ impl Div {
             shadow_blur: 0,
             corner_radius: 0.0,
             gradient: None,
+            gradient_fill: None,
             children: Vec::new(),
         }
     }
 
     pub fn background(mut self, color: Color) -> Self {
-        self.background = color;
+        self.set_background(color);
         self
     }
 
     pub fn gradient(mut self, end_color: Color, angle: f32) -> Self {
-        self.gradient = Some((end_color, angle));
+        self.set_gradient(Some((end_color, angle)));
         self
     }
 
+    /// Change the background (the gradient's start color) after building
+    pub fn set_background(&mut self, color: Color) {
+        self.background = color;
+        self.gradient_fill = two_color_gradient(self.background, self.gradient);
+    }
+
+    /// Change or remove the gradient after building
+    pub fn set_gradient(&mut self, gradient: Option<(Color, f32)>) {
+        self.gradient = gradient;
+        self.gradient_fill = two_color_gradient(self.background, self.gradient);
+    }
+
     pub fn rounded(mut self, radius: f32) -> Self {
         self.corner_radius = radius;
         self
@@ -386,6 +811,7 @@ impl Div {
 
 impl Element for Div {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let _scope = profiler::scope("ui.Div");
         // Draw shadow first (behind the div) with proper blur
         if self.shadow && self.shadow_blur > 0 {
             if self.corner_radius > 0.0 {
@@ -411,60 +837,15 @@ impl Element for Div {
         }
 
         // Draw div background with effects
-        if let Some((end_color, angle)) = self.gradient {
-            if self.corner_radius > 0.0 {
-                // For gradients with rounded corners, draw gradient then mask
-                canvas.fill_gradient_rect(
-                    self.rect.x,
-                    self.rect.y,
-                    self.rect.width,
-                    self.rect.height,
-                    self.background,
-                    end_color,
-                    angle,
-                );
-                // Redraw rounded rect to clip corners
-                canvas.fill_rounded_rect(
-                    self.rect.x,
-                    self.rect.y,
-                    self.rect.width,
-                    self.rect.height,
-                    self.corner_radius,
-                    Color::TRANSPARENT,
-                );
-            } else {
-                canvas.fill_gradient_rect(
-                    self.rect.x,
-                    self.rect.y,
-                    self.rect.width,
-                    self.rect.height,
-                    self.background,
-                    end_color,
-                    angle,
-                );
-            }
-        } else if self.background.a > 0 {
-            // Only draw background if not transparent
-            canvas.fill_rounded_rect(
-                self.rect.x,
-                self.rect.y,
-                self.rect.width,
-                self.rect.height,
-                self.corner_radius,
-                self.background,
-            );
+        if let Some(gradient) = &self.gradient_fill {
+            canvas.fill_gradient(self.rect, CornerRadii::all(self.corner_radius), gradient);
         }
 
-        // Draw border if enabled
-        if let Some(border_color) = self.border_color {
-            canvas.draw_rect(
-                self.rect.x,
-                self.rect.y,
-                self.rect.width,
-                self.rect.height,
-                border_color,
-                self.border_width,
-            );
+        // Background (only if not transparent) and border in one pass
+        let fill = (self.gradient.is_none() && self.background.a > 0).then_some(self.background);
+        let border = self.border_color.map(|color| Border::new(self.border_width as f32, color));
+        if fill.is_some() || border.is_some() {
+            canvas.draw_rounded_rect(self.rect, CornerRadii::all(self.corner_radius), fill, border);
         }
 
         // Render children
@@ -476,20 +857,69 @@ impl Element for Div {
     fn bounds(&self) -> Rect {
         self.rect.clone()
     }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        &self.children
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        &mut self.children
+    }
+
+    fn opaque_rect(&self) -> Option<Rect> {
+        opaque_fill(
+            inside_border(self.rect, self.border_color, self.border_width),
+            self.background,
+            self.gradient.map(|g| g.0),
+            self.corner_radius,
+        )
+    }
+
+    fn translucent_rect(&self) -> Option<Rect> {
+        let translucent = match self.gradient {
+            Some((end, _)) => self.background.a < 255 || end.a < 255,
+            // Fully transparent backgrounds aren't drawn at all
+            None => self.background.a > 0 && self.background.a < 255,
+        };
+        let border = self.border_color.map_or(false, |c| c.a < 255);
+        (translucent || border).then_some(self.rect)
+    }
+
+    fn paint_hash(&self) -> Option<u64> {
+        Some(hash_with(|h| {
+            self.rect.hash(h);
+            self.background.hash(h);
+            self.border_color.hash(h);
+            self.border_width.hash(h);
+            self.shadow.hash(h);
+            self.shadow_blur.hash(h);
+            self.corner_radius.to_bits().hash(h);
+            self.gradient.map(|(c, a)| (c, a.to_bits())).hash(h);
+        }))
+    }
+
+    fn paint_bounds(&self, _text_renderer: &TextRenderer) -> Rect {
+        with_shadow(self.rect, self.shadow, self.shadow_blur)
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
 }
 
 // Card - Deprecated, use Div instead
 // Kept for backward compatibility
 pub struct Card {
     pub rect: Rect,
-    pub background: Color,
+    background: Color,
     pub border_color: Option<Color>,
     pub border_width: i32,
     pub shadow: bool,
     pub shadow_blur: i32,
     pub corner_radius: f32,
     // shader_effect removed - using software rendering only
-    pub gradient: Option<(Color, f32)>,
+    gradient: Option<(Color, f32)>,
+    gradient_fill: Option<Arc<Gradient>>,
     pub children: Vec<Box<dyn Element>>,
 }
 
@@ -505,20 +935,33 @@ impl Card {
             corner_radius: 12.0,
             // shader_effect: None,
             gradient: None,
+            gradient_fill: None,
             children: Vec::new(),
         }
     }
 
     pub fn background(mut self, color: Color) -> Self {
-        self.background = color;
+        self.set_background(color);
         self
     }
 
     pub fn gradient(mut self, end_color: Color, angle: f32) -> Self {
-        self.gradient = Some((end_color, angle));
+        self.set_gradient(Some((end_color, angle)));
         self
     }
 
+    /// Change the background (the gradient's start color) after building
+    pub fn set_background(&mut self, color: Color) {
+        self.background = color;
+        self.gradient_fill = two_color_gradient(self.background, self.gradient);
+    }
+
+    /// Change or remove the gradient after building
+    pub fn set_gradient(&mut self, gradient: Option<(Color, f32)>) {
+        self.gradient = gradient;
+        self.gradient_fill = two_color_gradient(self.background, self.gradient);
+    }
+
     pub fn rounded(mut self, radius: f32) -> Self {
         self.corner_radius = radius;
         self
@@ -592,44 +1035,11 @@ impl Card {
         self.children.push(Box::new(element));
         self
     }
-
-    // Helper to apply rounded corner mask by clearing corners
-    fn apply_rounded_mask(&self, canvas: &mut Canvas) {
-        let radius = self.corner_radius as i32;
-        let x = self.rect.x;
-        let y = self.rect.y;
-        let width = self.rect.width;
-        let height = self.rect.height;
-
-        // Clear corners to create rounded effect
-        for corner_x in [x, x + width - radius] {
-            for corner_y in [y, y + height - radius] {
-                for dy in 0..radius {
-                    for dx in 0..radius {
-                        let center_x = if corner_x == x { radius } else { 0 };
-                        let center_y = if corner_y == y { radius } else { 0 };
-
-                        let dist = (((dx - center_x) * (dx - center_x)
-                            + (dy - center_y) * (dy - center_y))
-                            as f32)
-                            .sqrt();
-                        let radius_f = radius as f32;
-
-                        // Clear pixels outside the rounded corner
-                        if dist > radius_f {
-                            let px = corner_x + dx;
-                            let py = corner_y + dy;
-                            canvas.set_pixel(px, py, Color::BG_PRIMARY);
-                        }
-                    }
-                }
-            }
-        }
-    }
 }
 
 impl Element for Card {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let _scope = profiler::scope("ui.Card");
         // Draw shadow first (behind the card) with proper blur
         if self.shadow {
             if self.corner_radius > 0.0 {
@@ -655,30 +1065,8 @@ impl Element for Card {
         }
 
         // Draw card background with effects
-        if let Some((end_color, angle)) = self.gradient {
-            if self.corner_radius > 0.0 {
-                // For gradients with rounded corners, draw gradient then mask
-                canvas.fill_gradient_rect(
-                    self.rect.x,
-                    self.rect.y,
-                    self.rect.width,
-                    self.rect.height,
-                    self.background,
-                    end_color,
-                    angle,
-                );
-                self.apply_rounded_mask(canvas);
-            } else {
-                canvas.fill_gradient_rect(
-                    self.rect.x,
-                    self.rect.y,
-                    self.rect.width,
-                    self.rect.height,
-                    self.background,
-                    end_color,
-                    angle,
-                );
-            }
+        if let Some(gradient) = &self.gradient_fill {
+            canvas.fill_gradient(self.rect, CornerRadii::all(self.corner_radius), gradient);
         } else if false { // shader effects disabled
             if self.corner_radius > 0.0 {
                 // For effects with rounded corners:
@@ -696,27 +1084,13 @@ impl Element for Card {
                 );
             } else {
             }
-        } else {
-            canvas.fill_rounded_rect(
-                self.rect.x,
-                self.rect.y,
-                self.rect.width,
-                self.rect.height,
-                self.corner_radius,
-                self.background,
-            );
         }
 
-        // Draw border if enabled
-        if let Some(border_color) = self.border_color {
-            canvas.draw_rect(
-                self.rect.x,
-                self.rect.y,
-                self.rect.width,
-                self.rect.height,
-                border_color,
-                self.border_width,
-            );
+        // Background and border in one pass
+        let fill = self.gradient.is_none().then_some(self.background);
+        let border = self.border_color.map(|color| Border::new(self.border_width as f32, color));
+        if fill.is_some() || border.is_some() {
+            canvas.draw_rounded_rect(self.rect, CornerRadii::all(self.corner_radius), fill, border);
         }
 
         // Render children
@@ -728,6 +1102,50 @@ impl Element for Card {
     fn bounds(&self) -> Rect {
         self.rect.clone()
     }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        &self.children
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        &mut self.children
+    }
+
+    fn opaque_rect(&self) -> Option<Rect> {
+        opaque_fill(
+            inside_border(self.rect, self.border_color, self.border_width),
+            self.background,
+            self.gradient.map(|g| g.0),
+            self.corner_radius,
+        )
+    }
+
+    fn translucent_rect(&self) -> Option<Rect> {
+        let end_alpha = self.gradient.map_or(255, |g| g.0.a);
+        let border_alpha = self.border_color.map_or(255, |c| c.a);
+        (self.background.a < 255 || end_alpha < 255 || border_alpha < 255).then_some(self.rect)
+    }
+
+    fn paint_hash(&self) -> Option<u64> {
+        Some(hash_with(|h| {
+            self.rect.hash(h);
+            self.background.hash(h);
+            self.border_color.hash(h);
+            self.border_width.hash(h);
+            self.shadow.hash(h);
+            self.shadow_blur.hash(h);
+            self.corner_radius.to_bits().hash(h);
+            self.gradient.map(|(c, a)| (c, a.to_bits())).hash(h);
+        }))
+    }
+
+    fn paint_bounds(&self, _text_renderer: &TextRenderer) -> Rect {
+        with_shadow(self.rect, self.shadow, self.shadow_blur)
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
 }
 
 // Builder functions for ergonomic API
@@ -752,19 +1170,14 @@ pub fn vstack(x: i32, y: i32) -> VStack {
     VStack::new(x, y)
 }
 
-// SVG icon assets embedded at compile time
-const SVG_MINIMIZE: &str = include_str!("../assets/ui_minimize.svg");
-const SVG_MAXIMIZE: &str = include_str!("../assets/ui_maximize.svg");
-const SVG_RESTORE: &str = include_str!("../assets/ui_restore.svg");
-const SVG_QUIT: &str = include_str!("../assets/ui_quit.svg");
-
 pub struct Titlebar {
     pub rect: Rect,
     pub title: String,
-    pub background: Color,
+    background: Color,
     pub show_controls: bool,
     // shader_effect removed - using software rendering only
-    pub gradient: Option<(Color, f32)>,
+    gradient: Option<(Color, f32)>,
+    gradient_fill: Option<Arc<Gradient>>,
 }
 
 impl Titlebar {
@@ -776,19 +1189,32 @@ impl Titlebar {
             show_controls: true,
             // shader_effect: None,
             gradient: None,
+            gradient_fill: None,
         }
     }
 
     pub fn background(mut self, color: Color) -> Self {
-        self.background = color;
+        self.set_background(color);
         self
     }
 
     pub fn gradient(mut self, end_color: Color, angle: f32) -> Self {
-        self.gradient = Some((end_color, angle));
+        self.set_gradient(Some((end_color, angle)));
         self
     }
 
+    /// Change the background (the gradient's start color) after building
+    pub fn set_background(&mut self, color: Color) {
+        self.background = color;
+        self.gradient_fill = two_color_gradient(self.background, self.gradient);
+    }
+
+    /// Change or remove the gradient after building
+    pub fn set_gradient(&mut self, gradient: Option<(Color, f32)>) {
+        self.gradient = gradient;
+        self.gradient_fill = two_color_gradient(self.background, self.gradient);
+    }
+
 
     pub fn blur(mut self, radius: f32) -> Self {
         // self.shader_effect = Some(ShaderEffect::blur(radius));
@@ -817,15 +1243,7 @@ impl Titlebar {
         let icon_x = x + (32 - icon_size) / 2;
         let icon_y = y + (self.rect.height - icon_size) / 2;
 
-        Self::render_svg(
-            canvas,
-            SVG_MINIMIZE,
-            icon_x,
-            icon_y,
-            icon_size as u32,
-            icon_size as u32,
-            color,
-        );
+        Self::draw_icon(canvas, icons::MINIMIZE, icon_x, icon_y, icon_size as u32, color);
     }
 
     fn draw_maximize_button(&self, canvas: &mut Canvas, x: i32, y: i32, hovered: bool) {
@@ -840,15 +1258,7 @@ impl Titlebar {
         let icon_x = x + (32 - icon_size) / 2;
         let icon_y = y + (self.rect.height - icon_size) / 2;
 
-        Self::render_svg(
-            canvas,
-            SVG_MAXIMIZE,
-            icon_x,
-            icon_y,
-            icon_size as u32,
-            icon_size as u32,
-            color,
-        );
+        Self::draw_icon(canvas, icons::MAXIMIZE, icon_x, icon_y, icon_size as u32, color);
     }
 
     fn draw_close_button(&self, canvas: &mut Canvas, x: i32, y: i32, hovered: bool) {
@@ -863,117 +1273,23 @@ impl Titlebar {
         let icon_x = x + (32 - icon_size) / 2;
         let icon_y = y + (self.rect.height - icon_size) / 2;
 
-        Self::render_svg(
-            canvas,
-            SVG_QUIT,
-            icon_x,
-            icon_y,
-            icon_size as u32,
-            icon_size as u32,
-            color,
-        );
+        Self::draw_icon(canvas, icons::QUIT, icon_x, icon_y, icon_size as u32, color);
     }
 
-    fn render_svg(
-        canvas: &mut Canvas,
-        svg_data: &str,
-        x: i32,
-        y: i32,
-        width: u32,
-        height: u32,
-        color: Color,
-    ) {
-        use resvg::usvg;
-        use tiny_skia::{Pixmap, Transform};
-
-        // Parse SVG
-        let opt = usvg::Options::default();
-        let tree = match usvg::Tree::from_str(svg_data, &opt) {
-            Ok(tree) => tree,
-            Err(_) => return,
-        };
-
-        // Create pixmap for rendering at higher resolution for better quality
-        let scale_factor = 2.0; // Render at 2x for better antialiasing
-        let render_width = (width as f32 * scale_factor) as u32;
-        let render_height = (height as f32 * scale_factor) as u32;
-
-        let mut pixmap = match Pixmap::new(render_width, render_height) {
-            Some(p) => p,
-            None => return,
-        };
-
-        // Calculate scale to fit SVG into target size
-        let svg_size = tree.size();
-        let scale_x = render_width as f32 / svg_size.width();
-        let scale_y = render_height as f32 / svg_size.height();
-        let scale = scale_x.min(scale_y);
-
-        // Create transform for scaling
-        let transform = Transform::from_scale(scale, scale);
-
-        // Render SVG to pixmap with scaling
-        resvg::render(&tree, transform, &mut pixmap.as_mut());
-
-        // Downsample and copy to canvas with proper alpha blending
-        let pixels = pixmap.data();
-        for py in 0..height {
-            for px in 0..width {
-                // Sample from the higher resolution pixmap (simple box filter)
-                let src_x = (px as f32 * scale_factor) as u32;
-                let src_y = (py as f32 * scale_factor) as u32;
-
-                // Average 2x2 samples for antialiasing
-                let mut r_sum = 0u32;
-                let mut g_sum = 0u32;
-                let mut b_sum = 0u32;
-                let mut a_sum = 0u32;
-                let mut count = 0u32;
-
-                for dy in 0..2 {
-                    for dx in 0..2 {
-                        let sample_x = src_x + dx;
-                        let sample_y = src_y + dy;
-                        if sample_x < render_width && sample_y < render_height {
-                            let idx = ((sample_y * render_width + sample_x) * 4) as usize;
-                            if idx + 3 < pixels.len() {
-                                r_sum += pixels[idx] as u32;
-                                g_sum += pixels[idx + 1] as u32;
-                                b_sum += pixels[idx + 2] as u32;
-                                a_sum += pixels[idx + 3] as u32;
-                                count += 1;
-                            }
-                        }
-                    }
-                }
-
-                if count > 0 && a_sum > 0 {
-                    let avg_alpha = (a_sum / count) as u8;
-
-                    // Apply color tint to white SVG
-                    let tinted = Color::rgba(color.r, color.g, color.b, avg_alpha);
-
-                    // Use blend_pixel for proper alpha compositing
-                    canvas.blend_pixel(x + px as i32, y + py as i32, tinted);
-                }
-            }
+    fn draw_icon(canvas: &mut Canvas, id: &str, x: i32, y: i32, size: u32, color: Color) {
+        // Cached coverage, tinted as it is blended
+        if let Some(mask) = icons::mask(id, size, size, 1) {
+            canvas.draw_glyph(x, y, &mask, color);
         }
     }
 }
 
 impl Element for Titlebar {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let _scope = profiler::scope("ui.Titlebar");
         // Draw titlebar background with effects
-        if let Some((end_color, angle)) = self.gradient {
-            canvas.fill_gradient_rect(
-                self.rect.x,
-                self.rect.y,
-                self.rect.width,
-                self.rect.height,
-                self.background,
-                end_color,
-                angle,
-            );
+        if let Some(gradient) = &self.gradient_fill {
+            canvas.fill_gradient(self.rect, CornerRadii::default(), gradient);
         } else if false { // shader effects disabled
         } else {
             canvas.fill_rect(
@@ -1032,6 +1348,29 @@ impl Element for Titlebar {
     fn bounds(&self) -> Rect {
         self.rect.clone()
     }
+
+    fn opaque_rect(&self) -> Option<Rect> {
+        opaque_fill(self.rect, self.background, self.gradient.map(|g| g.0), 0.0)
+    }
+
+    fn translucent_rect(&self) -> Option<Rect> {
+        let end_alpha = self.gradient.map_or(255, |g| g.0.a);
+        (self.background.a < 255 || end_alpha < 255).then_some(self.rect)
+    }
+
+    fn paint_hash(&self) -> Option<u64> {
+        Some(hash_with(|h| {
+            self.rect.hash(h);
+            self.title.hash(h);
+            self.background.hash(h);
+            self.show_controls.hash(h);
+            self.gradient.map(|(c, a)| (c, a.to_bits())).hash(h);
+        }))
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
 }
 
 pub fn titlebar(width: i32, title: impl Into<String>) -> Titlebar {
@@ -1116,6 +1455,7 @@ impl ShaderCard {
 
 impl Element for ShaderCard {
     fn render(&self, canvas: &mut Canvas, text_renderer: &TextRenderer) {
+        let _scope = profiler::scope("ui.ShaderCard");
         // Draw shadow first
         if self.shadow {
             canvas.draw_shadow(
@@ -1152,4 +1492,72 @@ impl Element for ShaderCard {
     fn bounds(&self) -> Rect {
         self.rect.clone()
     }
+
+    fn children(&self) -> &[Box<dyn Element>] {
+        &self.children
+    }
+
+    fn children_mut(&mut self) -> &mut [Box<dyn Element>] {
+        &mut self.children
+    }
+
+    fn paint_bounds(&self, _text_renderer: &TextRenderer) -> Rect {
+        with_shadow(self.rect, self.shadow, self.shadow_blur)
+    }
+
+    fn as_any_mut(&mut self) -> Option<&mut dyn Any> {
+        Some(self)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::core::retained::RetainedTree;
+
+    #[test]
+    fn find_mut_sees_through_wrappers() {
+        let mut tree = RetainedTree::new();
+        tree.set_root(
+            div(0, 0, 100, 20)
+                .child(text("a", 0, 0).keyed("keyed"))
+                .child(text("b", 0, 0).keyed("keyed-cached").cached())
+                .child(text("c", 0, 0).cached().keyed("cached-keyed")),
+        );
+        for key in ["keyed", "keyed-cached", "cached-keyed"] {
+            let found = tree.find_mut::<Text>(key);
+            assert!(found.is_some(), "{} not found as Text", key);
+            found.unwrap().set_text(key);
+        }
+        assert!(tree.find_mut::<Div>("keyed").is_none());
+    }
+
+    #[test]
+    fn subtract_covers_exactly_the_difference() {
+        // Every placement of `other` around and inside a fixed rect,
+        // including disjoint, touching and covering ones
+        let rect = Rect::new(4, 4, 8, 6);
+        for y in 0..16 {
+            for x in 0..18 {
+                for (w, h) in [(0, 3), (1, 1), (3, 2), (5, 9), (20, 20)] {
+                    let other = Rect::new(x - 2, y - 2, w, h);
+                    let parts: Vec<Rect> = rect.subtract(&other).collect();
+                    assert!(parts.len() <= 4);
+                    for (i, a) in parts.iter().enumerate() {
+                        assert!(!a.is_empty());
+                        for b in &parts[i + 1..] {
+                            assert!(!a.intersects(b), "{:?} - {:?}: parts overlap", rect, other);
+                        }
+                    }
+                    for py in 0..20 {
+                        for px in 0..20 {
+                            let expected = rect.contains_point(px, py) && !other.contains_point(px, py);
+                            let actual = parts.iter().any(|p| p.contains_point(px, py));
+                            assert_eq!(actual, expected, "{:?} - {:?} at ({}, {})", rect, other, px, py);
+                        }
+                    }
+                }
+            }
+        }
+    }
 }
@@ -1,8 +1,15 @@
 use smithay_client_toolkit::{
-    compositor::{CompositorHandler, CompositorState},
+    compositor::{CompositorHandler, CompositorState, Region},
     delegate_compositor, delegate_output, delegate_pointer, delegate_registry, delegate_seat,
     delegate_shm, delegate_xdg_shell, delegate_xdg_window,
     output::{OutputHandler, OutputState},
+    reexports::{
+        calloop::{
+            timer::{TimeoutAction, Timer},
+            EventLoop, LoopHandle, RegistrationToken,
+        },
+        calloop_wayland_source::WaylandSource,
+    },
     registry::{ProvidesRegistryState, RegistryState},
     registry_handlers,
     seat::{
@@ -16,25 +23,32 @@ use smithay_client_toolkit::{
         },
         WaylandSurface,
     },
-    shm::{slot::SlotPool, Shm, ShmHandler},
+    shm::{Shm, ShmHandler},
 };
 use wayland_client::{
     globals::registry_queue_init,
-    protocol::{wl_output, wl_pointer, wl_seat, wl_shm, wl_surface},
-    Connection, EventQueue, QueueHandle,
+    protocol::{wl_output, wl_pointer, wl_seat, wl_surface},
+    Connection, Dispatch, QueueHandle,
+};
+use wayland_protocols::wp::presentation_time::client::{
+    wp_presentation::{self, WpPresentation},
+    wp_presentation_feedback::{self, WpPresentationFeedback},
+};
+use wayland_protocols::wp::viewporter::client::{
+    wp_viewport::{self, WpViewport},
+    wp_viewporter::{self, WpViewporter},
 };
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 
 use crate::core::canvas::Canvas;
 use crate::core::color::Color;
-
-// Debug logging macro
-macro_rules! debug_log {
-    ($($arg:tt)*) => {
-        if std::env::var("MOCHI_DEBUG").is_ok() {
-            eprintln!("[MOCHI DEBUG] {}", format!($($arg)*));
-        }
-    };
-}
+use crate::core::damage::{DamageRegion, MAX_RECTS};
+use crate::core::display_list::{DisplayList, RecordingCanvas};
+use crate::core::profiler;
+use crate::core::stretch::{stretch, ScaleFilter};
+use crate::core::swapchain::{copy_rect, Swapchain};
+use crate::core::tiles::TiledRenderer;
+use crate::core::ui::Rect;
 
 pub struct WindowConfig {
     pub title: String,
@@ -45,6 +59,30 @@ pub struct WindowConfig {
     pub decorations: bool,
     pub transparent: bool,
     pub draggable: bool,
+    pub resize_mode: ResizeMode,
+}
+
+/// What the window shows while it is being resized, until the full redraw
+/// once resizing pauses
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum ResizeMode {
+    /// Flat background. Cheapest, but the content blinks out.
+    Fill,
+    /// The last full frame, scaled by the compositor through wp_viewporter,
+    /// or stretched on the CPU with `filter` where that isn't available
+    Scale { filter: ScaleFilter },
+    /// Render every step for real while the last full render took at most
+    /// `budget`, and scale as above otherwise
+    Budgeted { budget: Duration, filter: ScaleFilter },
+}
+
+impl Default for ResizeMode {
+    fn default() -> Self {
+        ResizeMode::Budgeted {
+            budget: Duration::from_millis(8),
+            filter: ScaleFilter::Bilinear,
+        }
+    }
 }
 
 impl Default for WindowConfig {
@@ -58,35 +96,86 @@ impl Default for WindowConfig {
             decorations: false, // Use client-side decorations
             transparent: false,
             draggable: true,
+            resize_mode: ResizeMode::default(),
         }
     }
 }
 
-struct AppState {
+// A fully rendered frame kept to be scaled while resizing
+struct Snapshot {
+    pixels: Vec<u8>,
+    width: u32,
+    height: u32,
+}
+
+// Frame pacing. Invalidating only marks the window dirty; it is drawn
+// after the current batch of events, and never again before the compositor
+// signals (with a frame callback) that the previous frame is on screen. Any
+// number of invalidations between two callbacks cost one draw, and an idle
+// window doesn't wake up at all.
+#[derive(Default)]
+struct FrameScheduler {
+    dirty: bool,
+    // A frame callback is outstanding
+    waiting: bool,
+    drawn: u64,
+}
+
+/// Window state, handed to the callbacks of event sources registered
+/// through `Window::loop_handle`
+pub struct AppState {
     registry_state: RegistryState,
     output_state: OutputState,
     compositor_state: CompositorState,
     shm_state: Shm,
     xdg_shell_state: XdgShell,
     seat_state: SeatState,
-    pool: Option<SlotPool>,
+    // Created on the first configure
+    swapchain: Option<Swapchain>,
     window: Option<XdgWindow>,
     width: u32,
     height: u32,
     draw_fn: Option<Box<dyn FnMut(&mut Canvas)>>,
     pointer_location: Option<(f64, f64)>,
-    is_resizing: bool,
-    last_resize_time: std::time::Instant,
     resize_debounce_ms: u64,
-    // Buffer pooling optimization
-    last_buffer_size: Option<(u32, u32)>,
+    // Fires once resizing has paused; restarted by every resize step
+    resize_timer: Option<RegistrationToken>,
+    loop_handle: LoopHandle<'static, AppState>,
+    resize_mode: ResizeMode,
+    // Render time of the last full draw, weighed against the resize budget
+    last_full_draw: Duration,
+    // Source of the CPU-stretched resize preview
+    resize_source: Option<Snapshot>,
+    // Absent if the compositor has no wp_viewporter
+    viewporter: Option<WpViewporter>,
+    viewport: Option<WpViewport>,
+    // The compositor is scaling the attached buffer to the window size
+    viewport_scaled: bool,
+    // The attached buffer holds a full render, not a preview
+    presented_full: bool,
+    // Bound only while profiling, for present latency
+    presentation: Option<WpPresentation>,
+    // Last rendered frame; partial redraws paint over it
+    frame: Vec<u8>,
+    frame_size: (u32, u32),
+    // The frame holds a full render, not a preview
+    frame_is_full: bool,
+    // Damage carried into the next draw (first frame, resize)
+    pending_damage: DamageRegion,
+    // Draw calls are recorded here and rasterized in parallel bands
+    display_list: DisplayList,
+    tiles: TiledRenderer,
+    // Last opaque region sent to the compositor
+    opaque_region: Vec<Rect>,
+    frames: FrameScheduler,
     // Window configuration
     transparent: bool,
     draggable: bool,
 }
 
 pub struct Window {
-    event_queue: EventQueue<AppState>,
+    event_loop: EventLoop<'static, AppState>,
+    qh: QueueHandle<AppState>,
     state: AppState,
 }
 
@@ -97,7 +186,6 @@ impl Window {
         // Force LLVMpipe software rendering
         std::env::set_var("LIBGL_ALWAYS_SOFTWARE", "1");
         std::env::set_var("GALLIUM_DRIVER", "llvmpipe");
-        std::env::set_var("LP_NUM_THREADS", "4"); // Use 4 threads for better performance
         
         // Log renderer info
         let renderer = std::env::var("GALLIUM_DRIVER").unwrap_or_else(|_| "unknown".to_string());
@@ -113,6 +201,10 @@ impl Window {
         
         let qh = event_queue.handle();
 
+        // Wayland events are one source among the loop's timers and whatever
+        // the app registers
+        let event_loop = EventLoop::<AppState>::try_new()?;
+
         debug_log!("Binding Wayland protocols...");
         let state = AppState {
             registry_state: RegistryState::new(&globals),
@@ -121,26 +213,53 @@ impl Window {
             shm_state: Shm::bind(&globals, &qh)?,
             xdg_shell_state: XdgShell::bind(&globals, &qh)?,
             seat_state: SeatState::new(&globals, &qh),
-            pool: None,
+            swapchain: None,
             window: None,
             width: config.width,
             height: config.height,
             draw_fn: None,
             pointer_location: None,
-            is_resizing: false,
-            last_resize_time: std::time::Instant::now(),
             resize_debounce_ms: 150, // Wait 150ms after resize before full redraw
-            last_buffer_size: None,
+            resize_timer: None,
+            loop_handle: event_loop.handle(),
+            resize_mode: config.resize_mode,
+            last_full_draw: Duration::ZERO,
+            resize_source: None,
+            viewporter: globals.bind(&qh, 1..=1, ()).ok(),
+            viewport: None,
+            viewport_scaled: false,
+            presented_full: false,
+            presentation: if profiler::enabled() {
+                globals.bind(&qh, 1..=1, ()).ok()
+            } else {
+                None
+            },
+            frame: Vec::new(),
+            frame_size: (0, 0),
+            frame_is_full: false,
+            pending_damage: DamageRegion::new(),
+            display_list: DisplayList::new(),
+            tiles: TiledRenderer::new(),
+            opaque_region: Vec::new(),
+            frames: FrameScheduler::default(),
             transparent: config.transparent,
             draggable: config.draggable,
         };
         debug_log!("Wayland protocols bound successfully");
 
-        let mut window = Self { event_queue, state };
+        WaylandSource::new(conn, event_queue)
+            .insert(event_loop.handle())
+            .map_err(|e| e.error)?;
+        let mut window = Self { event_loop, qh, state };
 
-        let qh = window.event_queue.handle();
+        let qh = window.qh.clone();
         debug_log!("Creating surface...");
         let surface = window.state.compositor_state.create_surface(&qh);
+        if let Some(viewporter) = &window.state.viewporter {
+            window.state.viewport = Some(viewporter.get_viewport(&surface, &qh, ()));
+        } else {
+            debug_log!("No wp_viewporter, resize previews are stretched on the CPU");
+        }
 
         // Use client-side decorations for custom titlebar dragging
         let decorations = WindowDecorations::RequestClient;
@@ -178,6 +297,28 @@ impl Window {
         self.state.draw_fn = Some(Box::new(f));
     }
 
+    /// The window's event loop. Timers, channels, fds and signals inserted
+    /// here are dispatched on the UI thread, between frames; call
+    /// `AppState::request_redraw` from their callbacks to show a change.
+    pub fn loop_handle(&self) -> LoopHandle<'static, AppState> {
+        self.event_loop.handle()
+    }
+
+    /// Redraw each time the wall clock crosses a multiple of `period`, such
+    /// as every minute on the minute for a clock. The window sleeps in
+    /// between.
+    pub fn redraw_every(&mut self, period: Duration) -> Result<(), Box<dyn std::error::Error>> {
+        let timer = Timer::from_deadline(next_boundary(period));
+        self.event_loop
+            .handle()
+            .insert_source(timer, move |_, _, state| {
+                state.request_redraw();
+                TimeoutAction::ToInstant(next_boundary(period))
+            })
+            .map_err(|e| e.error)?;
+        Ok(())
+    }
+
     pub fn run(mut self) -> Result<(), Box<dyn std::error::Error>> {
         debug_log!("Entering main event loop");
         debug_log!("=== Mochi Window System ===");
@@ -186,40 +327,95 @@ impl Window {
         debug_log!("Resolution: {}x{}", self.state.width, self.state.height);
         debug_log!("===========================");
         
-        let mut frame_count = 0u64;
-        let start_time = std::time::Instant::now();
-        
         loop {
-            self.event_queue.blocking_dispatch(&mut self.state)?;
-            
-            // Check if we need to trigger a delayed full redraw after resize
-            if self.state.is_resizing {
-                let elapsed = self.state.last_resize_time.elapsed();
-                if elapsed.as_millis() >= self.state.resize_debounce_ms as u128 {
-                    debug_log!("Triggering delayed full redraw after resize");
-                    self.state.is_resizing = false;
-                    if let Some(window) = &self.state.window {
-                        let qh = self.event_queue.handle();
-                        self.state.draw(&qh, false);
-                    }
-                }
-            }
-            
-            frame_count += 1;
-            if frame_count % 60 == 0 {
-                let elapsed = start_time.elapsed().as_secs_f64();
-                let fps = frame_count as f64 / elapsed;
-                debug_log!("Frame {}: {:.1} FPS, Size: {}x{}", 
-                          frame_count, fps, self.state.width, self.state.height);
+            // Sleeps until a Wayland event or another source is ready
+            self.event_loop.dispatch(None, &mut self.state)?;
+
+            // Everything invalidated by this batch of events is drawn at once
+            let frames = &self.state.frames;
+            if frames.dirty && !frames.waiting {
+                self.state.draw(&self.qh, false);
             }
         }
     }
 }
 
+// The next time the wall clock is a whole multiple of `period`
+fn next_boundary(period: Duration) -> Instant {
+    let period = period.as_nanos().max(1);
+    let now = SystemTime::now().duration_since(UNIX_EPOCH).unwrap_or_default();
+    let remaining = period - now.as_nanos() % period;
+    Instant::now() + Duration::from_nanos(remaining as u64)
+}
+
 impl AppState {
-    fn draw(&mut self, _qh: &QueueHandle<Self>, skip_expensive: bool) {
+    /// Draw again once the compositor is ready for a new frame
+    pub fn request_redraw(&mut self) {
+        self.frames.dirty = true;
+    }
+
+    /// Surface size in pixels
+    pub fn size(&self) -> (u32, u32) {
+        (self.width, self.height)
+    }
+
+    // Restart the debounce timer. The full redraw happens once no resize
+    // step has arrived for resize_debounce_ms.
+    fn schedule_resize_redraw(&mut self) {
+        if let Some(token) = self.resize_timer.take() {
+            self.loop_handle.remove(token);
+        }
+        let timer = Timer::from_duration(Duration::from_millis(self.resize_debounce_ms));
+        let inserted = self.loop_handle.insert_source(timer, |_, _, state| {
+            debug_log!("Resize settled - doing full redraw");
+            state.resize_timer = None;
+            state.request_redraw();
+            TimeoutAction::Drop
+        });
+        match inserted {
+            Ok(token) => self.resize_timer = Some(token),
+            Err(e) => {
+                debug_log!("Failed to start resize timer: {:?}", e.error);
+                self.request_redraw();
+            }
+        }
+    }
+
+    // The filter to scale the last full frame with while resizing, if the
+    // resize mode scales at all
+    fn resize_filter(&self) -> Option<ScaleFilter> {
+        match self.resize_mode {
+            ResizeMode::Fill => None,
+            ResizeMode::Scale { filter } | ResizeMode::Budgeted { filter, .. } => Some(filter),
+        }
+    }
+
+    // Have the compositor scale the attached buffer, the last full frame, to
+    // the new size. Nothing is rendered or uploaded.
+    fn present_scaled(&mut self, qh: &QueueHandle<Self>) -> bool {
+        let (Some(window), Some(viewport)) = (&self.window, &self.viewport) else {
+            return false;
+        };
+        if !self.presented_full || self.resize_filter().is_none() {
+            return false;
+        }
+        viewport.set_destination(self.width as i32, self.height as i32);
+        self.viewport_scaled = true;
+        window.wl_surface().frame(qh, window.wl_surface().clone());
+        self.frames.waiting = true;
+        window.wl_surface().commit();
+        debug_log!("Scaled last frame to {}x{} with wp_viewporter", self.width, self.height);
+        true
+    }
+
+    fn draw(&mut self, qh: &QueueHandle<Self>, skip_expensive: bool) {
         let draw_start = std::time::Instant::now();
 
+        if skip_expensive && self.present_scaled(qh) {
+            return;
+        }
+        let filter = self.resize_filter();
+
         let window = match &self.window {
             Some(w) => w,
             None => {
@@ -228,56 +424,86 @@ impl AppState {
             }
         };
 
-        let pool = match &mut self.pool {
-            Some(p) => p,
+        let swapchain = match &mut self.swapchain {
+            Some(s) => s,
             None => {
-                debug_log!("draw() called but pool is None");
+                debug_log!("draw() called but swapchain is None");
+                return;
+            }
+        };
+
+        // Take a buffer before rendering anything into the frame, so a frame
+        // is never rendered without somewhere to put it
+        let (buffer, pixels, stale) = match swapchain.acquire() {
+            Ok(Some(acquired)) => acquired,
+            Ok(None) => {
+                // Retried when the compositor releases a buffer
+                debug_log!("All buffers busy, deferring draw");
+                self.frames.dirty = true;
+                return;
+            }
+            Err(e) => {
+                debug_log!("Failed to create buffer: {}", e);
                 return;
             }
         };
 
-        let stride = self.width as i32 * 4;
         let buffer_size = (self.width * self.height * 4) as usize;
-        
-        // Check if buffer size changed (optimization: reuse buffer when size unchanged)
-        let size_changed = self.last_buffer_size != Some((self.width, self.height));
-        if size_changed {
-            debug_log!("Buffer size changed, creating new buffer: {}x{} ({}KB)", 
-                      self.width, self.height, buffer_size / 1024);
-            self.last_buffer_size = Some((self.width, self.height));
-        } else {
-            debug_log!("Reusing buffer: {}x{}", self.width, self.height);
+
+        // The first preview of a resize keeps the full frame to stretch from
+        if skip_expensive && self.frame_is_full && filter.is_some() {
+            let (width, height) = self.frame_size;
+            self.resize_source = Some(Snapshot {
+                pixels: std::mem::take(&mut self.frame),
+                width,
+                height,
+            });
+            self.frame_is_full = false;
         }
 
-        let (buffer, canvas_buffer) = pool
-            .create_buffer(
-                self.width as i32,
-                self.height as i32,
-                stride,
-                wl_shm::Format::Argb8888,
-            )
-            .expect("Failed to create buffer");
+        // A new size invalidates the retained frame
+        if self.frame.len() != buffer_size {
+            self.frame = vec![0; buffer_size];
+            self.frame_size = (self.width, self.height);
+            self.pending_damage = DamageRegion::full(self.width, self.height);
+        }
 
-        if skip_expensive {
+        let mut opaque = [Rect::new(0, 0, 0, 0); MAX_RECTS];
+        let mut opaque_count = 0;
+        let damage = if skip_expensive {
             debug_log!("Fast draw (skipping expensive rendering)");
-            // During resize, just fill with solid background color for performance
-            let bg_color = if self.transparent {
-                Color::TRANSPARENT
-            } else {
-                Color::rgb(40, 40, 40)
-            };
-            
-            for pixel in canvas_buffer.chunks_exact_mut(4) {
-                pixel[0] = bg_color.b;  // B
-                pixel[1] = bg_color.g;  // G
-                pixel[2] = bg_color.r;  // R
-                pixel[3] = bg_color.a;  // A
+            match (&self.resize_source, filter) {
+                (Some(source), Some(filter)) => stretch(
+                    &mut self.frame,
+                    self.width,
+                    self.height,
+                    &source.pixels,
+                    source.width,
+                    source.height,
+                    filter,
+                ),
+                _ => {
+                    // Nothing to scale; fill with a solid background color
+                    let bg_color = if self.transparent {
+                        Color::TRANSPARENT
+                    } else {
+                        Color::rgb(40, 40, 40)
+                    };
+                    Canvas::new(&mut self.frame, self.width, self.height).clear(bg_color);
+                }
+            }
+            self.frame_is_full = false;
+            if !self.transparent {
+                opaque[0] = Rect::new(0, 0, self.width as i32, self.height as i32);
+                opaque_count = 1;
             }
+
+            // The placeholder must be fully replaced by the next real draw
+            self.pending_damage = DamageRegion::full(self.width, self.height);
+            DamageRegion::full(self.width, self.height)
         } else {
-            debug_log!("Full draw with effects");
             let canvas_start = std::time::Instant::now();
-            
-            let mut canvas = Canvas::new(canvas_buffer, self.width, self.height);
+            self.frames.dirty = false;
 
             // Clear background - use transparent if configured
             let bg_color = if self.transparent {
@@ -285,28 +511,122 @@ impl AppState {
             } else {
                 Color::BG_PRIMARY
             };
-            canvas.clear(bg_color);
 
-            // Call user draw function
+            // Always record: the list is culled against opaque regions before
+            // anything is rasterized. With one thread the tiled renderer just
+            // replays it inline.
+            let mut canvas = RecordingCanvas::with_list(
+                self.width,
+                self.height,
+                self.pending_damage.take(),
+                std::mem::take(&mut self.display_list),
+            );
+            canvas.set_background(bg_color);
+
+            // Call user draw function; it reports what changed through
+            // Canvas::add_damage, and all painting is clipped to that
             if let Some(ref mut draw_fn) = self.draw_fn {
+                let _scope = profiler::scope("frame.record");
                 draw_fn(&mut canvas);
             }
-            
+            profiler::draw_overlay(&mut canvas);
+
+            // An opaque background covers the whole surface no matter what
+            // the draw function reported
+            if bg_color.a == 255 {
+                opaque[0] = Rect::new(0, 0, self.width as i32, self.height as i32);
+                opaque_count = 1;
+            } else {
+                opaque_count = canvas.opaque_region().len();
+                opaque[..opaque_count].copy_from_slice(canvas.opaque_region());
+            }
+
+            let (list, damage) = canvas.finish();
+            {
+                let _scope = profiler::scope("frame.rasterize");
+                self.tiles
+                    .render(&mut self.frame, self.width, self.height, &damage, &list);
+            }
+            self.display_list = list;
+
             let canvas_elapsed = canvas_start.elapsed();
             debug_log!("Canvas rendering took: {:.2}ms", canvas_elapsed.as_secs_f64() * 1000.0);
+            self.last_full_draw = canvas_elapsed;
+            self.frame_is_full = true;
+            self.resize_source = None;
+            damage
+        };
+
+        if damage.is_empty() {
+            debug_log!("Nothing damaged, skipping commit");
+            return;
+        }
+        debug_log!("Damaged {} rect(s), {} px", damage.rects().len(), damage.area());
+
+        // The buffer last held the frame from a few draws ago. Only what
+        // changed since then, and in this draw, is copied into it.
+        let copy_scope = profiler::scope("frame.copy");
+        let mut copy = stale.clone();
+        copy.union(&damage);
+        for rect in copy.rects() {
+            copy_rect(pixels, &self.frame, self.width, rect);
+        }
+        drop(copy_scope);
+        debug_log!("Copied {} rect(s), {} px into buffer", copy.rects().len(), copy.area());
+        if let Err(e) = buffer.attach_to(window.wl_surface()) {
+            debug_log!("Failed to attach buffer: {:?}", e);
+            return;
+        }
+        let commit_scope = profiler::scope("frame.commit");
+        swapchain.presented(&damage);
+        self.presented_full = !skip_expensive;
+        if self.viewport_scaled {
+            if let Some(viewport) = &self.viewport {
+                viewport.set_destination(-1, -1);
+            }
+            self.viewport_scaled = false;
         }
 
-        window.wl_surface().attach(Some(buffer.wl_buffer()), 0, 0);
+        // Lets the compositor skip blending and drawing what's beneath us
+        let opaque = &opaque[..opaque_count];
+        if self.opaque_region != opaque {
+            match Region::new(&self.compositor_state) {
+                Ok(region) => {
+                    for rect in opaque {
+                        region.add(rect.x, rect.y, rect.width, rect.height);
+                    }
+                    window.wl_surface().set_opaque_region(Some(region.wl_region()));
+                    self.opaque_region.clear();
+                    self.opaque_region.extend_from_slice(opaque);
+                    debug_log!("Opaque region: {} rect(s)", opaque.len());
+                }
+                Err(e) => debug_log!("Failed to create opaque region: {:?}", e),
+            }
+        }
         
-        // Use damage_buffer for more efficient updates (only redraw changed regions)
-        // For now, damage the entire buffer, but this could be optimized with dirty region tracking
-        window
-            .wl_surface()
-            .damage_buffer(0, 0, self.width as i32, self.height as i32);
+        // Only the damaged rects need to be re-uploaded by the compositor
+        for rect in damage.rects() {
+            window
+                .wl_surface()
+                .damage_buffer(rect.x, rect.y, rect.width, rect.height);
+        }
+        // Nothing more is drawn until this frame is on screen
+        window.wl_surface().frame(qh, window.wl_surface().clone());
+        self.frames.waiting = true;
+        if let Some(presentation) = &self.presentation {
+            presentation.feedback(window.wl_surface(), qh, (self.frames.drawn + 1, Instant::now()));
+        }
         window.wl_surface().commit();
-        
+        drop(commit_scope);
+
+        self.frames.drawn += 1;
         let draw_elapsed = draw_start.elapsed();
-        debug_log!("Total draw() took: {:.2}ms", draw_elapsed.as_secs_f64() * 1000.0);
+        profiler::end_frame(self.frames.drawn, draw_elapsed);
+        debug_log!(
+            "Total draw() took: {:.2}ms (frame {})",
+            draw_elapsed.as_secs_f64() * 1000.0,
+            self.frames.drawn
+        );
     }
 }
 
@@ -332,32 +652,13 @@ impl CompositorHandler for AppState {
     fn frame(
         &mut self,
         _conn: &Connection,
-        qh: &QueueHandle<Self>,
+        _qh: &QueueHandle<Self>,
         _surface: &wl_surface::WlSurface,
         time: u32,
     ) {
-        debug_log!("frame() callback: time={}, was_resizing={}", time, self.is_resizing);
-        
-        // Check if enough time has passed since last resize
-        if self.is_resizing {
-            let elapsed = self.last_resize_time.elapsed();
-            if elapsed.as_millis() < self.resize_debounce_ms as u128 {
-                debug_log!("Resize debounce: waiting {}ms more", 
-                          self.resize_debounce_ms as u128 - elapsed.as_millis());
-                // Still resizing, request another frame callback
-                if let Some(window) = &self.window {
-                    window.wl_surface().frame(qh, window.wl_surface().clone());
-                }
-                return;
-            }
-            
-            // Resize settled, do full redraw
-            debug_log!("Resize settled - doing full redraw");
-            self.is_resizing = false;
-        }
-        
-        // Full redraw
-        self.draw(qh, false);
+        debug_log!("frame() callback: time={}, dirty={}", time, self.frames.dirty);
+        // The run loop draws next if anything was invalidated meanwhile
+        self.frames.waiting = false;
     }
 
     fn surface_enter(
@@ -412,6 +713,7 @@ impl OutputHandler for AppState {
 impl WindowHandler for AppState {
     fn request_close(&mut self, _: &Connection, _: &QueueHandle<Self>, _: &XdgWindow) {
         debug_log!("Window close requested");
+        profiler::write_trace();
         std::process::exit(0);
     }
 
@@ -443,24 +745,31 @@ impl WindowHandler for AppState {
             }
         }
 
-        // Recreate pool if size changed or pool doesn't exist
-        if self.pool.is_none() || size_changed {
-            let pool_size = (self.width * self.height * 4) as usize;
-            debug_log!("Creating new pool: {} bytes", pool_size);
-            self.pool = Some(
-                SlotPool::new(pool_size, &self.shm_state)
-                    .expect("Failed to create pool"),
-            );
+        // Buffers are reused until the size changes; the pool only grows
+        match &mut self.swapchain {
+            Some(swapchain) => swapchain.resize(self.width, self.height),
+            None => {
+                self.swapchain = Some(
+                    Swapchain::new(&self.shm_state, self.width, self.height)
+                        .expect("Failed to create pool"),
+                );
+            }
         }
 
-        // During resize, use fast draw (skip expensive rendering)
+        // During resize, use fast draw (skip expensive rendering) unless a
+        // full one is known to fit the budget
         if size_changed {
-            debug_log!("Size changed - using fast draw");
-            self.is_resizing = true;
-            self.last_resize_time = std::time::Instant::now();
-            self.draw(qh, true); // Skip expensive rendering
-            
-            // Don't request frame callback here - let the timer handle it
+            self.schedule_resize_redraw();
+            match self.resize_mode {
+                ResizeMode::Budgeted { budget, .. } if self.last_full_draw <= budget => {
+                    debug_log!("Size changed - full draw fits the budget");
+                    self.draw(qh, false);
+                }
+                _ => {
+                    debug_log!("Size changed - using fast draw");
+                    self.draw(qh, true);
+                }
+            }
         } else {
             debug_log!("Initial configure - using full draw");
             // Initial configure or state change - do full draw
@@ -484,6 +793,61 @@ delegate_seat!(AppState);
 delegate_pointer!(AppState);
 delegate_registry!(AppState);
 
+// wp_viewporter and wp_viewport send no events
+impl Dispatch<WpViewporter, ()> for AppState {
+    fn event(
+        _: &mut Self,
+        _: &WpViewporter,
+        _: wp_viewporter::Event,
+        _: &(),
+        _: &Connection,
+        _: &QueueHandle<Self>,
+    ) {
+    }
+}
+
+impl Dispatch<WpPresentation, ()> for AppState {
+    fn event(
+        _: &mut Self,
+        _: &WpPresentation,
+        _: wp_presentation::Event,
+        _: &(),
+        _: &Connection,
+        _: &QueueHandle<Self>,
+    ) {
+    }
+}
+
+// Tagged with the frame number and when it was committed. Latency is taken
+// when the event arrives rather than from its timestamp, which is in a
+// clock Instant can't be compared against.
+impl Dispatch<WpPresentationFeedback, (u64, Instant)> for AppState {
+    fn event(
+        _: &mut Self,
+        _: &WpPresentationFeedback,
+        event: wp_presentation_feedback::Event,
+        &(frame, committed): &(u64, Instant),
+        _: &Connection,
+        _: &QueueHandle<Self>,
+    ) {
+        if let wp_presentation_feedback::Event::Presented { .. } = event {
+            profiler::presented(frame, committed.elapsed());
+        }
+    }
+}
+
+impl Dispatch<WpViewport, ()> for AppState {
+    fn event(
+        _: &mut Self,
+        _: &WpViewport,
+        _: wp_viewport::Event,
+        _: &(),
+        _: &Connection,
+        _: &QueueHandle<Self>,
+    ) {
+    }
+}
+
 impl ProvidesRegistryState for AppState {
     fn registry(&mut self) -> &mut RegistryState {
         &mut self.registry_state
@@ -4,10 +4,18 @@ pub mod core;
 pub use core::canvas::Canvas;
 pub use core::color::Color;
 pub use core::dialog::Dialog;
+pub use core::display_list::{DisplayList, RecordingCanvas};
+pub use core::gradient::Gradient;
+pub use core::retained::RetainedTree;
+pub use core::rounded::{Border, CornerRadii};
 pub use core::text::TextRenderer;
 pub use core::ui::*;
-pub use core::window::{Window, WindowConfig};
+pub use core::stretch::ScaleFilter;
+pub use core::window::{AppState, ResizeMode, Window, WindowConfig};
 pub use core::rsx::*;
 
 // Re-export glam for convenience
 pub use glam::{Vec2, Vec3, Vec4, Mat4};
+
+// Event sources for Window::loop_handle
+pub use smithay_client_toolkit::reexports::calloop;